@@ -699,12 +699,20 @@ static void insert_edges_into_graph(char * variable_buffer, unsigned int num_nod
 	unsigned int i, j, k, offset, slice, index, delta, next, diff, dest_index, src_index;
 	float sub_graph[MAX_STATES * MAX_STATES];
 	float transpose[MAX_STATES * MAX_STATES];
+	unsigned int parents[MAX_DEGREE];
 
 	assert(num_node_names > 1);
+	assert(num_node_names - 1 <= MAX_DEGREE);
 
 	dest_index = find_node_by_name(variable_buffer, graph);
 	slice = num_probabilities / graph->node_num_vars[dest_index];
 
+	//keep the full table for exact inference
+	for(i = 1; i < num_node_names; ++i){
+		parents[i - 1] = find_node_by_name(&(variable_buffer[i * CHAR_BUFFER_SIZE]), graph);
+	}
+	graph_set_node_factor(graph, dest_index, parents, num_node_names - 1, probability_buffer);
+
     /*
 	printf("Values for sinK: %s\n", variable_buffer);
 	for(i = 0; i < num_probabilities; ++i){
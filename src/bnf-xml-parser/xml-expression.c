@@ -340,6 +340,7 @@ static void add_edges_to_graph(xmlDocPtr doc, xmlNodePtr definition, Graph_t gra
 
     float sub_graph[MAX_STATES * MAX_STATES];
     float transpose[MAX_STATES * MAX_STATES];
+    unsigned int parents[MAX_DEGREE];
 
     // check if edge or observed node
     result = get_subnode_set(doc, (xmlChar *)".//GIVEN/text()", definition);
@@ -360,6 +361,16 @@ static void add_edges_to_graph(xmlDocPtr doc, xmlNodePtr definition, Graph_t gra
     //assert(dest_index < graph->current_num_vertices);
     slice = num_probabilities / graph->node_num_vars[dest_index];
 
+    //keep the full table for exact inference
+    assert(node_set->nodeNr <= MAX_DEGREE);
+    for(i = 0; i < node_set->nodeNr; ++i){
+        value = xmlNodeListGetString(doc, node_set->nodeTab[i], 0);
+        strncpy(src_node_name, (char *)value, CHAR_BUFFER_SIZE);
+        xmlFree(value);
+        parents[i] = find_node_by_name(src_node_name, graph);
+    }
+    graph_set_node_factor(graph, dest_index, parents, (unsigned int)node_set->nodeNr, total_probabilities);
+
     offset = 1;
     for(i = node_set->nodeNr - 1; i >= 0; --i){
         value = xmlNodeListGetString(doc, node_set->nodeTab[i], 0);
@@ -20,6 +20,12 @@
 
 #define PRECISION 1E-3f
 
+#define DAMPING_STEP 0.1f
+
+#define MAX_DAMPING 0.9f
+
+#define DAMPING_PATIENCE 5
+
 #define BLOCK_SIZE 1024
 
 #define BLOCK_SIZE_2_D_X 64
@@ -38,6 +44,24 @@
 
 #define MAX_DEGREE 20
 
+#define MAX_COLORS (2 * MAX_DEGREE + 1)
+
+#define SPLASH_SIZE 32
+
+#define COMPONENT_BATCH_SIZE 1024
+
+#define EVIDENCE_BATCH_SIZE 64
+
+#define OVERLAY_PAGE_SIZE 64
+
+#define NUM_PARTITIONS 4
+
+#define L2_CACHE_SIZE (256 * 1024)
+
+#define LOCAL_ITERATIONS 4
+
+#define MAX_CLIQUE_SIZE 4194304
+
 #define CHARS_IN_KEY 20
 
 #endif /* CONSTANTS_H_ */
@@ -76,17 +76,17 @@ void send_message_for_edge_cuda(float * buffer, unsigned int edge_index, float *
     num_dest = y_dim[edge_index];
 
     sum = 0.0;
-    for(i = 0; i < num_src; ++i){
+    for(i = 0; i < num_dest; ++i){
         partial_sums[threadIdx.x * MAX_STATES + i] = 0.0;
-        for(j = 0; j < num_dest; ++j){
-            partial_sums[threadIdx.x * MAX_STATES + i] += joint_probabilities[MAX_STATES * MAX_STATES * edge_index + MAX_STATES * i + j] * buffer[j];
+        for(j = 0; j < num_src; ++j){
+            partial_sums[threadIdx.x * MAX_STATES + i] += joint_probabilities[MAX_STATES * MAX_STATES * edge_index + MAX_STATES * j + i] * buffer[j];
         }
         sum += partial_sums[threadIdx.x * MAX_STATES + i];
     }
     if(sum <= 0.0){
         sum = 1.0;
     }
-    for(i = 0; i < num_src; ++i){
+    for(i = 0; i < num_dest; ++i){
         edge_messages[edge_index * MAX_STATES + i] = partial_sums[threadIdx.x * MAX_STATES + i] / sum;
     }
 }
@@ -200,17 +200,17 @@ static void send_message_for_edge_iteration_cuda(float * belief, unsigned int sr
     num_dest = dim_dest[edge_index];
 
     sum = 0.0;
-    for(i = 0; i < num_src; ++i){
+    for(i = 0; i < num_dest; ++i){
         partial_sums[MAX_STATES * threadIdx.x + i] = 0.0;
-        for(j = 0; j < num_dest; ++j){
-            partial_sums[MAX_STATES * threadIdx.x + i] += joint_probabilities[MAX_STATES * MAX_STATES * edge_index + MAX_STATES * i + j] * belief[MAX_STATES * src_index + j];
+        for(j = 0; j < num_src; ++j){
+            partial_sums[MAX_STATES * threadIdx.x + i] += joint_probabilities[MAX_STATES * MAX_STATES * edge_index + MAX_STATES * j + i] * belief[MAX_STATES * src_index + j];
         }
         sum += partial_sums[MAX_STATES * threadIdx.x + i];
     }
     if(sum <= 0.0){
         sum = 1.0;
     }
-    for (i = 0; i < num_src; ++i) {
+    for (i = 0; i < num_dest; ++i) {
         edge_messages[edge_index * MAX_STATES + i] = partial_sums[MAX_STATES * threadIdx.x + i] / sum;
     }
 }
@@ -282,12 +282,12 @@ void marginalize_loop_node_edge_kernel(float * belief, unsigned int * num_vars,
 }
 
 __device__
-float calculate_local_delta(unsigned int i, float * previous_messages, float * current_messages, unsigned int * x_dim){
+float calculate_local_delta(unsigned int i, float * previous_messages, float * current_messages, unsigned int * y_dim){
     float delta, diff;
     unsigned int k, num_messages;
 
     delta = 0.0;
-    num_messages = x_dim[i];
+    num_messages = y_dim[i];
 
     for(k = 0; k < num_messages; ++k){
         diff = previous_messages[MAX_STATES * i + k] - current_messages[MAX_STATES * i + k];
@@ -302,7 +302,7 @@ float calculate_local_delta(unsigned int i, float * previous_messages, float * c
 
 __global__
 void calculate_delta(float * previous_messages, float * current_messages, float * delta, float * delta_array,
-                     unsigned int * x_dim,
+                     unsigned int * y_dim,
                      unsigned int num_edges){
     extern __shared__ float shared_delta[];
     unsigned int tid, idx, i, s;
@@ -312,7 +312,7 @@ void calculate_delta(float * previous_messages, float * current_messages, float
     i = blockIdx.x * (blockDim.x * 2) + threadIdx.x;
 
     if(idx < num_edges){
-        delta_array[idx] = calculate_local_delta(idx, previous_messages, current_messages, x_dim);
+        delta_array[idx] = calculate_local_delta(idx, previous_messages, current_messages, y_dim);
     }
     __syncthreads();
 
@@ -377,7 +377,7 @@ void calculate_delta(float * previous_messages, float * current_messages, float
 
 __global__
 void calculate_delta_6(float * previous_messages, float * current_messages, float * delta, float * delta_array,
-                       unsigned int * edges_x_dim,
+                       unsigned int * edges_y_dim,
                        unsigned int num_edges, char n_is_pow_2, unsigned int warp_size) {
     extern __shared__ float shared_delta[];
 
@@ -390,7 +390,7 @@ void calculate_delta_6(float * previous_messages, float * current_messages, floa
     unsigned int grid_size = blockDim.x * 2 * gridDim.x;
 
     if(idx < num_edges){
-        delta_array[idx] = calculate_local_delta(idx, previous_messages, current_messages, edges_x_dim);
+        delta_array[idx] = calculate_local_delta(idx, previous_messages, current_messages, edges_y_dim);
     }
     __syncthreads();
 
@@ -476,7 +476,7 @@ void calculate_delta_6(float * previous_messages, float * current_messages, floa
 
 __global__
 void calculate_delta_simple(float * previous_messages, float * current_messages,
-                            float * delta, float * delta_array, unsigned int * x_dim,
+                            float * delta, float * delta_array, unsigned int * y_dim,
                             unsigned int num_edges) {
     extern __shared__ float shared_delta[];
     unsigned int tid, idx, i, s;
@@ -485,7 +485,7 @@ void calculate_delta_simple(float * previous_messages, float * current_messages,
     idx = blockIdx.x * blockDim.x + threadIdx.x;
 
     if (idx < num_edges) {
-        delta_array[idx] = calculate_local_delta(idx, previous_messages, current_messages, x_dim);
+        delta_array[idx] = calculate_local_delta(idx, previous_messages, current_messages, y_dim);
     }
     __syncthreads();
 
@@ -617,9 +617,9 @@ unsigned int loopy_propagate_until_cuda(Graph_t graph, float convergence, unsign
             previous_messages = temp;
             num_iter++;
         }
-        calculate_delta_6<<<dimReduceGrid, dimReduceBlock, reduceSmemSize>>>(previous_messages, current_messages, delta, delta_array, edges_x_dim, num_edges, is_pow_2, WARP_SIZE);
-        //calculate_delta<<<dimReduceGrid, dimReduceBlock, reduceSmemSize>>>(previous_messages, current_messages, delta, delta_array, edges_x_dim, num_edges);
-        //calculate_delta_simple<<<dimReduceGrid, dimReduceBlock, reduceSmemSize>>>(previous_messages, current_messages, delta, delta_array, edges_x_dim, num_edges);
+        calculate_delta_6<<<dimReduceGrid, dimReduceBlock, reduceSmemSize>>>(previous_messages, current_messages, delta, delta_array, edges_y_dim, num_edges, is_pow_2, WARP_SIZE);
+        //calculate_delta<<<dimReduceGrid, dimReduceBlock, reduceSmemSize>>>(previous_messages, current_messages, delta, delta_array, edges_y_dim, num_edges);
+        //calculate_delta_simple<<<dimReduceGrid, dimReduceBlock, reduceSmemSize>>>(previous_messages, current_messages, delta, delta_array, edges_y_dim, num_edges);
         test_error();
         CUDA_CHECK_RETURN(cudaMemcpy(&host_delta, delta, sizeof(float), cudaMemcpyDeviceToHost));
      //   printf("Current delta: %f\n", host_delta);
@@ -743,9 +743,9 @@ unsigned int loopy_propagate_until_cuda_edge(Graph_t graph, float convergence, u
 
             num_iter++;
         }
-        calculate_delta_6<<<dimReduceGrid, dimReduceBlock, reduceSmemSize>>>(previous_messages, current_messages, delta, delta_array, num_src, num_edges, is_pow_2, WARP_SIZE);
-        //calculate_delta<<<dimReduceGrid, dimReduceBlock, reduceSmemSize>>>(previous_messages, current_messages, delta, delta_array, edges_x_dim, num_edges);
-        //calculate_delta_simple<<<dimReduceGrid, dimReduceBlock, reduceSmemSize>>>(previous_messages, current_messages, delta, delta_array, edges_x_dim, num_edges);
+        calculate_delta_6<<<dimReduceGrid, dimReduceBlock, reduceSmemSize>>>(previous_messages, current_messages, delta, delta_array, num_dest, num_edges, is_pow_2, WARP_SIZE);
+        //calculate_delta<<<dimReduceGrid, dimReduceBlock, reduceSmemSize>>>(previous_messages, current_messages, delta, delta_array, num_dest, num_edges);
+        //calculate_delta_simple<<<dimReduceGrid, dimReduceBlock, reduceSmemSize>>>(previous_messages, current_messages, delta, delta_array, num_dest, num_edges);
         test_error();
         CUDA_CHECK_RETURN(cudaMemcpy(&host_delta, delta, sizeof(float), cudaMemcpyDeviceToHost));
         //   printf("Current delta: %f\n", host_delta);
@@ -90,10 +90,10 @@ void send_message_for_edge_cuda(float * message_buffer, unsigned int edge_index,
     num_dest = y_dim[edge_index];
 
     sum = 0.0f;
-    for(i = 0; i < num_src; ++i){
+    for(i = 0; i < num_dest; ++i){
         partial_sum = 0.0;
-        for(j = 0; j < num_dest; ++j){
-            partial_sum += joint_probabilities[MAX_STATES * MAX_STATES * edge_index + MAX_STATES * i + j] * message_buffer[MAX_STATES * node_index + j];
+        for(j = 0; j < num_src; ++j){
+            partial_sum += joint_probabilities[MAX_STATES * MAX_STATES * edge_index + MAX_STATES * j + i] * message_buffer[MAX_STATES * node_index + j];
         }
         sum += partial_sum;
         edge_messages[edge_index * MAX_STATES + i] = partial_sum;
@@ -101,7 +101,7 @@ void send_message_for_edge_cuda(float * message_buffer, unsigned int edge_index,
     if(sum <= 0.0){
         sum = 1.0;
     }
-    for(i = 0; i < num_src; ++i){
+    for(i = 0; i < num_dest; ++i){
         edge_messages[edge_index * MAX_STATES + i] = edge_messages[edge_index * MAX_STATES + i] / sum;
     }
 }
@@ -206,13 +206,13 @@ void marginalize_sum_node_kernel(unsigned int * node_num_vars, float * message_b
 }
 
 __device__
-float calculate_local_delta(unsigned int i, float * previous_messages, float * current_messages, unsigned int * edges_x_dim){
+float calculate_local_delta(unsigned int i, float * previous_messages, float * current_messages, unsigned int * edges_y_dim){
     float delta, diff;
     unsigned int k;
 
     delta = 0.0;
 
-    for(k = 0; k < edges_x_dim[i]; ++k){
+    for(k = 0; k < edges_y_dim[i]; ++k){
         diff = previous_messages[MAX_STATES * i + k] - current_messages[MAX_STATES * i + k];
         if(diff != diff){
             diff = 0.0;
@@ -224,7 +224,7 @@ float calculate_local_delta(unsigned int i, float * previous_messages, float * c
 }
 
 __global__
-void calculate_delta(float * previous_messages, float * current_messages, float * delta, float * delta_array, unsigned int * edges_x_dim, unsigned int num_edges){
+void calculate_delta(float * previous_messages, float * current_messages, float * delta, float * delta_array, unsigned int * edges_y_dim, unsigned int num_edges){
     extern __shared__ float shared_delta[];
     unsigned int tid, idx, i, s;
 
@@ -233,7 +233,7 @@ void calculate_delta(float * previous_messages, float * current_messages, float
     i = blockIdx.x * (blockDim.x * 2) + threadIdx.x;
 
     if(idx < num_edges){
-        delta_array[idx] = calculate_local_delta(idx, previous_messages, current_messages, edges_x_dim);
+        delta_array[idx] = calculate_local_delta(idx, previous_messages, current_messages, edges_y_dim);
     }
     __syncthreads();
 
@@ -298,7 +298,7 @@ void calculate_delta(float * previous_messages, float * current_messages, float
 
 __global__
 void calculate_delta_6(float * previous_messages, float * current_messages, float * delta, float * delta_array,
-                       unsigned int * edges_x_dim,
+                       unsigned int * edges_y_dim,
                        unsigned int num_edges, char n_is_pow_2, unsigned int warp_size) {
     extern __shared__ float shared_delta[];
 
@@ -311,7 +311,7 @@ void calculate_delta_6(float * previous_messages, float * current_messages, floa
     unsigned int grid_size = blockDim.x * 2 * gridDim.x;
 
     if(idx < num_edges){
-        delta_array[idx] = calculate_local_delta(idx, previous_messages, current_messages, edges_x_dim);
+        delta_array[idx] = calculate_local_delta(idx, previous_messages, current_messages, edges_y_dim);
     }
     __syncthreads();
 
@@ -397,7 +397,7 @@ void calculate_delta_6(float * previous_messages, float * current_messages, floa
 
 __global__
 void calculate_delta_simple(float * previous_messages, float * current_messages,
-                            float * delta, float * delta_array, unsigned int * edges_x_dim,
+                            float * delta, float * delta_array, unsigned int * edges_y_dim,
                             unsigned int num_edges) {
     extern __shared__ float shared_delta[];
     unsigned int tid, idx, i, s;
@@ -406,7 +406,7 @@ void calculate_delta_simple(float * previous_messages, float * current_messages,
     idx = blockIdx.x * blockDim.x + threadIdx.x;
 
     if (idx < num_edges) {
-        delta_array[idx] = calculate_local_delta(idx, previous_messages, current_messages, edges_x_dim);
+        delta_array[idx] = calculate_local_delta(idx, previous_messages, current_messages, edges_y_dim);
     }
     __syncthreads();
 
@@ -572,9 +572,9 @@ unsigned int loopy_propagate_until_cuda(Graph_t graph, float convergence, unsign
             previous_messages = temp;
             num_iter++;
         }
-        calculate_delta_6<<<dimReduceGrid, dimReduceBlock, reduceSmemSize>>>(previous_messages, current_messages, delta, delta_array, edges_x_dim, num_edges, is_pow_2, WARP_SIZE);
-        //calculate_delta<<<dimReduceGrid, dimReduceBlock, reduceSmemSize>>>(previous_messages, current_messages, delta, delta_array, edges_x_dim, num_edges);
-        //calculate_delta_simple<<<dimReduceGrid, dimReduceBlock, reduceSmemSize>>>(previous_messages, current_messages, delta, delta_array, edges_x_dim, num_edges);
+        calculate_delta_6<<<dimReduceGrid, dimReduceBlock, reduceSmemSize>>>(previous_messages, current_messages, delta, delta_array, edges_y_dim, num_edges, is_pow_2, WARP_SIZE);
+        //calculate_delta<<<dimReduceGrid, dimReduceBlock, reduceSmemSize>>>(previous_messages, current_messages, delta, delta_array, edges_y_dim, num_edges);
+        //calculate_delta_simple<<<dimReduceGrid, dimReduceBlock, reduceSmemSize>>>(previous_messages, current_messages, delta, delta_array, edges_y_dim, num_edges);
         check_cuda_kernel_return_code();
         CUDA_CHECK_RETURN(cudaMemcpy(&host_delta, delta, sizeof(float), cudaMemcpyDeviceToHost));
      //   printf("Current delta: %f\n", host_delta);
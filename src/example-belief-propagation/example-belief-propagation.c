@@ -147,6 +147,27 @@ void forward_backward_belief_propagation() {
 
 }
 
+// loopy engines leave node_states at the priors, so beliefs come from the message query
+void print_loopy_beliefs(Graph_t graph){
+	unsigned int i, j, variable_name_index;
+	unsigned int nodes[NUM_NODES];
+	float beliefs[MAX_STATES * NUM_NODES];
+
+	for(i = 0; i < graph->current_num_vertices; ++i){
+		nodes[i] = i;
+	}
+	marginalize_loopy_nodes(graph, nodes, graph->current_num_vertices, beliefs);
+
+	for(i = 0; i < graph->current_num_vertices; ++i){
+		printf("Node %s [\n", &graph->node_names[i * CHAR_BUFFER_SIZE]);
+		for(j = 0; j < graph->node_num_vars[i]; ++j){
+			variable_name_index = i * CHAR_BUFFER_SIZE * MAX_STATES + j * CHAR_BUFFER_SIZE;
+			printf("%s:\t%.6lf\n", &graph->variable_names[variable_name_index], beliefs[MAX_STATES * i + j]);
+		}
+		printf("]\n");
+	}
+}
+
 void loopy_belief_propagation() {
 	Graph_t graph;
 
@@ -166,7 +187,7 @@ void loopy_belief_propagation() {
     loopy_propagate_until(graph, 1E-9, 10000);
 
 
-    print_nodes(graph);
+    print_loopy_beliefs(graph);
 
 
 	graph_destroy(graph);
@@ -3,6 +3,9 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "graph.h"
 
@@ -34,6 +37,12 @@ create_graph(unsigned int num_vertices, unsigned int num_edges)
 	assert(g->node_states);
 	g->node_num_vars = (unsigned int *)malloc(sizeof(unsigned int) * num_vertices);
 	assert(g->node_num_vars);
+	g->node_factors = (float **)calloc(sizeof(float *), (size_t)num_vertices);
+	assert(g->node_factors);
+	g->node_parents = (unsigned int *)malloc(sizeof(unsigned int) * MAX_DEGREE * num_vertices);
+	assert(g->node_parents);
+	g->node_num_parents = (unsigned int *)calloc(sizeof(unsigned int), (size_t)num_vertices);
+	assert(g->node_num_parents);
 	g->src_nodes_to_edges_node_list = (unsigned int *)malloc(sizeof(unsigned int) * num_vertices);
 	assert(g->src_nodes_to_edges_node_list);
 	g->src_nodes_to_edges_edge_list = (unsigned int *)malloc(sizeof(unsigned int) * num_edges);
@@ -52,10 +61,32 @@ create_graph(unsigned int num_vertices, unsigned int num_edges)
 	assert(g->variable_names);
     g->levels_to_nodes = (unsigned int *)malloc(sizeof(unsigned int) * 2 * num_vertices);
     assert(g->levels_to_nodes != NULL);
+    g->node_levels = (unsigned int *)malloc(sizeof(unsigned int) * num_vertices);
+    assert(g->node_levels != NULL);
 	
 	g->current_edge_messages = &g->edges_messages;
     g->previous_edge_messages = &g->last_edges_messages;
 
+	g->node_colors = NULL;
+	g->colors_to_nodes_color_list = NULL;
+	g->colors_to_nodes_node_list = NULL;
+	g->num_colors = 0;
+	g->node_components = NULL;
+	g->components_to_nodes_component_list = NULL;
+	g->components_to_nodes_node_list = NULL;
+	g->num_components = 0;
+	g->node_partitions = NULL;
+	g->partitions_to_nodes_partition_list = NULL;
+	g->partitions_to_nodes_node_list = NULL;
+	g->num_partitions = 0;
+
+	g->work_ranges = NULL;
+	g->num_work_ranges = 0;
+	g->node_is_work_hub = NULL;
+	g->work_hubs = NULL;
+	g->num_work_hubs = 0;
+	g->work_hub_partials = NULL;
+
     g->node_hash_table_created = 0;
     g->edge_tables_created = 0;
 
@@ -80,7 +111,7 @@ void initialize_node(Graph_t graph, unsigned int node_index, unsigned int num_va
 
 void init_edge(Graph_t graph, unsigned int edge_index, unsigned int src_index, unsigned int dest_index, unsigned int dim_x,
 			   unsigned int dim_y, float * joint_probabilities){
-	int i, j;
+	unsigned int i, j;
 
 	assert(src_index >= 0);
 	assert(dest_index >= 0);
@@ -100,8 +131,10 @@ void init_edge(Graph_t graph, unsigned int edge_index, unsigned int src_index, u
         for(j = 0; j < dim_y; ++j){
             graph->edges_joint_probabilities[MAX_STATES * MAX_STATES * edge_index + MAX_STATES * i + j] = joint_probabilities[MAX_STATES * i + j];
         }
-		graph->edges_messages[MAX_STATES * edge_index + i] = 0;
-		graph->last_edges_messages[MAX_STATES * edge_index + i] = 0;
+    }
+    for(j = 0; j < dim_y; ++j){
+		graph->edges_messages[MAX_STATES * edge_index + j] = 0;
+		graph->last_edges_messages[MAX_STATES * edge_index + j] = 0;
     }
 }
 
@@ -146,6 +179,88 @@ void graph_set_node_state(Graph_t g, unsigned int node_index, unsigned int num_s
 	node_set_state(g, node_index, num_states, state);
 }
 
+/**
+ * Keeps the full CPT of a node. Entries are laid out with the node's own state slowest and the parents in the given order,
+ * the last parent varying fastest; this is the layout both parsers read their tables in.
+ * XML files may hold one table per parent for the same node; later tables are multiplied in, widening the scope.
+ */
+void graph_set_node_factor(Graph_t g, unsigned int node_index, unsigned int * parents, unsigned int num_parents, float * probabilities){
+	unsigned int i, j, k, entry, old_num_parents, new_num_parents, num_probabilities, old_index, new_index;
+	unsigned int scope[MAX_DEGREE];
+	unsigned int digits[MAX_DEGREE];
+	unsigned int positions[MAX_DEGREE];
+	float * old_factor;
+	float * factor;
+
+	assert(node_index < g->current_num_vertices);
+	assert(num_parents <= MAX_DEGREE);
+
+	old_factor = g->node_factors[node_index];
+	old_num_parents = 0;
+	if(old_factor != NULL){
+		old_num_parents = g->node_num_parents[node_index];
+	}
+
+	//combined scope: the existing parents, then any new ones
+	new_num_parents = old_num_parents;
+	for(i = 0; i < old_num_parents; ++i){
+		scope[i] = g->node_parents[MAX_DEGREE * node_index + i];
+	}
+	for(i = 0; i < num_parents; ++i){
+		assert(parents[i] < g->current_num_vertices);
+		for(j = 0; j < new_num_parents; ++j){
+			if(scope[j] == parents[i]){
+				break;
+			}
+		}
+		if(j == new_num_parents){
+			assert(new_num_parents < MAX_DEGREE);
+			scope[new_num_parents] = parents[i];
+			new_num_parents += 1;
+		}
+		positions[i] = j;
+	}
+
+	num_probabilities = g->node_num_vars[node_index];
+	for(i = 0; i < new_num_parents; ++i){
+		num_probabilities *= g->node_num_vars[scope[i]];
+	}
+
+	factor = (float *)malloc(sizeof(float) * num_probabilities);
+	assert(factor);
+
+	for(entry = 0; entry < num_probabilities; ++entry){
+		//decode the entry into per-parent states, last parent fastest
+		k = entry;
+		for(i = new_num_parents; i > 0; --i){
+			digits[i - 1] = k % g->node_num_vars[scope[i - 1]];
+			k /= g->node_num_vars[scope[i - 1]];
+		}
+
+		new_index = k;
+		for(i = 0; i < num_parents; ++i){
+			new_index = new_index * g->node_num_vars[parents[i]] + digits[positions[i]];
+		}
+		factor[entry] = probabilities[new_index];
+
+		if(old_factor != NULL){
+			old_index = k;
+			for(i = 0; i < old_num_parents; ++i){
+				old_index = old_index * g->node_num_vars[scope[i]] + digits[i];
+			}
+			factor[entry] *= old_factor[old_index];
+		}
+	}
+
+	for(i = 0; i < new_num_parents; ++i){
+		g->node_parents[MAX_DEGREE * node_index + i] = scope[i];
+	}
+	g->node_num_parents[node_index] = new_num_parents;
+
+	free(old_factor);
+	g->node_factors[node_index] = factor;
+}
+
 void graph_add_edge(Graph_t graph, unsigned int src_index, unsigned int dest_index, unsigned int dim_x, unsigned int dim_y, float * joint_probabilities) {
 	unsigned int edge_index;
     ENTRY src_e, *src_ep;
@@ -368,6 +483,26 @@ void graph_destroy(Graph_t g) {
 	free(g->observed_nodes);
 	free(g->variable_names);
 	free(g->levels_to_nodes);
+	free(g->node_levels);
+	free(g->node_colors);
+	free(g->colors_to_nodes_color_list);
+	free(g->colors_to_nodes_node_list);
+	free(g->node_components);
+	free(g->components_to_nodes_component_list);
+	free(g->components_to_nodes_node_list);
+	free(g->node_partitions);
+	free(g->partitions_to_nodes_partition_list);
+	free(g->partitions_to_nodes_node_list);
+	free(g->work_ranges);
+	free(g->node_is_work_hub);
+	free(g->work_hubs);
+	free(g->work_hub_partials);
+	for(i = 0; i < g->current_num_vertices; ++i){
+		free(g->node_factors[i]);
+	}
+	free(g->node_factors);
+	free(g->node_parents);
+	free(g->node_num_parents);
 	free(g->node_num_vars);
 	free(g->node_states);
 	free(g);
@@ -385,6 +520,7 @@ void propagate_using_levels_start(Graph_t g){
 	else{
 		level_end_index = g->levels_to_nodes[1];
 	}
+#pragma omp parallel for default(none) shared(g, level_start_index, level_end_index, num_vertices) private(i, k, node_index, edge_index, start_index, end_index) schedule(dynamic, 16)
 	for(k = level_start_index; k < level_end_index; ++k){
 		node_index = g->levels_to_nodes[k];
 		//set as visited
@@ -423,30 +559,64 @@ void propagate_using_levels_start(Graph_t g){
 	}
 }
 
-void send_message(float * states, unsigned int offset, unsigned int edge_index, float * edge_joint_probabilities, float * edge_messages, unsigned int * edge_num_src,
-				  unsigned int * edge_num_dest){
-	unsigned int i, j, num_src, num_dest;
-	float sum;
+// message = joint^T * belief over the nonzero beliefs only; a one-hot belief (hard evidence) is a column copy
+#pragma acc routine
+static inline void transfer_belief(float * joint, float * belief, unsigned int num_src, unsigned int num_dest, float * message){
+	unsigned int i, j, k, num_nonzero;
+	unsigned int nonzero[MAX_STATES];
+	float sum, partial_sum;
 
-	num_src = edge_num_src[edge_index];
-	num_dest = edge_num_dest[edge_index];
+	num_nonzero = 0;
+	for(j = 0; j < num_src; ++j){
+		if(belief[j] != 0.0f){
+			nonzero[num_nonzero] = j;
+			num_nonzero += 1;
+		}
+	}
 
 	sum = 0.0;
-	for(i = 0; i < num_src; ++i){
-		edge_messages[MAX_STATES * edge_index + i] = 0.0;
-		for(j = 0; j < num_dest; ++j){
-			edge_messages[MAX_STATES * edge_index + i] += edge_joint_probabilities[MAX_STATES * MAX_STATES * edge_index + MAX_STATES * i + j] * states[offset + j];
+	if(num_nonzero == 1){
+		j = nonzero[0];
+		for(i = 0; i < num_dest; ++i){
+			message[i] = joint[MAX_STATES * j + i];
+			sum += message[i];
+		}
+	}
+	else if(num_nonzero < num_src){
+		for(i = 0; i < num_dest; ++i){
+			partial_sum = 0.0;
+			for(k = 0; k < num_nonzero; ++k){
+				j = nonzero[k];
+				partial_sum += joint[MAX_STATES * j + i] * belief[j];
+			}
+			message[i] = partial_sum;
+			sum += partial_sum;
+		}
+	}
+	else{
+		for(i = 0; i < num_dest; ++i){
+			partial_sum = 0.0;
+			for(j = 0; j < num_src; ++j){
+				partial_sum += joint[MAX_STATES * j + i] * belief[j];
+			}
+			message[i] = partial_sum;
+			sum += partial_sum;
 		}
-		sum += edge_messages[MAX_STATES * edge_index + i];
 	}
 	if(sum <= 0.0){
 		sum = 1.0;
 	}
-	for (i = 0; i < num_src; ++i) {
-		edge_messages[MAX_STATES * edge_index + i] = edge_messages[MAX_STATES * edge_index + i] / sum;
+	for(i = 0; i < num_dest; ++i){
+		message[i] = message[i] / sum;
 	}
 }
 
+void send_message(float * states, unsigned int offset, unsigned int edge_index, float * edge_joint_probabilities, float * edge_messages, unsigned int * edge_num_src,
+				  unsigned int * edge_num_dest){
+	transfer_belief(edge_joint_probabilities + MAX_STATES * MAX_STATES * edge_index, states + offset, edge_num_src[edge_index], edge_num_dest[edge_index],
+					edge_messages + MAX_STATES * edge_index);
+}
+
 #pragma acc routine
 static inline void combine_message(float * dest, float * src, unsigned int length, unsigned int offset){
 	unsigned int i;
@@ -460,7 +630,7 @@ static inline void combine_message(float * dest, float * src, unsigned int lengt
 
 static void propagate_node_using_levels(Graph_t g, unsigned int current_node_index){
 	float message_buffer[MAX_STATES];
-	unsigned int i, j, num_variables, start_index, end_index, num_vertices, edge_index;
+	unsigned int i, j, num_variables, start_index, end_index, num_vertices, edge_index, dest_node_index;
 	unsigned int * dest_nodes_to_edges_nodes;
 	unsigned int * dest_nodes_to_edges_edges;
 	unsigned int * src_nodes_to_edges_nodes;
@@ -507,8 +677,9 @@ static void propagate_node_using_levels(Graph_t g, unsigned int current_node_ind
 
 	for(i = start_index; i < end_index; ++i){
 		edge_index = src_nodes_to_edges_edges[i];
+		dest_node_index = g->edges_dest_index[edge_index];
 		//ensure node hasn't been visited yet
-		if(g->visited[g->edges_dest_index[edge_index]] == 0){
+		if(g->visited[dest_node_index] == 0){
 			/*printf("sending message on edge\n");
 			print_edge(g, edge_index);
 			printf("message: [");
@@ -521,6 +692,36 @@ static void propagate_node_using_levels(Graph_t g, unsigned int current_node_ind
 	}
 }
 
+// true if the node shares an edge, in either direction, with another node on its own level
+static char has_same_level_neighbor(Graph_t g, unsigned int node_index){
+	unsigned int i, start_index, end_index, num_vertices, level;
+
+	num_vertices = g->current_num_vertices;
+	level = g->node_levels[node_index];
+
+	start_index = g->src_nodes_to_edges_node_list[node_index];
+	end_index = (node_index + 1 == num_vertices) ? g->current_num_edges : g->src_nodes_to_edges_node_list[node_index + 1];
+	for(i = start_index; i < end_index; ++i){
+		if(g->node_levels[g->edges_dest_index[g->src_nodes_to_edges_edge_list[i]]] == level){
+			return 1;
+		}
+	}
+
+	start_index = g->dest_nodes_to_edges_node_list[node_index];
+	end_index = (node_index + 1 == num_vertices) ? g->current_num_edges : g->dest_nodes_to_edges_node_list[node_index + 1];
+	for(i = start_index; i < end_index; ++i){
+		if(g->node_levels[g->edges_src_index[g->dest_nodes_to_edges_edge_list[i]]] == level){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Nodes of a level with no neighbour on the same level only exchange messages with other levels, so they run concurrently.
+ * Nodes joined to a neighbour on their own level run after the barrier, one at a time in level order, so the messages between
+ * them are sent exactly as the serial sweep sends them.
+ */
 void propagate_using_levels(Graph_t g, unsigned int current_level) {
 	unsigned int i, start_index, end_index;
 
@@ -531,9 +732,17 @@ void propagate_using_levels(Graph_t g, unsigned int current_level) {
 	else{
 		end_index = g->levels_to_nodes[current_level + 1];
 	}
-	//#pragma omp parallel for shared(g, start_index, end_index) private(i)
+#pragma omp parallel for default(none) shared(g, start_index, end_index) private(i) schedule(dynamic, 16)
+	for(i = start_index; i < end_index; ++i){
+		if(!has_same_level_neighbor(g, g->levels_to_nodes[i])){
+			propagate_node_using_levels(g, g->levels_to_nodes[i]);
+		}
+	}
+
 	for(i = start_index; i < end_index; ++i){
-		propagate_node_using_levels(g, g->levels_to_nodes[i]);
+		if(has_same_level_neighbor(g, g->levels_to_nodes[i])){
+			propagate_node_using_levels(g, g->levels_to_nodes[i]);
+		}
 	}
 }
 
@@ -590,6 +799,7 @@ void marginalize(Graph_t g){
 
 	num_nodes = g->current_num_vertices;
 
+#pragma omp parallel for default(none) shared(g, num_nodes) private(i)
 	for(i = 0; i < num_nodes; ++i){
 		marginalize_node(g, i);
 	}
@@ -637,7 +847,7 @@ void print_edge(Graph_t graph, unsigned int edge_index){
 		printf("\t]\n");
 	}
 	printf("]\nMessage:\n[");
-	for(i = 0; i < dim_x; ++i){
+	for(i = 0; i < dim_y; ++i){
 		printf("\t%.6lf", graph->edges_messages[MAX_STATES * edge_index + i]);
 	}
 	printf("\t]\n]\n");
@@ -722,34 +932,36 @@ void print_dest_nodes_to_edges(Graph_t g){
 	}
 }
 
+// one message per edge, so splitting the edges evenly balances the threads whatever the degrees
 void init_previous_edge(Graph_t graph){
-	unsigned int i, j, num_vertices, start_index, end_index, edge_index;
-	unsigned int * src_node_to_edges_nodes;
-	unsigned int * src_node_to_edges_edges;
+	unsigned int i, num_edges;
 	float * previous_messages;
 
-	num_vertices = graph->current_num_vertices;
-	src_node_to_edges_nodes = graph->src_nodes_to_edges_node_list;
-	src_node_to_edges_edges = graph->src_nodes_to_edges_edge_list;
+	num_edges = graph->current_num_edges;
 	previous_messages = *graph->previous_edge_messages;
 
-	for(i = 0; i < num_vertices; ++i){
-		start_index = src_node_to_edges_nodes[i];
-		if(i + 1 >= num_vertices){
-			end_index = graph->current_num_edges;
-		}
-		else
-		{
-			end_index = src_node_to_edges_nodes[i + 1];
-		}
-		for(j = start_index; j < end_index; ++j){
-			edge_index = src_node_to_edges_edges[j];
-
-			send_message(graph->node_states, MAX_STATES * i, edge_index, graph->edges_joint_probabilities, previous_messages, graph->edges_x_dim, graph->edges_y_dim);
-		}
+#pragma omp parallel for default(none) shared(graph, num_edges, previous_messages) private(i)
+	for(i = 0; i < num_edges; ++i){
+		send_message(graph->node_states, MAX_STATES * graph->edges_src_index[i], i, graph->edges_joint_probabilities, previous_messages, graph->edges_x_dim, graph->edges_y_dim);
 	}
 }
 
+/**
+ * Snapshots the messages the loopy engines leave in previous_edge_messages; messages needs MAX_STATES * current_num_edges floats.
+ */
+void save_edge_messages(Graph_t graph, float * messages){
+	memcpy(messages, *graph->previous_edge_messages, sizeof(float) * MAX_STATES * graph->current_num_edges);
+}
+
+/**
+ * Warm start: seeds both message buffers from a snapshot taken with save_edge_messages on the same model, in place of
+ * init_previous_edge. The evidence may differ from the run that produced the snapshot.
+ */
+void init_previous_edge_from_messages(Graph_t graph, float * messages){
+	memcpy(graph->edges_messages, messages, sizeof(float) * MAX_STATES * graph->current_num_edges);
+	memcpy(graph->last_edges_messages, messages, sizeof(float) * MAX_STATES * graph->current_num_edges);
+}
+
 void fill_in_leaf_nodes_in_index(Graph_t graph, unsigned int * start_index, unsigned int * end_index, unsigned int max_count){
 	unsigned int i, diff, edge_start_index, edge_end_index;
 
@@ -766,14 +978,14 @@ void fill_in_leaf_nodes_in_index(Graph_t graph, unsigned int * start_index, unsi
 
         if(diff <= max_count){
             graph->levels_to_nodes[*end_index] = i;
+            graph->node_levels[i] = 0;
             *end_index += 1;
         }
     }
 }
 
 void visit_node(Graph_t graph, unsigned int buffer_index, unsigned int * end_index){
-	unsigned int node_index, edge_start_index, edge_end_index, edge_index, i, j, dest_node_index;
-	char visited;
+	unsigned int node_index, edge_start_index, edge_end_index, edge_index, i, dest_node_index;
 
     node_index = graph->levels_to_nodes[buffer_index];
     if(graph->visited[node_index] == 0){
@@ -788,14 +1000,9 @@ void visit_node(Graph_t graph, unsigned int buffer_index, unsigned int * end_ind
         for(i = edge_start_index; i < edge_end_index; ++i){
 			edge_index = graph->src_nodes_to_edges_edge_list[i];
             dest_node_index = graph->edges_dest_index[edge_index];
-            visited = 0;
-			for(j = graph->current_num_vertices; j < *end_index; ++j){
-				if(graph->levels_to_nodes[j] == dest_node_index){
-					visited = 1;
-					break;
-				}
-			}
-			if(visited == 0){
+			//already placed on a level
+			if(graph->node_levels[dest_node_index] == graph->current_num_vertices){
+				graph->node_levels[dest_node_index] = graph->num_levels + 1;
 				graph->levels_to_nodes[*end_index] = dest_node_index;
 				*end_index += 1;
 			}
@@ -803,26 +1010,99 @@ void visit_node(Graph_t graph, unsigned int buffer_index, unsigned int * end_ind
     }
 }
 
+struct degree_entry {
+	unsigned int degree;
+	unsigned int node_index;
+};
+
+static int compare_degree_entries(const void * a, const void * b){
+	const struct degree_entry * x = (const struct degree_entry *)a;
+	const struct degree_entry * y = (const struct degree_entry *)b;
+
+	if(x->degree != y->degree){
+		return (x->degree < y->degree) - (x->degree > y->degree);
+	}
+	return (x->node_index > y->node_index) - (x->node_index < y->node_index);
+}
+
+static unsigned int node_degree(Graph_t graph, unsigned int node_index){
+	unsigned int degree;
+
+	if(node_index + 1 == graph->current_num_vertices){
+		degree = graph->current_num_edges - graph->src_nodes_to_edges_node_list[node_index];
+		degree += graph->current_num_edges - graph->dest_nodes_to_edges_node_list[node_index];
+	}
+	else{
+		degree = graph->src_nodes_to_edges_node_list[node_index + 1] - graph->src_nodes_to_edges_node_list[node_index];
+		degree += graph->dest_nodes_to_edges_node_list[node_index + 1] - graph->dest_nodes_to_edges_node_list[node_index];
+	}
+	return degree;
+}
+
+// heaviest nodes first so the dynamic schedule hands them out before the cheap tail
+static void sort_level_by_degree(Graph_t graph, unsigned int start_index, unsigned int end_index, struct degree_entry * entries){
+	unsigned int i;
+
+	for(i = start_index; i < end_index; ++i){
+		entries[i - start_index].node_index = graph->levels_to_nodes[i];
+		entries[i - start_index].degree = node_degree(graph, graph->levels_to_nodes[i]);
+	}
+	qsort(entries, end_index - start_index, sizeof(struct degree_entry), compare_degree_entries);
+	for(i = start_index; i < end_index; ++i){
+		graph->levels_to_nodes[i] = entries[i - start_index].node_index;
+	}
+}
+
 void init_levels_to_nodes(Graph_t graph){
-	unsigned int start_index, end_index, copy_end_index, i;
+	unsigned int start_index, end_index, copy_end_index, i, num_vertices;
+	struct degree_entry * entries;
 
     reset_visited(graph);
 
-    start_index = graph->current_num_vertices;
+	num_vertices = graph->current_num_vertices;
+	for(i = 0; i < num_vertices; ++i){
+		graph->node_levels[i] = num_vertices;
+	}
+	graph->num_levels = 0;
+
+    start_index = num_vertices;
     end_index = start_index;
 
     fill_in_leaf_nodes_in_index(graph, &start_index, &end_index, 2);
-    while(end_index < 2 * graph->current_num_vertices){
+    while(end_index < 2 * num_vertices){
         copy_end_index = end_index;
         for(i = start_index; i < copy_end_index; ++i){
             visit_node(graph, i, &end_index);
         }
+		//nodes the leaves can't reach start a level of their own
+		if(end_index == copy_end_index){
+			for(i = 0; i < num_vertices && end_index == copy_end_index; ++i){
+				if(graph->node_levels[i] == num_vertices){
+					graph->node_levels[i] = graph->num_levels + 1;
+					graph->levels_to_nodes[end_index] = i;
+					end_index += 1;
+				}
+			}
+		}
+        start_index = copy_end_index;
         graph->num_levels += 1;
         graph->levels_to_nodes[graph->num_levels] = copy_end_index;
     }
 
 	graph->num_levels += 1;
 
+	entries = (struct degree_entry *)malloc(sizeof(struct degree_entry) * num_vertices);
+	assert(entries);
+	for(i = 0; i < graph->num_levels; ++i){
+		if(i + 1 == graph->num_levels){
+			sort_level_by_degree(graph, graph->levels_to_nodes[i], 2 * num_vertices, entries);
+		}
+		else{
+			sort_level_by_degree(graph, graph->levels_to_nodes[i], graph->levels_to_nodes[i + 1], entries);
+		}
+	}
+	free(entries);
+
     reset_visited(graph);
 }
 
@@ -847,188 +1127,797 @@ void print_levels_to_nodes(Graph_t graph){
     }
 }
 
-#pragma acc routine
-static void initialize_message_buffer(float * message_buffer, float * node_states, unsigned int node_index, unsigned int num_variables){
-	unsigned int j;
-
-	//clear buffer
-	for(j = 0; j < num_variables; ++j){
-		message_buffer[j] = node_states[MAX_STATES * node_index + j];
-	}
+static unsigned int hash_node_index(unsigned int x){
+	x = ((x >> 16) ^ x) * 0x45d9f3b;
+	x = ((x >> 16) ^ x) * 0x45d9f3b;
+	x = (x >> 16) ^ x;
+	return x;
 }
 
-#pragma acc routine
-static void read_incoming_messages(float * message_buffer,
-								   unsigned int * dest_node_to_edges_nodes,
-								   unsigned int * dest_node_to_edges_edges,
-								   float * previous_messages,
-                                   unsigned int current_num_edges, unsigned int num_vertices,
-								   unsigned int num_variables, unsigned int i){
-	unsigned int start_index, end_index, j, edge_index;
+// jones-plassmann: a node is colored in a round once it beats all of its uncolored neighbors
+static char is_local_max(Graph_t graph, unsigned int node_index){
+	unsigned int i, start_index, end_index, neighbor_index, priority, neighbor_priority;
 
-	start_index = dest_node_to_edges_nodes[i];
-	if(i + 1 >= num_vertices){
-		end_index = current_num_edges;
+	priority = hash_node_index(node_index);
+
+	start_index = graph->src_nodes_to_edges_node_list[node_index];
+	if(node_index + 1 == graph->current_num_vertices){
+		end_index = graph->current_num_edges;
 	}
 	else{
-		end_index = dest_node_to_edges_nodes[i + 1];
+		end_index = graph->src_nodes_to_edges_node_list[node_index + 1];
+	}
+	for(i = start_index; i < end_index; ++i){
+		neighbor_index = graph->edges_dest_index[graph->src_nodes_to_edges_edge_list[i]];
+		neighbor_priority = hash_node_index(neighbor_index);
+		if(graph->node_colors[neighbor_index] == MAX_COLORS &&
+		   (neighbor_priority > priority || (neighbor_priority == priority && neighbor_index > node_index))){
+			return 0;
+		}
 	}
 
-	for(j = start_index; j < end_index; ++j){
-		edge_index = dest_node_to_edges_edges[j];
-
-		combine_message(message_buffer, previous_messages, num_variables, MAX_STATES * edge_index);
+	start_index = graph->dest_nodes_to_edges_node_list[node_index];
+	if(node_index + 1 == graph->current_num_vertices){
+		end_index = graph->current_num_edges;
+	}
+	else{
+		end_index = graph->dest_nodes_to_edges_node_list[node_index + 1];
+	}
+	for(i = start_index; i < end_index; ++i){
+		neighbor_index = graph->edges_src_index[graph->dest_nodes_to_edges_edge_list[i]];
+		neighbor_priority = hash_node_index(neighbor_index);
+		if(graph->node_colors[neighbor_index] == MAX_COLORS &&
+		   (neighbor_priority > priority || (neighbor_priority == priority && neighbor_index > node_index))){
+			return 0;
+		}
 	}
-}
 
-#pragma acc routine
-static void send_message_for_edge(float * buffer, unsigned int edge_index,
-								  float * joint_probabilities, float * edge_messages, unsigned int * dim_src,
-								  unsigned int * dim_dest) {
-	unsigned int i, j, num_src, num_dest;
-	float sum, partial_sum;
+	return 1;
+}
 
-	num_src = dim_src[edge_index];
-	num_dest = dim_dest[edge_index];
+static unsigned int smallest_free_color(Graph_t graph, unsigned int node_index){
+	unsigned int i, start_index, end_index, color;
+	char used[MAX_COLORS];
 
+	for(i = 0; i < MAX_COLORS; ++i){
+		used[i] = 0;
+	}
 
-	sum = 0.0;
-	for(i = 0; i < num_src; ++i){
-		partial_sum = 0.0;
-		for(j = 0; j < num_dest; ++j){
-			partial_sum += joint_probabilities[MAX_STATES * MAX_STATES * edge_index + MAX_STATES * i + j] * buffer[j];
+	start_index = graph->src_nodes_to_edges_node_list[node_index];
+	if(node_index + 1 == graph->current_num_vertices){
+		end_index = graph->current_num_edges;
+	}
+	else{
+		end_index = graph->src_nodes_to_edges_node_list[node_index + 1];
+	}
+	for(i = start_index; i < end_index; ++i){
+		color = graph->node_colors[graph->edges_dest_index[graph->src_nodes_to_edges_edge_list[i]]];
+		if(color < MAX_COLORS){
+			used[color] = 1;
 		}
-		edge_messages[edge_index * MAX_STATES + i] = partial_sum;
-		sum += partial_sum;
 	}
-	if(sum <= 0.0){
-		sum = 1.0;
+
+	start_index = graph->dest_nodes_to_edges_node_list[node_index];
+	if(node_index + 1 == graph->current_num_vertices){
+		end_index = graph->current_num_edges;
+	}
+	else{
+		end_index = graph->dest_nodes_to_edges_node_list[node_index + 1];
+	}
+	for(i = start_index; i < end_index; ++i){
+		color = graph->node_colors[graph->edges_src_index[graph->dest_nodes_to_edges_edge_list[i]]];
+		if(color < MAX_COLORS){
+			used[color] = 1;
+		}
 	}
-	for (i = 0; i < num_src; ++i) {
-		edge_messages[edge_index * MAX_STATES + i] = edge_messages[edge_index * MAX_STATES + i] / sum;
+
+	for(color = 0; color < MAX_COLORS; ++color){
+		if(used[color] == 0){
+			break;
+		}
 	}
+	assert(color < MAX_COLORS);
+	return color;
 }
 
-#pragma acc routine
-static void send_message_for_edge_iteration(float * belief, unsigned int src_index, unsigned int edge_index,
-                                            float * joint_probabilities, float * edge_messages,
-                                            unsigned int * dim_src, unsigned int * dim_dest){
-    unsigned int i, j, num_src, num_dest;
-    float sum, partial_sum;
+void init_colors_to_nodes(Graph_t graph){
+	unsigned int i, num_vertices, num_colored, num_newly_colored, num_colors, index;
+	unsigned int * node_colors;
+	unsigned int * counts;
+	char * candidates;
 
-    num_src = dim_src[edge_index];
-    num_dest = dim_dest[edge_index];
+	num_vertices = graph->current_num_vertices;
 
-    sum = 0.0;
-    for(i = 0; i < num_src; ++i){
-        partial_sum = 0.0;
-        for(j = 0; j < num_dest; ++j){
-            partial_sum += joint_probabilities[MAX_STATES * MAX_STATES * edge_index + MAX_STATES * i + j] * belief[MAX_STATES * src_index + j];
-        }
-        edge_messages[edge_index * MAX_STATES + i] = partial_sum;
-        sum += partial_sum;
-    }
-    if(sum <= 0.0){
-        sum = 1.0;
-    }
-    for (i = 0; i < num_src; ++i) {
-        edge_messages[edge_index * MAX_STATES + i] = edge_messages[edge_index * MAX_STATES + i] / sum;
-    }
-}
+	free(graph->node_colors);
+	free(graph->colors_to_nodes_color_list);
+	free(graph->colors_to_nodes_node_list);
+	graph->node_colors = (unsigned int *)malloc(sizeof(unsigned int) * num_vertices);
+	assert(graph->node_colors);
+	graph->colors_to_nodes_color_list = (unsigned int *)malloc(sizeof(unsigned int) * MAX_COLORS);
+	assert(graph->colors_to_nodes_color_list);
+	graph->colors_to_nodes_node_list = (unsigned int *)malloc(sizeof(unsigned int) * num_vertices);
+	assert(graph->colors_to_nodes_node_list);
+	candidates = (char *)calloc(sizeof(char), (size_t)num_vertices);
+	assert(candidates);
+
+	node_colors = graph->node_colors;
+	for(i = 0; i < num_vertices; ++i){
+		node_colors[i] = MAX_COLORS;
+	}
 
-#pragma acc routine
-static void send_message_for_node(unsigned int * src_node_to_edges_nodes,
-								  unsigned int * src_node_to_edges_edges,
-								  float * message_buffer, unsigned int current_num_edges,
-								  float * joint_probabilities, float * edge_messages,
-								  unsigned int * num_src, unsigned int * num_dest,
-								  unsigned int num_vertices, unsigned int i){
-	unsigned int start_index, end_index, j, edge_index;
+	// candidates are picked against the colors of the previous round so the two loops stay race free
+	num_colored = 0;
+	while(num_colored < num_vertices){
+#pragma omp parallel for default(none) shared(graph, node_colors, candidates, num_vertices) private(i)
+		for(i = 0; i < num_vertices; ++i){
+			candidates[i] = (char)(node_colors[i] == MAX_COLORS && is_local_max(graph, i));
+		}
 
-	start_index = src_node_to_edges_nodes[i];
-	if(i + 1 >= num_vertices){
-		end_index = current_num_edges;
+		num_newly_colored = 0;
+#pragma omp parallel for default(none) shared(graph, node_colors, candidates, num_vertices) private(i) reduction(+:num_newly_colored)
+		for(i = 0; i < num_vertices; ++i){
+			if(candidates[i]){
+				node_colors[i] = smallest_free_color(graph, i);
+				num_newly_colored++;
+			}
+		}
+		assert(num_newly_colored > 0);
+		num_colored += num_newly_colored;
 	}
-	else {
-		end_index = src_node_to_edges_nodes[i + 1];
+
+	// bucket nodes by color
+	counts = (unsigned int *)calloc(sizeof(unsigned int), MAX_COLORS);
+	assert(counts);
+	num_colors = 0;
+	for(i = 0; i < num_vertices; ++i){
+		counts[node_colors[i]] += 1;
+		if(node_colors[i] + 1 > num_colors){
+			num_colors = node_colors[i] + 1;
+		}
 	}
-    
-	for(j = start_index; j < end_index; ++j){
-		edge_index = src_node_to_edges_edges[j];
-		/*printf("Sending on edge\n");
-        print_edge(graph, edge_index);*/
-		send_message_for_edge(message_buffer, edge_index, joint_probabilities, edge_messages, num_src, num_dest);
+	index = 0;
+	for(i = 0; i < num_colors; ++i){
+		graph->colors_to_nodes_color_list[i] = index;
+		index += counts[i];
+		counts[i] = graph->colors_to_nodes_color_list[i];
 	}
+	for(i = 0; i < num_vertices; ++i){
+		graph->colors_to_nodes_node_list[counts[node_colors[i]]] = i;
+		counts[node_colors[i]] += 1;
+	}
+	graph->num_colors = num_colors;
+
+	free(counts);
+	free(candidates);
 }
 
-static void marginalize_loopy_nodes(Graph_t graph, float * current_messages, unsigned int num_vertices) {
-	unsigned int j;
+void print_colors_to_nodes(Graph_t graph){
+	unsigned int i, j, start_index, end_index;
 
-	unsigned int i, num_variables, start_index, end_index, edge_index, current_num_vertices, current_num_edges;
-	float sum;
-	float * states;
-	unsigned int * num_vars;
-	float new_message[MAX_STATES];
+	for(i = 0; i < graph->num_colors; ++i){
+		printf("Color: %d\n", i);
+		printf("---------------\n");
+		start_index = graph->colors_to_nodes_color_list[i];
+		if(i + 1 == graph->num_colors){
+			end_index = graph->current_num_vertices;
+		}
+		else{
+			end_index = graph->colors_to_nodes_color_list[i + 1];
+		}
+		printf("Nodes:-----------\n");
+		for(j = start_index; j < end_index; ++j){
+			print_node(graph, graph->colors_to_nodes_node_list[j]);
+		}
+		printf("-------------------\n");
+	}
+}
 
-	unsigned int * dest_nodes_to_edges_nodes;
-	unsigned int * dest_nodes_to_edges_edges;
+static void lower_label(unsigned int * labels, unsigned int index, unsigned int label){
+	unsigned int current;
 
-	dest_nodes_to_edges_nodes = graph->dest_nodes_to_edges_node_list;
-	dest_nodes_to_edges_edges = graph->dest_nodes_to_edges_edge_list;
-	current_num_vertices = graph->current_num_vertices;
-	current_num_edges = graph->current_num_edges;
-	states = graph->node_states;
-	num_vars = graph->node_num_vars;
+	current = labels[index];
+	while(label < current && !__sync_bool_compare_and_swap(&labels[index], current, label)){
+		current = labels[index];
+	}
+}
 
+/**
+ * Labels connected components by hooking the larger label of each edge onto the smaller one and then pointer jumping.
+ * Components are numbered in order of their smallest node and bucketed like the colors.
+ */
+void init_components_to_nodes(Graph_t graph){
+	unsigned int i, num_vertices, num_edges, num_components, index, src_label, dest_label;
+	unsigned int * labels;
+	unsigned int * counts;
+	char changed;
 
-#pragma omp parallel for default(none) shared(states, num_vars, num_vertices, current_num_vertices, current_num_edges, dest_nodes_to_edges_nodes, dest_nodes_to_edges_edges, current_messages) private(i, j, num_variables, start_index, end_index, edge_index, sum, new_message)
-	for(j = 0; j < num_vertices; ++j) {
+	num_vertices = graph->current_num_vertices;
+	num_edges = graph->current_num_edges;
 
-		num_variables = num_vars[j];
+	free(graph->node_components);
+	free(graph->components_to_nodes_component_list);
+	free(graph->components_to_nodes_node_list);
+	graph->node_components = (unsigned int *)malloc(sizeof(unsigned int) * num_vertices);
+	assert(graph->node_components);
+	graph->components_to_nodes_node_list = (unsigned int *)malloc(sizeof(unsigned int) * num_vertices);
+	assert(graph->components_to_nodes_node_list);
 
+	labels = graph->node_components;
+	for(i = 0; i < num_vertices; ++i){
+		labels[i] = i;
+	}
 
-		for (i = 0; i < num_variables; ++i) {
-			new_message[i] = 1.0;
+	do {
+		changed = 0;
+#pragma omp parallel for default(none) shared(graph, labels, num_edges) private(i, src_label, dest_label) reduction(|:changed)
+		for(i = 0; i < num_edges; ++i){
+			src_label = labels[graph->edges_src_index[i]];
+			dest_label = labels[graph->edges_dest_index[i]];
+			if(src_label < dest_label){
+				lower_label(labels, dest_label, src_label);
+				changed = 1;
+			}
+			else if(dest_label < src_label){
+				lower_label(labels, src_label, dest_label);
+				changed = 1;
+			}
 		}
-
-
-		start_index = dest_nodes_to_edges_nodes[j];
-		if (j + 1 == current_num_vertices) {
-			end_index = current_num_edges;
-		} else {
-			end_index = dest_nodes_to_edges_nodes[j + 1];
+#pragma omp parallel for default(none) shared(labels, num_vertices) private(i)
+		for(i = 0; i < num_vertices; ++i){
+			while(labels[i] != labels[labels[i]]){
+				labels[i] = labels[labels[i]];
+			}
 		}
+	} while(changed);
 
-		for (i = start_index; i < end_index; ++i) {
-			edge_index = dest_nodes_to_edges_edges[i];
-
-			combine_message(new_message, current_messages, num_variables, MAX_STATES * edge_index);
-
+	// every label is now the smallest node of its component; renumber densely
+	num_components = 0;
+	for(i = 0; i < num_vertices; ++i){
+		if(labels[i] == i){
+			num_components += 1;
 		}
-		if (start_index < end_index) {
-			for (i = 0; i < num_variables; ++i) {
-				states[MAX_STATES * j + i] *= new_message[i];
+	}
+	graph->components_to_nodes_component_list = (unsigned int *)malloc(sizeof(unsigned int) * (num_components + 1));
+	assert(graph->components_to_nodes_component_list);
+	counts = (unsigned int *)calloc(sizeof(unsigned int), num_components + 1);
+	assert(counts);
+
+	index = 0;
+	for(i = 0; i < num_vertices; ++i){
+		if(labels[i] == i){
+			labels[i] = index;
+			index += 1;
+		}
+		else{
+			labels[i] = labels[labels[i]];
+		}
+		counts[labels[i]] += 1;
+	}
+	index = 0;
+	for(i = 0; i < num_components; ++i){
+		graph->components_to_nodes_component_list[i] = index;
+		index += counts[i];
+		counts[i] = graph->components_to_nodes_component_list[i];
+	}
+	for(i = 0; i < num_vertices; ++i){
+		graph->components_to_nodes_node_list[counts[labels[i]]] = i;
+		counts[labels[i]] += 1;
+	}
+	graph->num_components = num_components;
+
+	free(counts);
+}
+
+void print_components_to_nodes(Graph_t graph){
+	unsigned int i, j, start_index, end_index;
+
+	for(i = 0; i < graph->num_components; ++i){
+		printf("Component: %d\n", i);
+		printf("---------------\n");
+		start_index = graph->components_to_nodes_component_list[i];
+		if(i + 1 == graph->num_components){
+			end_index = graph->current_num_vertices;
+		}
+		else{
+			end_index = graph->components_to_nodes_component_list[i + 1];
+		}
+		printf("Nodes:-----------\n");
+		for(j = start_index; j < end_index; ++j){
+			print_node(graph, graph->components_to_nodes_node_list[j]);
+		}
+		printf("-------------------\n");
+	}
+}
+
+// scores a neighbor already placed by the streaming partitioner
+static inline void count_partition_neighbor(Graph_t graph, unsigned int neighbor_index, unsigned int * scores, unsigned int * stack, unsigned int * stack_size, char * seen){
+	if(graph->node_partitions[neighbor_index] < graph->num_partitions){
+		scores[graph->node_partitions[neighbor_index]] += 1;
+	}
+	else if(!seen[neighbor_index]){
+		seen[neighbor_index] = 1;
+		stack[*stack_size] = neighbor_index;
+		*stack_size += 1;
+	}
+}
+
+/**
+ * Streaming (linear deterministic greedy) partition into num_partitions balanced parts. Nodes arrive in BFS order and each
+ * goes to the part holding most of its placed neighbors, weighted by how much room the part has left; ties go to the
+ * smallest part. One pass over the edges, so it is cheap enough to run before every partitioned solve.
+ */
+void init_partitions_to_nodes(Graph_t graph, unsigned int num_partitions){
+	unsigned int i, j, k, p, node_index, num_vertices, num_edges, capacity, start_index, end_index, head, stack_size, best, index;
+	unsigned int * scores;
+	unsigned int * sizes;
+	unsigned int * stack;
+	unsigned int * counts;
+	char * seen;
+	double weight, best_weight;
+
+	assert(num_partitions > 0);
+
+	num_vertices = graph->current_num_vertices;
+	num_edges = graph->current_num_edges;
+
+	free(graph->node_partitions);
+	free(graph->partitions_to_nodes_partition_list);
+	free(graph->partitions_to_nodes_node_list);
+	graph->node_partitions = (unsigned int *)malloc(sizeof(unsigned int) * num_vertices);
+	assert(graph->node_partitions);
+	graph->partitions_to_nodes_partition_list = (unsigned int *)malloc(sizeof(unsigned int) * (num_partitions + 1));
+	assert(graph->partitions_to_nodes_partition_list);
+	graph->partitions_to_nodes_node_list = (unsigned int *)malloc(sizeof(unsigned int) * num_vertices);
+	assert(graph->partitions_to_nodes_node_list);
+	graph->num_partitions = num_partitions;
+
+	scores = (unsigned int *)malloc(sizeof(unsigned int) * num_partitions);
+	assert(scores);
+	sizes = (unsigned int *)calloc(sizeof(unsigned int), num_partitions);
+	assert(sizes);
+	stack = (unsigned int *)malloc(sizeof(unsigned int) * num_vertices);
+	assert(stack);
+	seen = (char *)calloc(sizeof(char), (size_t)num_vertices);
+	assert(seen);
+
+	for(i = 0; i < num_vertices; ++i){
+		graph->node_partitions[i] = num_partitions;
+	}
+	capacity = (num_vertices + num_partitions - 1) / num_partitions;
+
+	stack_size = 0;
+	head = 0;
+	for(i = 0; i < num_vertices; ++i){
+		if(seen[i]){
+			continue;
+		}
+		seen[i] = 1;
+		stack[stack_size] = i;
+		stack_size += 1;
+
+		while(head < stack_size){
+			node_index = stack[head];
+			head += 1;
+
+			memset(scores, 0, sizeof(unsigned int) * num_partitions);
+			start_index = graph->src_nodes_to_edges_node_list[node_index];
+			end_index = (node_index + 1 == num_vertices) ? num_edges : graph->src_nodes_to_edges_node_list[node_index + 1];
+			for(j = start_index; j < end_index; ++j){
+				count_partition_neighbor(graph, graph->edges_dest_index[graph->src_nodes_to_edges_edge_list[j]], scores, stack, &stack_size, seen);
+			}
+			start_index = graph->dest_nodes_to_edges_node_list[node_index];
+			end_index = (node_index + 1 == num_vertices) ? num_edges : graph->dest_nodes_to_edges_node_list[node_index + 1];
+			for(j = start_index; j < end_index; ++j){
+				count_partition_neighbor(graph, graph->edges_src_index[graph->dest_nodes_to_edges_edge_list[j]], scores, stack, &stack_size, seen);
+			}
+
+			best = num_partitions;
+			best_weight = -1.0;
+			for(p = 0; p < num_partitions; ++p){
+				if(sizes[p] >= capacity){
+					continue;
+				}
+				weight = scores[p] * (1.0 - (double)sizes[p] / capacity);
+				if(weight > best_weight || (weight == best_weight && sizes[p] < sizes[best])){
+					best = p;
+					best_weight = weight;
+				}
+			}
+			assert(best < num_partitions);
+			graph->node_partitions[node_index] = best;
+			sizes[best] += 1;
+		}
+	}
+
+	// bucket nodes by partition
+	counts = sizes;
+	index = 0;
+	for(k = 0; k < num_partitions; ++k){
+		graph->partitions_to_nodes_partition_list[k] = index;
+		index += counts[k];
+		counts[k] = graph->partitions_to_nodes_partition_list[k];
+	}
+	graph->partitions_to_nodes_partition_list[num_partitions] = num_vertices;
+	for(i = 0; i < num_vertices; ++i){
+		graph->partitions_to_nodes_node_list[counts[graph->node_partitions[i]]] = i;
+		counts[graph->node_partitions[i]] += 1;
+	}
+
+	free(scores);
+	free(sizes);
+	free(stack);
+	free(seen);
+}
+
+void print_partitions_to_nodes(Graph_t graph){
+	unsigned int i, j;
+
+	for(i = 0; i < graph->num_partitions; ++i){
+		printf("Partition: %d\n", i);
+		printf("---------------\n");
+		printf("Nodes:-----------\n");
+		for(j = graph->partitions_to_nodes_partition_list[i]; j < graph->partitions_to_nodes_partition_list[i + 1]; ++j){
+			print_node(graph, graph->partitions_to_nodes_node_list[j]);
+		}
+		printf("-------------------\n");
+	}
+}
+
+/**
+ * Grows blocks one at a time by BFS from the first unplaced node, closing a block when the private copies of its nodes
+ * (state, the edges they send on with their tables, two message buffers in and out) would exceed cache_size bytes, and
+ * stores them as the graph's partitions for loopy_propagate_until_blocked. A node too large to fit gets a block of its own.
+ */
+void init_cache_blocks_to_nodes(Graph_t graph, unsigned int cache_size){
+	unsigned int i, j, node_index, neighbor_index, num_vertices, num_edges, start_index, end_index, head, tail, num_blocks, num_placed;
+	size_t block_bytes, node_bytes;
+	unsigned int * queue;
+	unsigned int * queued;
+
+	num_vertices = graph->current_num_vertices;
+	num_edges = graph->current_num_edges;
+
+	free(graph->node_partitions);
+	free(graph->partitions_to_nodes_partition_list);
+	free(graph->partitions_to_nodes_node_list);
+	graph->node_partitions = (unsigned int *)malloc(sizeof(unsigned int) * num_vertices);
+	assert(graph->node_partitions);
+	graph->partitions_to_nodes_partition_list = (unsigned int *)malloc(sizeof(unsigned int) * (num_vertices + 1));
+	assert(graph->partitions_to_nodes_partition_list);
+	graph->partitions_to_nodes_node_list = (unsigned int *)malloc(sizeof(unsigned int) * num_vertices);
+	assert(graph->partitions_to_nodes_node_list);
+
+	queue = (unsigned int *)malloc(sizeof(unsigned int) * (num_vertices + 1));
+	assert(queue);
+	// block that last queued the node, plus one; nodes a full block left behind can be queued again by the next
+	queued = (unsigned int *)calloc(sizeof(unsigned int), num_vertices);
+	assert(queued);
+
+	for(i = 0; i < num_vertices; ++i){
+		graph->node_partitions[i] = num_vertices;
+	}
+
+	num_blocks = 0;
+	num_placed = 0;
+	i = 0;
+	while(num_placed < num_vertices){
+		graph->partitions_to_nodes_partition_list[num_blocks] = num_placed;
+		num_blocks += 1;
+		block_bytes = 0;
+
+		head = 0;
+		tail = 0;
+		while(1){
+			// frontier ran dry before the block filled: continue from the next unplaced node
+			if(head == tail){
+				while(i < num_vertices && graph->node_partitions[i] < num_vertices){
+					++i;
+				}
+				if(i == num_vertices){
+					break;
+				}
+				queue[tail] = i;
+				queued[i] = num_blocks;
+				tail += 1;
+			}
+			node_index = queue[head];
+			head += 1;
+			if(graph->node_partitions[node_index] < num_vertices){
+				continue;
+			}
+
+			start_index = graph->src_nodes_to_edges_node_list[node_index];
+			end_index = (node_index + 1 == num_vertices) ? num_edges : graph->src_nodes_to_edges_node_list[node_index + 1];
+			node_bytes = sizeof(float) * MAX_STATES + (end_index - start_index) * (sizeof(float) * (MAX_STATES * MAX_STATES + 2 * MAX_STATES) + 4 * sizeof(unsigned int));
+			start_index = graph->dest_nodes_to_edges_node_list[node_index];
+			end_index = (node_index + 1 == num_vertices) ? num_edges : graph->dest_nodes_to_edges_node_list[node_index + 1];
+			node_bytes += (end_index - start_index) * (sizeof(float) * 2 * MAX_STATES + sizeof(unsigned int));
+
+			if(block_bytes > 0 && block_bytes + node_bytes > cache_size){
+				break;
+			}
+			block_bytes += node_bytes;
+			graph->node_partitions[node_index] = num_blocks - 1;
+			graph->partitions_to_nodes_node_list[num_placed] = node_index;
+			num_placed += 1;
+
+			start_index = graph->src_nodes_to_edges_node_list[node_index];
+			end_index = (node_index + 1 == num_vertices) ? num_edges : graph->src_nodes_to_edges_node_list[node_index + 1];
+			for(j = start_index; j < end_index; ++j){
+				neighbor_index = graph->edges_dest_index[graph->src_nodes_to_edges_edge_list[j]];
+				if(queued[neighbor_index] != num_blocks && graph->node_partitions[neighbor_index] == num_vertices){
+					queued[neighbor_index] = num_blocks;
+					queue[tail] = neighbor_index;
+					tail += 1;
+				}
+			}
+			start_index = graph->dest_nodes_to_edges_node_list[node_index];
+			end_index = (node_index + 1 == num_vertices) ? num_edges : graph->dest_nodes_to_edges_node_list[node_index + 1];
+			for(j = start_index; j < end_index; ++j){
+				neighbor_index = graph->edges_src_index[graph->dest_nodes_to_edges_edge_list[j]];
+				if(queued[neighbor_index] != num_blocks && graph->node_partitions[neighbor_index] == num_vertices){
+					queued[neighbor_index] = num_blocks;
+					queue[tail] = neighbor_index;
+					tail += 1;
+				}
+			}
+		}
+	}
+	graph->partitions_to_nodes_partition_list[num_blocks] = num_vertices;
+	graph->num_partitions = num_blocks;
+
+	free(queue);
+	free(queued);
+}
+
+/**
+ * Static schedule for the synchronous node loops, one range per thread. A node costs (in-degree + out-degree) x states;
+ * ranges are cut from the prefix sum of those costs so each holds an equal share. A node costing more than a share is a
+ * hub: it belongs to no range, and every thread instead takes a slice of its incoming edges (a partial product, merged
+ * afterwards) and of its outgoing edges. Call again after the edges change.
+ */
+void init_work_ranges(Graph_t graph, unsigned int num_threads){
+	unsigned int i, t, num_vertices, num_edges, in_degree, out_degree;
+	double total_work, share, work;
+	double * node_work;
+
+	assert(num_threads > 0);
+
+	num_vertices = graph->current_num_vertices;
+	num_edges = graph->current_num_edges;
+
+	free(graph->work_ranges);
+	free(graph->node_is_work_hub);
+	free(graph->work_hubs);
+	free(graph->work_hub_partials);
+	graph->work_ranges = (unsigned int *)malloc(sizeof(unsigned int) * (num_threads + 1));
+	assert(graph->work_ranges);
+	graph->node_is_work_hub = (char *)calloc(sizeof(char), (size_t)num_vertices + 1);
+	assert(graph->node_is_work_hub);
+	graph->num_work_ranges = num_threads;
+
+	node_work = (double *)malloc(sizeof(double) * (num_vertices + 1));
+	assert(node_work);
+
+	total_work = 0.0;
+	for(i = 0; i < num_vertices; ++i){
+		in_degree = ((i + 1 == num_vertices) ? num_edges : graph->dest_nodes_to_edges_node_list[i + 1]) - graph->dest_nodes_to_edges_node_list[i];
+		out_degree = ((i + 1 == num_vertices) ? num_edges : graph->src_nodes_to_edges_node_list[i + 1]) - graph->src_nodes_to_edges_node_list[i];
+		node_work[i] = (double)(in_degree + out_degree) * graph->node_num_vars[i];
+		total_work += node_work[i];
+	}
+	share = total_work / num_threads;
+
+	graph->num_work_hubs = 0;
+	if(num_threads > 1){
+		for(i = 0; i < num_vertices; ++i){
+			if(node_work[i] > share){
+				graph->node_is_work_hub[i] = 1;
+				graph->num_work_hubs += 1;
+				total_work -= node_work[i];
+			}
+		}
+	}
+	graph->work_hubs = (unsigned int *)malloc(sizeof(unsigned int) * (graph->num_work_hubs + 1));
+	assert(graph->work_hubs);
+	graph->work_hub_partials = (float *)malloc(sizeof(float) * MAX_STATES * num_threads * (graph->num_work_hubs + 1));
+	assert(graph->work_hub_partials);
+
+	// hubs are spread over every thread, so the ranges split what is left
+	share = total_work / num_threads;
+	graph->num_work_hubs = 0;
+	graph->work_ranges[0] = 0;
+	t = 1;
+	work = 0.0;
+	for(i = 0; i < num_vertices; ++i){
+		if(graph->node_is_work_hub[i]){
+			graph->work_hubs[graph->num_work_hubs] = i;
+			graph->num_work_hubs += 1;
+			continue;
+		}
+		work += node_work[i];
+		while(t < num_threads && work >= share * t){
+			graph->work_ranges[t] = i + 1;
+			t += 1;
+		}
+	}
+	for(; t <= num_threads; ++t){
+		graph->work_ranges[t] = num_vertices;
+	}
+
+	free(node_work);
+}
+
+#pragma acc routine
+static void initialize_message_buffer(float * message_buffer, float * node_states, unsigned int node_index, unsigned int num_variables){
+	unsigned int j;
+
+	//clear buffer
+	for(j = 0; j < num_variables; ++j){
+		message_buffer[j] = node_states[MAX_STATES * node_index + j];
+	}
+}
+
+#pragma acc routine
+static void read_incoming_messages(float * message_buffer,
+								   unsigned int * dest_node_to_edges_nodes,
+								   unsigned int * dest_node_to_edges_edges,
+								   float * previous_messages,
+                                   unsigned int current_num_edges, unsigned int num_vertices,
+								   unsigned int num_variables, unsigned int i){
+	unsigned int start_index, end_index, j, edge_index;
+
+	start_index = dest_node_to_edges_nodes[i];
+	if(i + 1 >= num_vertices){
+		end_index = current_num_edges;
+	}
+	else{
+		end_index = dest_node_to_edges_nodes[i + 1];
+	}
+
+	for(j = start_index; j < end_index; ++j){
+		edge_index = dest_node_to_edges_edges[j];
+
+		combine_message(message_buffer, previous_messages, num_variables, MAX_STATES * edge_index);
+	}
+}
+
+#pragma acc routine
+static void send_message_for_edge(float * buffer, unsigned int edge_index,
+								  float * joint_probabilities, float * edge_messages, unsigned int * dim_src,
+								  unsigned int * dim_dest) {
+	transfer_belief(joint_probabilities + MAX_STATES * MAX_STATES * edge_index, buffer, dim_src[edge_index], dim_dest[edge_index],
+					edge_messages + MAX_STATES * edge_index);
+}
+
+#pragma acc routine
+static void send_message_for_edge_iteration(float * belief, unsigned int src_index, unsigned int edge_index,
+                                            float * joint_probabilities, float * edge_messages,
+                                            unsigned int * dim_src, unsigned int * dim_dest){
+    transfer_belief(joint_probabilities + MAX_STATES * MAX_STATES * edge_index, belief + MAX_STATES * src_index, dim_src[edge_index], dim_dest[edge_index],
+                    edge_messages + MAX_STATES * edge_index);
+}
+
+#pragma acc routine
+static void send_message_for_node(unsigned int * src_node_to_edges_nodes,
+								  unsigned int * src_node_to_edges_edges,
+								  float * message_buffer, unsigned int current_num_edges,
+								  float * joint_probabilities, float * edge_messages,
+								  unsigned int * num_src, unsigned int * num_dest,
+								  unsigned int num_vertices, unsigned int i){
+	unsigned int start_index, end_index, j, edge_index;
+
+	start_index = src_node_to_edges_nodes[i];
+	if(i + 1 >= num_vertices){
+		end_index = current_num_edges;
+	}
+	else {
+		end_index = src_node_to_edges_nodes[i + 1];
+	}
+    
+	for(j = start_index; j < end_index; ++j){
+		edge_index = src_node_to_edges_edges[j];
+		/*printf("Sending on edge\n");
+        print_edge(graph, edge_index);*/
+		send_message_for_edge(message_buffer, edge_index, joint_probabilities, edge_messages, num_src, num_dest);
+	}
+}
+
+// sends in place and returns how far the outgoing messages moved
+static float send_message_for_node_in_place(unsigned int * src_node_to_edges_nodes,
+											unsigned int * src_node_to_edges_edges,
+											float * message_buffer, unsigned int current_num_edges,
+											float * joint_probabilities, float * edge_messages,
+											unsigned int * num_src, unsigned int * num_dest,
+											unsigned int num_vertices, unsigned int i){
+	unsigned int start_index, end_index, j, k, edge_index;
+	float previous_message[MAX_STATES];
+	float delta, diff;
+
+	start_index = src_node_to_edges_nodes[i];
+	if(i + 1 >= num_vertices){
+		end_index = current_num_edges;
+	}
+	else {
+		end_index = src_node_to_edges_nodes[i + 1];
+	}
+
+	delta = 0.0f;
+	for(j = start_index; j < end_index; ++j){
+		edge_index = src_node_to_edges_edges[j];
+		for(k = 0; k < num_dest[edge_index]; ++k){
+			previous_message[k] = edge_messages[MAX_STATES * edge_index + k];
+		}
+		send_message_for_edge(message_buffer, edge_index, joint_probabilities, edge_messages, num_src, num_dest);
+		for(k = 0; k < num_dest[edge_index]; ++k){
+			diff = previous_message[k] - edge_messages[MAX_STATES * edge_index + k];
+			if(diff != diff){
+				diff = 0.0f;
 			}
+			delta += fabs(diff);
+		}
+	}
+	return delta;
+}
+
+/**
+ * Materializes beliefs for the requested nodes only, from the messages the loopy engines leave in previous_edge_messages.
+ * beliefs[MAX_STATES * k] receives the normalized belief of nodes[k]; node_states keep the priors the engines read.
+ */
+void marginalize_loopy_nodes(Graph_t graph, unsigned int * nodes, unsigned int num_nodes, float * beliefs) {
+	unsigned int i, j, node_index, num_variables, start_index, end_index, edge_index, num_vertices, num_edges;
+	float sum;
+	float * states;
+	float * messages;
+	float * belief;
+	unsigned int * num_vars;
+
+	unsigned int * dest_nodes_to_edges_nodes;
+	unsigned int * dest_nodes_to_edges_edges;
+
+	dest_nodes_to_edges_nodes = graph->dest_nodes_to_edges_node_list;
+	dest_nodes_to_edges_edges = graph->dest_nodes_to_edges_edge_list;
+	num_vertices = graph->current_num_vertices;
+	num_edges = graph->current_num_edges;
+	states = graph->node_states;
+	num_vars = graph->node_num_vars;
+	messages = *graph->previous_edge_messages;
+
+#pragma omp parallel for default(none) shared(states, num_vars, nodes, num_nodes, beliefs, num_vertices, num_edges, dest_nodes_to_edges_nodes, dest_nodes_to_edges_edges, messages) private(i, j, node_index, num_variables, start_index, end_index, edge_index, sum, belief) if(num_nodes >= COMPONENT_BATCH_SIZE)
+	for(j = 0; j < num_nodes; ++j) {
+		node_index = nodes[j];
+		num_variables = num_vars[node_index];
+		belief = beliefs + MAX_STATES * j;
+
+		for (i = 0; i < num_variables; ++i) {
+			belief[i] = states[MAX_STATES * node_index + i];
+		}
+
+		start_index = dest_nodes_to_edges_nodes[node_index];
+		if (node_index + 1 == num_vertices) {
+			end_index = num_edges;
+		} else {
+			end_index = dest_nodes_to_edges_nodes[node_index + 1];
+		}
+
+		for (i = start_index; i < end_index; ++i) {
+			edge_index = dest_nodes_to_edges_edges[i];
+
+			combine_message(belief, messages, num_variables, MAX_STATES * edge_index);
 		}
+
 		sum = 0.0;
 		for (i = 0; i < num_variables; ++i) {
-			sum += states[MAX_STATES * j + i];
+			sum += belief[i];
 		}
 		if (sum <= 0.0) {
 			sum = 1.0;
 		}
 
 		for (i = 0; i < num_variables; ++i) {
-			states[MAX_STATES * j + i] = states[MAX_STATES * j + i] / sum;
+			belief[i] = belief[i] / sum;
 		}
 	}
-
-/*
-#pragma omp parallel for default(none) shared(graph, num_vertices, current) private(i)
-	for(i = 0; i < num_vertices; ++i){
-		marginalize_node(graph, i, current);
-	}*/
-
 }
 
 #pragma acc routine
@@ -1118,63 +2007,132 @@ static void marginalize_nodes_acc(float * node_states, unsigned int * num_vars,
 	}
 }
 
-void loopy_propagate_one_iteration(Graph_t graph){
-	unsigned int i, num_variables, num_vertices, num_edges;
-	unsigned int * dest_node_to_edges_nodes;
-	unsigned int * dest_node_to_edges_edges;
-	unsigned int * src_node_to_edges_nodes;
-	unsigned int * src_node_to_edges_edges;
-	unsigned int * num_vars;
-	float * node_states;
-	float * joint_probabilities;
-	float * previous_edge_messages;
-	float * current_edge_messages;
-	unsigned int * num_src;
-	unsigned int * num_dest;
-	float ** temp;
+// how far the messages on edges[first, last) moved since the previous iteration
+static float loopy_edges_delta(unsigned int * edges, unsigned int first, unsigned int last,
+							   float * previous_messages, float * current_messages, unsigned int * num_dest){
+	unsigned int j, k, edge_index;
+	float delta, diff;
 
-	previous_edge_messages = *graph->previous_edge_messages;
-	current_edge_messages = *graph->current_edge_messages;
-	joint_probabilities = graph->edges_joint_probabilities;
-	num_src = graph->edges_x_dim;
-	num_dest = graph->edges_y_dim;
+	delta = 0.0f;
+	for(j = first; j < last; ++j){
+		edge_index = edges[j];
+		for(k = 0; k < num_dest[edge_index]; ++k){
+			diff = previous_messages[MAX_STATES * edge_index + k] - current_messages[MAX_STATES * edge_index + k];
+			if(diff != diff){
+				diff = 0.0f;
+			}
+			delta += fabs(diff);
+		}
+	}
+	return delta;
+}
 
+static unsigned int work_ranges_default(void){
+#ifdef _OPENMP
+	return (unsigned int)omp_get_max_threads();
+#else
+	return 1;
+#endif
+}
+
+/**
+ * One thread's part of a synchronous iteration over the ranges of init_work_ranges: its slice of every hub's incoming
+ * product, a barrier, then its node range and its slice of every hub's sends. A team smaller than the number of ranges
+ * takes them round robin. Every thread of the team must call it; returns how far the messages this thread sent moved.
+ */
+static float send_loopy_messages_balanced(Graph_t graph, float * previous_edge_messages, float * current_edge_messages,
+										  unsigned int thread, unsigned int num_threads){
+	unsigned int h, t, i, j, k, node_index, num_variables, num_vertices, num_edges, num_ranges, start_index, end_index, first, last;
+	float delta;
 	float message_buffer[MAX_STATES];
+	float * partial;
 
 	num_vertices = graph->current_num_vertices;
-	dest_node_to_edges_nodes = graph->dest_nodes_to_edges_node_list;
-	dest_node_to_edges_edges = graph->dest_nodes_to_edges_edge_list;
-	src_node_to_edges_nodes = graph->src_nodes_to_edges_node_list;
-	src_node_to_edges_edges = graph->src_nodes_to_edges_edge_list;
-    num_edges = graph->current_num_edges;
-	num_vars = graph->node_num_vars;
-	node_states = graph->node_states;
-
-#pragma omp parallel for default(none) shared(node_states, num_vars, num_vertices, dest_node_to_edges_nodes, dest_node_to_edges_edges, src_node_to_edges_nodes, src_node_to_edges_edges, num_edges, previous_edge_messages, num_dest, num_src, current_edge_messages, joint_probabilities) private(message_buffer, i, num_variables) //schedule(dynamic, 16)
-    for(i = 0; i < num_vertices; ++i){
-		num_variables = num_vars[i];
-
-		initialize_message_buffer(message_buffer, node_states, i, num_variables);
-
-		//read incoming messages
-		read_incoming_messages(message_buffer, dest_node_to_edges_nodes, dest_node_to_edges_edges, previous_edge_messages, num_edges, num_vertices, num_variables, i);
+	num_edges = graph->current_num_edges;
+	num_ranges = graph->num_work_ranges;
+
+	if(graph->num_work_hubs > 0){
+		for(h = 0; h < graph->num_work_hubs; ++h){
+			node_index = graph->work_hubs[h];
+			num_variables = graph->node_num_vars[node_index];
+			start_index = graph->dest_nodes_to_edges_node_list[node_index];
+			end_index = (node_index + 1 == num_vertices) ? num_edges : graph->dest_nodes_to_edges_node_list[node_index + 1];
+			for(t = thread; t < num_ranges; t += num_threads){
+				partial = graph->work_hub_partials + MAX_STATES * (num_ranges * h + t);
+				for(k = 0; k < num_variables; ++k){
+					partial[k] = 1.0f;
+				}
+				first = start_index + (unsigned int)((unsigned long)(end_index - start_index) * t / num_ranges);
+				last = start_index + (unsigned int)((unsigned long)(end_index - start_index) * (t + 1) / num_ranges);
+				for(j = first; j < last; ++j){
+					combine_message(partial, previous_edge_messages, num_variables, MAX_STATES * graph->dest_nodes_to_edges_edge_list[j]);
+				}
+			}
+		}
+#pragma omp barrier
+	}
 
-/*
-		printf("Message at node\n");
-		print_node(graph, i);
-		printf("[\t");
-		for(j = 0; j < num_variables; ++j){
-			printf("%.6lf\t", message_buffer[j]);
+	delta = 0.0f;
+	for(t = thread; t < num_ranges; t += num_threads){
+		for(i = graph->work_ranges[t]; i < graph->work_ranges[t + 1]; ++i){
+			if(graph->node_is_work_hub[i]){
+				continue;
+			}
+			num_variables = graph->node_num_vars[i];
+			initialize_message_buffer(message_buffer, graph->node_states, i, num_variables);
+			read_incoming_messages(message_buffer, graph->dest_nodes_to_edges_node_list, graph->dest_nodes_to_edges_edge_list, previous_edge_messages,
+								   num_edges, num_vertices, num_variables, i);
+			send_message_for_node(graph->src_nodes_to_edges_node_list, graph->src_nodes_to_edges_edge_list, message_buffer, num_edges,
+								  graph->edges_joint_probabilities, current_edge_messages, graph->edges_x_dim, graph->edges_y_dim, num_vertices, i);
+			start_index = graph->src_nodes_to_edges_node_list[i];
+			end_index = (i + 1 == num_vertices) ? num_edges : graph->src_nodes_to_edges_node_list[i + 1];
+			delta += loopy_edges_delta(graph->src_nodes_to_edges_edge_list, start_index, end_index, previous_edge_messages, current_edge_messages, graph->edges_y_dim);
 		}
-		printf("\t]\n");*/
 
+		for(h = 0; h < graph->num_work_hubs; ++h){
+			node_index = graph->work_hubs[h];
+			num_variables = graph->node_num_vars[node_index];
+			initialize_message_buffer(message_buffer, graph->node_states, node_index, num_variables);
+			for(j = 0; j < num_ranges; ++j){
+				combine_message(message_buffer, graph->work_hub_partials, num_variables, MAX_STATES * (num_ranges * h + j));
+			}
+			start_index = graph->src_nodes_to_edges_node_list[node_index];
+			end_index = (node_index + 1 == num_vertices) ? num_edges : graph->src_nodes_to_edges_node_list[node_index + 1];
+			first = start_index + (unsigned int)((unsigned long)(end_index - start_index) * t / num_ranges);
+			last = start_index + (unsigned int)((unsigned long)(end_index - start_index) * (t + 1) / num_ranges);
+			for(j = first; j < last; ++j){
+				send_message_for_edge(message_buffer, graph->src_nodes_to_edges_edge_list[j], graph->edges_joint_probabilities, current_edge_messages,
+									  graph->edges_x_dim, graph->edges_y_dim);
+			}
+			delta += loopy_edges_delta(graph->src_nodes_to_edges_edge_list, first, last, previous_edge_messages, current_edge_messages, graph->edges_y_dim);
+		}
+	}
+	return delta;
+}
+
+static void send_loopy_messages(Graph_t graph, float * previous_edge_messages, float * current_edge_messages){
+	unsigned int thread, num_threads;
 
-		//send message
-		send_message_for_node(src_node_to_edges_nodes, src_node_to_edges_edges, message_buffer, num_edges, joint_probabilities, current_edge_messages, num_src, num_dest, num_vertices, i);
+	if(graph->work_ranges == NULL){
+		init_work_ranges(graph, work_ranges_default());
+	}
 
+#pragma omp parallel default(none) shared(graph, previous_edge_messages, current_edge_messages) private(thread, num_threads) num_threads(graph->num_work_ranges)
+	{
+		thread = 0;
+		num_threads = 1;
+#ifdef _OPENMP
+		thread = omp_get_thread_num();
+		num_threads = omp_get_num_threads();
+#endif
+		send_loopy_messages_balanced(graph, previous_edge_messages, current_edge_messages, thread, num_threads);
 	}
+}
+
+void loopy_propagate_one_iteration(Graph_t graph){
+	float ** temp;
 
-	marginalize_loopy_nodes(graph, current_edge_messages, num_vertices);
+	send_loopy_messages(graph, *graph->previous_edge_messages, *graph->current_edge_messages);
 
 	//swap previous and current
 	temp = graph->previous_edge_messages;
@@ -1232,11 +2190,11 @@ unsigned int loopy_propagate_until_edge(Graph_t graph, float convergence, unsign
     float delta, diff, previous_delta;
     float * previous_edge_messages;
     float * current_edge_messages;
-    unsigned int * edges_x_dim;
+    unsigned int * edges_y_dim;
 
     previous_edge_messages = *graph->previous_edge_messages;
     current_edge_messages = *graph->current_edge_messages;
-    edges_x_dim = graph->edges_x_dim;
+    edges_y_dim = graph->edges_y_dim;
 
     num_edges = graph->current_num_edges;
 
@@ -1249,9 +2207,9 @@ unsigned int loopy_propagate_until_edge(Graph_t graph, float convergence, unsign
 
         delta = 0.0;
 
-#pragma omp parallel default(none) shared(previous_edge_messages, current_edge_messages, num_edges, edges_x_dim)  private(j, diff, k) reduction(+:delta)
+#pragma omp parallel default(none) shared(previous_edge_messages, current_edge_messages, num_edges, edges_y_dim)  private(j, diff, k) reduction(+:delta)
         for(j = 0; j < num_edges; ++j){
-            for(k = 0; k < edges_x_dim[j]; ++k){
+            for(k = 0; k < edges_y_dim[j]; ++k){
                 diff = previous_edge_messages[j * MAX_STATES + k] - current_edge_messages[j * MAX_STATES + k];
                 if(diff != diff){
                     diff = 0.0;
@@ -1275,344 +2233,3772 @@ unsigned int loopy_propagate_until_edge(Graph_t graph, float convergence, unsign
     return i;
 }
 
+/**
+ * Synchronous loopy BP. The whole solve runs in one parallel region: each iteration every thread sends the messages of
+ * its init_work_ranges share and sums how far they moved, and one thread swaps the buffers and tests convergence
+ * between two barriers. On small networks this avoids a fork/join per iteration.
+ */
 unsigned int loopy_propagate_until(Graph_t graph, float convergence, unsigned int max_iterations){
-	unsigned int i, j, k, num_edges;
-	float delta, diff, previous_delta;
+	unsigned int i, thread, num_threads, num_iterations;
+	float delta, local_delta, previous_delta, last_delta;
 	float * previous_edge_messages;
 	float * current_edge_messages;
-	unsigned int * edges_x_dim;
+	float ** temp;
 
-	previous_edge_messages = *graph->previous_edge_messages;
-	current_edge_messages = *graph->current_edge_messages;
-	edges_x_dim = graph->edges_x_dim;
+	if(graph->work_ranges == NULL){
+		init_work_ranges(graph, work_ranges_default());
+	}
+
+	previous_delta = -1.0f;
+	delta = 0.0f;
+	last_delta = 0.0f;
+	num_iterations = max_iterations;
+
+#pragma omp parallel default(none) shared(graph, convergence, max_iterations, delta, previous_delta, last_delta, num_iterations, temp) private(i, thread, num_threads, local_delta, previous_edge_messages, current_edge_messages) num_threads(graph->num_work_ranges)
+	{
+		thread = 0;
+		num_threads = 1;
+#ifdef _OPENMP
+		thread = omp_get_thread_num();
+		num_threads = omp_get_num_threads();
+#endif
+		for(i = 0; i < max_iterations; ++i){
+			previous_edge_messages = *graph->previous_edge_messages;
+			current_edge_messages = *graph->current_edge_messages;
+
+			local_delta = send_loopy_messages_balanced(graph, previous_edge_messages, current_edge_messages, thread, num_threads);
+#pragma omp atomic
+			delta += local_delta;
+#pragma omp barrier
+
+#pragma omp single
+			{
+				//swap previous and current
+				temp = graph->previous_edge_messages;
+				graph->previous_edge_messages = graph->current_edge_messages;
+				graph->current_edge_messages = temp;
+
+				last_delta = delta;
+				if(delta < convergence || fabs(delta - previous_delta) < convergence){
+					num_iterations = i;
+				}
+				else if(i < max_iterations - 1) {
+					previous_delta = delta;
+				}
+				delta = 0.0f;
+			}
+
+			if(num_iterations == i){
+				break;
+			}
+		}
+	}
+	if(num_iterations == max_iterations){
+		printf("No Convergence: previous: %f vs current: %f\n", previous_delta, last_delta);
+	}
+	return num_iterations;
+}
+
+/**
+ * Synchronous loopy BP with damped updates: new = (1 - damping) * computed + damping * previous.
+ * The damping factor starts at zero and grows by DAMPING_STEP whenever the undamped delta has gone DAMPING_PATIENCE iterations
+ * without reaching a new minimum (oscillation, or a stall above the tolerance). A slowly shrinking delta keeps setting new minima
+ * and is left undamped, so only graphs that fail to settle pay for it. It stops on the same test as loopy_propagate_until, so it
+ * never runs longer than the undamped engine on a graph that settles. Returns the total iterations; num_damped_iterations gets those
+ * run with damping > 0.
+ */
+unsigned int loopy_propagate_until_damped(Graph_t graph, float convergence, unsigned int max_iterations, unsigned int * num_damped_iterations){
+	unsigned int i, j, k, num_edges, num_stalled;
+	float delta, diff, previous_delta, min_delta, damping;
+	float * previous_edge_messages;
+	float * current_edge_messages;
+	unsigned int * edges_y_dim;
+	float ** temp;
 
+	edges_y_dim = graph->edges_y_dim;
 	num_edges = graph->current_num_edges;
 
 	previous_delta = -1.0f;
-	delta = 0.0;
+	delta = 0.0f;
+	min_delta = -1.0f;
+	damping = 0.0f;
+	num_stalled = 0;
+	*num_damped_iterations = 0;
 
 	for(i = 0; i < max_iterations; ++i){
-		//printf("Current iteration: %d\n", i+1);
-		loopy_propagate_one_iteration(graph);
+		previous_edge_messages = *graph->previous_edge_messages;
+		current_edge_messages = *graph->current_edge_messages;
 
-		delta = 0.0;
+		send_loopy_messages(graph, previous_edge_messages, current_edge_messages);
 
-#pragma omp parallel default(none) shared(previous_edge_messages, current_edge_messages, num_edges, edges_x_dim)  private(j, diff, k) reduction(+:delta)
+		delta = 0.0f;
+#pragma omp parallel for default(none) shared(previous_edge_messages, current_edge_messages, num_edges, edges_y_dim, damping) private(j, diff, k) reduction(+:delta)
 		for(j = 0; j < num_edges; ++j){
-			for(k = 0; k < edges_x_dim[j]; ++k){
-				diff = previous_edge_messages[j * MAX_STATES + k] - current_edge_messages[j * MAX_STATES + k];
+			for(k = 0; k < edges_y_dim[j]; ++k){
+				diff = current_edge_messages[j * MAX_STATES + k] - previous_edge_messages[j * MAX_STATES + k];
 				if(diff != diff){
-					diff = 0.0;
+					diff = 0.0f;
 				}
 				delta += fabs(diff);
+				current_edge_messages[j * MAX_STATES + k] = previous_edge_messages[j * MAX_STATES + k] + (1.0f - damping) * diff;
 			}
 		}
+		if(damping > 0.0f){
+			*num_damped_iterations += 1;
+		}
+
+		//swap previous and current
+		temp = graph->previous_edge_messages;
+		graph->previous_edge_messages = graph->current_edge_messages;
+		graph->current_edge_messages = temp;
 
-		//printf("Current delta: %.6lf\n", delta);
-		//printf("Previous delta: %.6lf\n", previous_delta);
 		if(delta < convergence || fabs(delta - previous_delta) < convergence){
 			break;
 		}
+		//no new minimum for several iterations: oscillating or stalled
+		if(min_delta < 0.0f || delta < min_delta){
+			min_delta = delta;
+			num_stalled = 0;
+		}
+		else{
+			num_stalled += 1;
+		}
+		if(num_stalled >= DAMPING_PATIENCE){
+			if(damping >= MAX_DAMPING){
+				printf("No Convergence: still oscillating at damping %f\n", damping);
+				break;
+			}
+			damping += DAMPING_STEP;
+			if(damping > MAX_DAMPING){
+				damping = MAX_DAMPING;
+			}
+			num_stalled = 0;
+		}
 		if(i < max_iterations - 1) {
 			previous_delta = delta;
 		}
 	}
 	if(i == max_iterations){
-		printf("No Convergence: previous: %f vs current: %f\n", previous_delta, delta);
+		printf("No Convergence: previous: %f vs current: %f at damping %f\n", previous_delta, delta, damping);
 	}
+
 	return i;
 }
 
-static unsigned int loopy_propagate_iterations_acc(unsigned int num_vertices, unsigned int num_edges,
-										   unsigned int *dest_node_to_edges_nodes, unsigned int *dest_node_to_edges_edges,
-										   unsigned int *src_node_to_edges_nodes, unsigned int *src_node_to_edges_edges,
-										   float * node_states, unsigned int * num_vars,
-										   float ** previous_messages, float ** current_messages,
-										   float * joint_probabilities, unsigned int * num_src, unsigned int * num_dest,
-										   unsigned int max_iterations,
-										   float convergence){
-	unsigned int i, j, k, num_variables, num_iter;
-	float delta, previous_delta, diff;
-	float * prev_messages;
-	float * curr_messages;
-	float * temp;
+// runs the active-set worklist from the given frontier; active and next_active must hold current_num_vertices entries
+static unsigned int propagate_active_set(Graph_t graph, unsigned int * active, unsigned int * next_active, unsigned int num_active,
+										 float threshold, unsigned int max_iterations){
+	unsigned int i, j, k, m, node_index, edge_index, dest_index, slot, num_variables, num_vertices, num_edges, start_index, end_index;
+	unsigned int num_next;
+	float diff, edge_delta;
+	float * previous_edge_messages;
+	float * current_edge_messages;
+	float message_buffer[MAX_STATES];
+	unsigned int * temp;
+	char * queued;
 
-	prev_messages = *previous_messages;
-	curr_messages =  *current_messages;
+	num_vertices = graph->current_num_vertices;
+	num_edges = graph->current_num_edges;
+	previous_edge_messages = *graph->previous_edge_messages;
+	current_edge_messages = *graph->current_edge_messages;
 
+	queued = (char *)calloc(sizeof(char), num_vertices);
+	assert(queued);
 
-	float message_buffer[MAX_STATES];
+	for(i = 0; i < max_iterations && num_active > 0; ++i){
+		num_next = 0;
 
-	num_iter = 0;
+#pragma omp parallel for default(none) shared(graph, active, next_active, queued, num_active, num_next, num_vertices, num_edges, previous_edge_messages, current_edge_messages, threshold) private(j, k, m, node_index, edge_index, dest_index, slot, num_variables, start_index, end_index, diff, edge_delta, message_buffer) schedule(dynamic, 16)
+		for(j = 0; j < num_active; ++j){
+			node_index = active[j];
+			num_variables = graph->node_num_vars[node_index];
 
-	previous_delta = -1.0f;
-	delta = 0.0f;
+			initialize_message_buffer(message_buffer, graph->node_states, node_index, num_variables);
+			read_incoming_messages(message_buffer, graph->dest_nodes_to_edges_node_list, graph->dest_nodes_to_edges_edge_list, previous_edge_messages,
+								   num_edges, num_vertices, num_variables, node_index);
 
-    for(i = 0; i < max_iterations; i+= BATCH_SIZE) {
-#pragma acc data present_or_copy(node_states[0:(MAX_STATES * num_vertices)], prev_messages[0:(MAX_STATES * num_edges)], curr_messages[0:(MAX_STATES * num_edges)]) present_or_copyin(dest_node_to_edges_nodes[0:num_vertices], dest_node_to_edges_edges[0:num_edges], src_node_to_edges_nodes[0:num_vertices], src_node_to_edges_edges[0:num_edges], num_vars[0:num_vertices], joint_probabilities[0:(num_edges * MAX_STATES * MAX_STATES)], num_src[0:num_edges], num_dest[0:num_edges])
-        {
-            //printf("Current iteration: %d\n", i+1);
-            for (j = 0; j < BATCH_SIZE; ++j) {
-#pragma acc kernels
-                for (k = 0; k < num_vertices; ++k) {
-                    num_variables = num_vars[k];
+			start_index = graph->src_nodes_to_edges_node_list[node_index];
+			if(node_index + 1 == num_vertices){
+				end_index = num_edges;
+			}
+			else{
+				end_index = graph->src_nodes_to_edges_node_list[node_index + 1];
+			}
+			for(k = start_index; k < end_index; ++k){
+				edge_index = graph->src_nodes_to_edges_edge_list[k];
+				send_message_for_edge(message_buffer, edge_index, graph->edges_joint_probabilities, current_edge_messages, graph->edges_x_dim, graph->edges_y_dim);
+
+				edge_delta = 0.0f;
+				for(m = 0; m < graph->edges_y_dim[edge_index]; ++m){
+					diff = current_edge_messages[MAX_STATES * edge_index + m] - previous_edge_messages[MAX_STATES * edge_index + m];
+					if(diff != diff){
+						diff = 0.0f;
+					}
+					edge_delta += fabs(diff);
+				}
 
-                    initialize_message_buffer(message_buffer, node_states, k, num_variables);
+				//wake the receiver for the next iteration
+				dest_index = graph->edges_dest_index[edge_index];
+				if(edge_delta > threshold && __sync_bool_compare_and_swap(&queued[dest_index], 0, 1)){
+#pragma omp atomic capture
+					slot = num_next++;
 
-                    //read incoming messages
-                    read_incoming_messages(message_buffer, dest_node_to_edges_nodes, dest_node_to_edges_edges, prev_messages, num_edges, num_vertices,
-                                           num_variables, k);
+					next_active[slot] = dest_index;
+				}
+			}
+		}
 
-/*
-		printf("Message at node\n");
-		print_node(graph, i);
-		printf("[\t");
-		for(j = 0; j < num_variables; ++j){
-			printf("%.6lf\t", message_buffer[j]);
+		//publish the recomputed messages; everything else in the previous buffer is still current
+#pragma omp parallel for default(none) shared(graph, active, num_active, num_vertices, num_edges, previous_edge_messages, current_edge_messages) private(j, k, m, node_index, edge_index, start_index, end_index)
+		for(j = 0; j < num_active; ++j){
+			node_index = active[j];
+			start_index = graph->src_nodes_to_edges_node_list[node_index];
+			if(node_index + 1 == num_vertices){
+				end_index = num_edges;
+			}
+			else{
+				end_index = graph->src_nodes_to_edges_node_list[node_index + 1];
+			}
+			for(k = start_index; k < end_index; ++k){
+				edge_index = graph->src_nodes_to_edges_edge_list[k];
+				for(m = 0; m < graph->edges_y_dim[edge_index]; ++m){
+					previous_edge_messages[MAX_STATES * edge_index + m] = current_edge_messages[MAX_STATES * edge_index + m];
+				}
+			}
 		}
-		printf("\t]\n");*/
 
+		for(j = 0; j < num_next; ++j){
+			queued[next_active[j]] = 0;
+		}
 
-                    //send message
-                    send_message_for_node(src_node_to_edges_nodes, src_node_to_edges_edges, message_buffer, num_edges, joint_probabilities,
-                                          curr_messages, num_src, num_dest, num_vertices, k);
+		temp = active;
+		active = next_active;
+		next_active = temp;
+		num_active = num_next;
+	}
+	if(num_active > 0){
+		printf("No Convergence: %d nodes still active\n", num_active);
+	}
 
-                }
+	free(queued);
 
-#pragma acc kernels
-                for (k = 0; k < num_vertices; ++k) {
-                    marginalize_node_acc(node_states, num_vars, k, curr_messages, dest_node_to_edges_nodes, dest_node_to_edges_edges, num_vertices,
-                                         num_edges);
-                }
+	return i;
+}
 
-                //swap previous and current
-                temp = prev_messages;
-                prev_messages = curr_messages;
-                curr_messages = temp;
+/**
+ * Active-set loopy BP: only nodes with an incoming message that moved by more than threshold recompute their outgoing messages.
+ * Reads come from the previous buffer, so updates stay synchronous; the frontier is a worklist deduplicated with a flag per node.
+ * Stops when the frontier empties and returns the number of iterations.
+ */
+unsigned int loopy_propagate_until_active(Graph_t graph, float threshold, unsigned int max_iterations){
+	unsigned int i, num_vertices, num_iterations;
+	unsigned int * active;
+	unsigned int * next_active;
 
-            }
+	num_vertices = graph->current_num_vertices;
 
+	active = (unsigned int *)malloc(sizeof(unsigned int) * num_vertices);
+	assert(active);
+	next_active = (unsigned int *)malloc(sizeof(unsigned int) * num_vertices);
+	assert(next_active);
 
-            delta = 0.0f;
-#pragma acc kernels
-            for (j = 0; j < num_edges; ++j) {
-                for (k = 0; k < num_src[j]; ++k) {
-                    diff = prev_messages[MAX_STATES * j + k] - curr_messages[MAX_STATES * j + k];
-                    if (diff != diff) {
-                        diff = 0.0f;
-                    }
-                    delta += fabs(diff);
-                }
-            }
-        }
-        if(delta < convergence || fabs(delta - previous_delta) < convergence){
-            break;
-        }
-        previous_delta = delta;
-        num_iter += BATCH_SIZE;
-    }
-	if(i == max_iterations) {
-		printf("No Convergence: previous: %f vs current: %f\n", previous_delta, delta);
+	for(i = 0; i < num_vertices; ++i){
+		active[i] = i;
 	}
 
+	num_iterations = propagate_active_set(graph, active, next_active, num_vertices, threshold, max_iterations);
 
-	return num_iter;
-}
+	free(active);
+	free(next_active);
 
-unsigned int loopy_progagate_until_acc(Graph_t graph, float convergence, unsigned int max_iterations){
-	unsigned int iter;
+	return num_iterations;
+}
 
-	/*printf("===BEFORE====\n");
-	print_nodes(graph);
-	print_edges(graph);
-*/
-	iter = loopy_propagate_iterations_acc(graph->current_num_vertices, graph->current_num_edges,
-	graph->dest_nodes_to_edges_node_list, graph->dest_nodes_to_edges_edge_list,
-										  graph->src_nodes_to_edges_node_list, graph->src_nodes_to_edges_edge_list,
-	graph->node_states, graph->node_num_vars,
-	graph->previous_edge_messages, graph->current_edge_messages, graph->edges_joint_probabilities,
-										  graph->edges_x_dim, graph->edges_y_dim,
-										  max_iterations, convergence);
+/**
+ * Incremental update after the evidence on changed_nodes was replaced (e.g. with graph_set_node_state) on a graph whose
+ * previous_edge_messages hold a converged solution. Only the changed nodes start active; residuals then spread through the
+ * active-set worklist until every message moves by less than threshold, so the cost follows the region the change reaches.
+ * Returns the number of iterations.
+ */
+unsigned int loopy_propagate_evidence_change(Graph_t graph, unsigned int * changed_nodes, unsigned int num_changed, float threshold, unsigned int max_iterations){
+	unsigned int i, num_vertices, num_active, num_iterations;
+	unsigned int * active;
+	unsigned int * next_active;
+	char * seeded;
 
-	/*printf("===AFTER====\n");
-	print_nodes(graph);
-	print_edges(graph);*/
+	num_vertices = graph->current_num_vertices;
 
-	return iter;
-}
+	active = (unsigned int *)malloc(sizeof(unsigned int) * num_vertices);
+	assert(active);
+	next_active = (unsigned int *)malloc(sizeof(unsigned int) * num_vertices);
+	assert(next_active);
+	seeded = (char *)calloc(sizeof(char), num_vertices);
+	assert(seeded);
+
+	num_active = 0;
+	for(i = 0; i < num_changed; ++i){
+		assert(changed_nodes[i] < num_vertices);
+		if(!seeded[changed_nodes[i]]){
+			seeded[changed_nodes[i]] = 1;
+			active[num_active] = changed_nodes[i];
+			num_active += 1;
+		}
+	}
 
-static unsigned int loopy_propagate_iterations_edges_acc(unsigned int num_vertices, unsigned int num_edges,
-														 float * node_states, unsigned int * num_vars,
-														 float ** previous_edge_messages, float ** current_edge_messages,
-														 float * joint_probabilities,
-														 unsigned int * edges_src_index, unsigned int * edges_dest_index,
-														 unsigned int * num_src, unsigned int * num_dest,
-														 unsigned int max_iterations, float convergence){
-	unsigned int i, j, k, num_iter, src_node_index, dest_node_index;
-	float delta, previous_delta, diff;
-	float * prev_messages;
-	float * curr_messages;
-	float * temp;
+	num_iterations = propagate_active_set(graph, active, next_active, num_active, threshold, max_iterations);
 
-	prev_messages = *previous_edge_messages;
-	curr_messages =  *current_edge_messages;
+	free(active);
+	free(next_active);
+	free(seeded);
 
+	return num_iterations;
+}
 
-	num_iter = 0;
+// one synchronous sweep over a set of nodes; messages into the set from outside it are held fixed. Returns how far the set's messages moved
+static float loopy_sweep_node_list(Graph_t graph, unsigned int * nodes, unsigned int num_nodes, float * previous_edge_messages, float * current_edge_messages){
+	unsigned int j, k, m, node_index, edge_index, num_variables, num_vertices, num_edges, start_index, end_index;
+	float delta, diff;
+	float message_buffer[MAX_STATES];
 
-	previous_delta = -1.0f;
-	delta = 0.0f;
+	num_vertices = graph->current_num_vertices;
+	num_edges = graph->current_num_edges;
 
-	for(i = 0; i < max_iterations; i+= BATCH_SIZE) {
-#pragma acc data present_or_copy(node_states[0:(MAX_STATES * num_vertices)], prev_messages[0:(MAX_STATES * num_edges)], curr_messages[0:(MAX_STATES * num_edges)]) present_or_copyin(num_vars[0:num_vertices], joint_probabilities[0:(num_edges * MAX_STATES * MAX_STATES)], num_src[0:num_edges], num_dest[0:num_edges], edges_src_index[0:num_edges])
-		{
-			//printf("Current iteration: %d\n", i+1);
-			for (j = 0; j < BATCH_SIZE; ++j) {
+#pragma omp parallel for default(none) shared(graph, nodes, num_nodes, num_vertices, num_edges, previous_edge_messages, current_edge_messages) private(j, node_index, num_variables, message_buffer) if(num_nodes >= COMPONENT_BATCH_SIZE)
+	for(j = 0; j < num_nodes; ++j){
+		node_index = nodes[j];
+		num_variables = graph->node_num_vars[node_index];
 
-#pragma acc kernels
-                for(k = 0; k < num_edges * MAX_STATES; ++k){
-					prev_messages[k] = curr_messages[k];
-				}
-#pragma acc kernels
-				for(k = 0; k < num_edges; ++k){
-					src_node_index = edges_src_index[k];
-					send_message_for_edge_iteration(node_states, src_node_index, k, joint_probabilities, curr_messages, num_src, num_dest);
-				}
+		initialize_message_buffer(message_buffer, graph->node_states, node_index, num_variables);
+		read_incoming_messages(message_buffer, graph->dest_nodes_to_edges_node_list, graph->dest_nodes_to_edges_edge_list, previous_edge_messages,
+							   num_edges, num_vertices, num_variables, node_index);
+		send_message_for_node(graph->src_nodes_to_edges_node_list, graph->src_nodes_to_edges_edge_list, message_buffer, num_edges,
+							  graph->edges_joint_probabilities, current_edge_messages, graph->edges_x_dim, graph->edges_y_dim, num_vertices, node_index);
+	}
 
-#pragma acc kernels
-				for(k = 0; k < num_edges; ++k){
-					dest_node_index = edges_dest_index[k];
-					combine_loopy_edge(i, curr_messages, dest_node_index, node_states, num_dest[k]);
-				}
-#pragma acc kernels
-				for(k = 0; k < num_vertices; ++k){
-					marginalize_loopy_node_edge(node_states, num_vars[k]);
+	delta = 0.0f;
+#pragma omp parallel for default(none) shared(graph, nodes, num_nodes, num_vertices, num_edges, previous_edge_messages, current_edge_messages) private(j, k, m, node_index, edge_index, start_index, end_index, diff) reduction(+:delta) if(num_nodes >= COMPONENT_BATCH_SIZE)
+	for(j = 0; j < num_nodes; ++j){
+		node_index = nodes[j];
+		start_index = graph->src_nodes_to_edges_node_list[node_index];
+		if(node_index + 1 == num_vertices){
+			end_index = num_edges;
+		}
+		else{
+			end_index = graph->src_nodes_to_edges_node_list[node_index + 1];
+		}
+		for(k = start_index; k < end_index; ++k){
+			edge_index = graph->src_nodes_to_edges_edge_list[k];
+			for(m = 0; m < graph->edges_y_dim[edge_index]; ++m){
+				diff = current_edge_messages[MAX_STATES * edge_index + m] - previous_edge_messages[MAX_STATES * edge_index + m];
+				if(diff != diff){
+					diff = 0.0f;
 				}
+				delta += fabs(diff);
+				previous_edge_messages[MAX_STATES * edge_index + m] = current_edge_messages[MAX_STATES * edge_index + m];
+			}
+		}
+	}
 
+	return delta;
+}
 
-				//swap previous and current
-				temp = prev_messages;
-				prev_messages = curr_messages;
-				curr_messages = temp;
+// synchronous loopy BP restricted to a set of nodes; messages into the set from outside it are held fixed. Small sets run on the calling thread
+static unsigned int loopy_propagate_node_list(Graph_t graph, unsigned int * nodes, unsigned int num_nodes, float convergence, unsigned int max_iterations,
+											  float * previous_edge_messages, float * current_edge_messages){
+	unsigned int i;
+	float delta, previous_delta;
 
-			}
+	previous_delta = -1.0f;
+	delta = 0.0f;
 
+	for(i = 0; i < max_iterations; ++i){
+		delta = loopy_sweep_node_list(graph, nodes, num_nodes, previous_edge_messages, current_edge_messages);
 
-			delta = 0.0f;
-#pragma acc kernels
-			for (j = 0; j < num_edges; ++j) {
-				for (k = 0; k < num_src[j]; ++k) {
-					diff = prev_messages[MAX_STATES * j + k] - curr_messages[MAX_STATES * j + k];
-					if (diff != diff) {
-						diff = 0.0f;
-					}
-					delta += fabs(diff);
-				}
-			}
-		}
 		if(delta < convergence || fabs(delta - previous_delta) < convergence){
 			break;
 		}
 		previous_delta = delta;
-		num_iter += BATCH_SIZE;
+	}
+	return i;
+}
+
+static unsigned int loopy_propagate_component(Graph_t graph, unsigned int component, float convergence, unsigned int max_iterations,
+											  float * previous_edge_messages, float * current_edge_messages){
+	unsigned int node_start, node_end;
+
+	node_start = graph->components_to_nodes_component_list[component];
+	if(component + 1 == graph->num_components){
+		node_end = graph->current_num_vertices;
+	}
+	else{
+		node_end = graph->components_to_nodes_component_list[component + 1];
+	}
+
+	return loopy_propagate_node_list(graph, graph->components_to_nodes_node_list + node_start, node_end - node_start, convergence, max_iterations,
+									 previous_edge_messages, current_edge_messages);
+}
+
+struct component_entry {
+	unsigned int size;
+	unsigned int component;
+};
+
+static int compare_component_entries(const void * a, const void * b){
+	const struct component_entry * x = (const struct component_entry *)a;
+	const struct component_entry * y = (const struct component_entry *)b;
+
+	if(x->size != y->size){
+		return (x->size < y->size) - (x->size > y->size);
+	}
+	return (x->component > y->component) - (x->component < y->component);
+}
+
+/**
+ * Loopy BP solved per connected component, each with its own iteration count and convergence test.
+ * Large components run one after another across all threads; the rest are packed into batches of about COMPONENT_BATCH_SIZE nodes
+ * that threads take dynamically. Expects init_components_to_nodes; returns the iterations of the slowest component.
+ */
+unsigned int loopy_propagate_until_components(Graph_t graph, float convergence, unsigned int max_iterations){
+	unsigned int i, j, num_components, num_large, num_batches, batch_size, num_iterations, max_component_iterations;
+	unsigned int * batches;
+	float * previous_edge_messages;
+	float * current_edge_messages;
+	struct component_entry * components;
+
+	assert(graph->components_to_nodes_component_list != NULL);
+
+	num_components = graph->num_components;
+	previous_edge_messages = *graph->previous_edge_messages;
+	current_edge_messages = *graph->current_edge_messages;
+
+	components = (struct component_entry *)malloc(sizeof(struct component_entry) * num_components);
+	assert(components);
+	batches = (unsigned int *)malloc(sizeof(unsigned int) * (num_components + 1));
+	assert(batches);
+
+	for(i = 0; i < num_components; ++i){
+		components[i].component = i;
+		if(i + 1 == num_components){
+			components[i].size = graph->current_num_vertices - graph->components_to_nodes_component_list[i];
+		}
+		else{
+			components[i].size = graph->components_to_nodes_component_list[i + 1] - graph->components_to_nodes_component_list[i];
+		}
+	}
+	qsort(components, num_components, sizeof(struct component_entry), compare_component_entries);
+
+	num_large = 0;
+	while(num_large < num_components && components[num_large].size >= COMPONENT_BATCH_SIZE){
+		num_large += 1;
+	}
+
+	// batch boundaries into the sorted tail
+	num_batches = 0;
+	batch_size = 0;
+	for(i = num_large; i < num_components; ++i){
+		if(batch_size == 0){
+			batches[num_batches] = i;
+			num_batches += 1;
+		}
+		batch_size += components[i].size;
+		if(batch_size >= COMPONENT_BATCH_SIZE){
+			batch_size = 0;
+		}
+	}
+	batches[num_batches] = num_components;
+
+	max_component_iterations = 0;
+	for(i = 0; i < num_large; ++i){
+		num_iterations = loopy_propagate_component(graph, components[i].component, convergence, max_iterations, previous_edge_messages, current_edge_messages);
+		if(num_iterations > max_component_iterations){
+			max_component_iterations = num_iterations;
+		}
+	}
+
+#pragma omp parallel for default(none) shared(graph, components, batches, num_batches, convergence, max_iterations, previous_edge_messages, current_edge_messages) private(i, j, num_iterations) reduction(max:max_component_iterations) schedule(dynamic, 1)
+	for(i = 0; i < num_batches; ++i){
+		for(j = batches[i]; j < batches[i + 1]; ++j){
+			num_iterations = loopy_propagate_component(graph, components[j].component, convergence, max_iterations, previous_edge_messages, current_edge_messages);
+			if(num_iterations > max_component_iterations){
+				max_component_iterations = num_iterations;
+			}
+		}
+	}
+	if(max_component_iterations == max_iterations){
+		printf("No Convergence: a component ran for all %d iterations\n", max_iterations);
+	}
+
+	free(components);
+	free(batches);
+
+	return max_component_iterations;
+}
+
+/**
+ * Gauss-Seidel variant: one color class at a time, reading and writing a single message buffer in place
+ */
+unsigned int loopy_propagate_until_colored(Graph_t graph, float convergence, unsigned int max_iterations){
+	unsigned int i, j, c, node_index, num_variables, num_vertices, num_edges, num_colors, start_index, end_index;
+	float delta, previous_delta;
+	float * messages;
+	float * node_states;
+	float * joint_probabilities;
+	unsigned int * num_vars;
+	unsigned int * num_src;
+	unsigned int * num_dest;
+	unsigned int * dest_node_to_edges_nodes;
+	unsigned int * dest_node_to_edges_edges;
+	unsigned int * src_node_to_edges_nodes;
+	unsigned int * src_node_to_edges_edges;
+	unsigned int * colors_to_nodes;
+	float message_buffer[MAX_STATES];
+
+	assert(graph->num_colors > 0);
+
+	// the seeded (and most recent) messages live in the previous buffer
+	messages = *graph->previous_edge_messages;
+	node_states = graph->node_states;
+	joint_probabilities = graph->edges_joint_probabilities;
+	num_vars = graph->node_num_vars;
+	num_src = graph->edges_x_dim;
+	num_dest = graph->edges_y_dim;
+	num_vertices = graph->current_num_vertices;
+	num_edges = graph->current_num_edges;
+	num_colors = graph->num_colors;
+	dest_node_to_edges_nodes = graph->dest_nodes_to_edges_node_list;
+	dest_node_to_edges_edges = graph->dest_nodes_to_edges_edge_list;
+	src_node_to_edges_nodes = graph->src_nodes_to_edges_node_list;
+	src_node_to_edges_edges = graph->src_nodes_to_edges_edge_list;
+	colors_to_nodes = graph->colors_to_nodes_node_list;
+
+	previous_delta = -1.0f;
+	delta = 0.0f;
+
+	for(i = 0; i < max_iterations; ++i){
+		delta = 0.0f;
+		for(c = 0; c < num_colors; ++c){
+			start_index = graph->colors_to_nodes_color_list[c];
+			if(c + 1 == num_colors){
+				end_index = num_vertices;
+			}
+			else{
+				end_index = graph->colors_to_nodes_color_list[c + 1];
+			}
+#pragma omp parallel for default(none) shared(node_states, num_vars, num_vertices, num_edges, messages, joint_probabilities, num_src, num_dest, dest_node_to_edges_nodes, dest_node_to_edges_edges, src_node_to_edges_nodes, src_node_to_edges_edges, colors_to_nodes, start_index, end_index) private(j, node_index, num_variables, message_buffer) reduction(+:delta)
+			for(j = start_index; j < end_index; ++j){
+				node_index = colors_to_nodes[j];
+				num_variables = num_vars[node_index];
+
+				initialize_message_buffer(message_buffer, node_states, node_index, num_variables);
+				read_incoming_messages(message_buffer, dest_node_to_edges_nodes, dest_node_to_edges_edges, messages, num_edges, num_vertices, num_variables, node_index);
+				delta += send_message_for_node_in_place(src_node_to_edges_nodes, src_node_to_edges_edges, message_buffer, num_edges, joint_probabilities, messages, num_src, num_dest, num_vertices, node_index);
+			}
+		}
+
+		// in-place sweeps can stall at a plateau well above the tolerance, so only an absolute delta counts as converged
+		if(delta < convergence){
+			break;
+		}
+		if(i < max_iterations - 1) {
+			previous_delta = delta;
+		}
+	}
+	if(i == max_iterations){
+		printf("No Convergence: previous: %f vs current: %f\n", previous_delta, delta);
+	}
+
+	return i;
+}
+
+struct residual_entry {
+	float residual;
+	unsigned int node_index;
+};
+
+static int compare_residual_entries(const void * a, const void * b){
+	const struct residual_entry * x = (const struct residual_entry *)a;
+	const struct residual_entry * y = (const struct residual_entry *)b;
+
+	if(x->residual > y->residual){
+		return -1;
+	}
+	if(x->residual < y->residual){
+		return 1;
+	}
+	return (x->node_index > y->node_index) - (x->node_index < y->node_index);
+}
+
+// how far a node's incoming messages moved since it last read them
+static float splash_node_residual(Graph_t graph, float * messages, float * read_messages, unsigned int node_index){
+	unsigned int i, k, start_index, end_index, edge_index;
+	float residual, diff;
+
+	start_index = graph->dest_nodes_to_edges_node_list[node_index];
+	if(node_index + 1 == graph->current_num_vertices){
+		end_index = graph->current_num_edges;
+	}
+	else{
+		end_index = graph->dest_nodes_to_edges_node_list[node_index + 1];
+	}
+
+	residual = 0.0f;
+	for(i = start_index; i < end_index; ++i){
+		edge_index = graph->dest_nodes_to_edges_edge_list[i];
+		for(k = 0; k < graph->edges_y_dim[edge_index]; ++k){
+			diff = messages[MAX_STATES * edge_index + k] - read_messages[MAX_STATES * edge_index + k];
+			if(diff != diff){
+				diff = 0.0f;
+			}
+			residual += fabs(diff);
+		}
+	}
+	return residual;
+}
+
+// messages from inside the splash are read live; messages from other splashes come from the round's snapshot, since their owners may be rewriting them
+static void splash_update_node(Graph_t graph, float * messages, float * boundary_messages, float * read_messages,
+							   unsigned int * owners, unsigned int owner, unsigned int node_index){
+	unsigned int i, k, num_variables, start_index, end_index, edge_index;
+	float * incoming;
+	float message_buffer[MAX_STATES];
+
+	num_variables = graph->node_num_vars[node_index];
+
+	initialize_message_buffer(message_buffer, graph->node_states, node_index, num_variables);
+
+	start_index = graph->dest_nodes_to_edges_node_list[node_index];
+	if(node_index + 1 == graph->current_num_vertices){
+		end_index = graph->current_num_edges;
+	}
+	else{
+		end_index = graph->dest_nodes_to_edges_node_list[node_index + 1];
+	}
+	for(i = start_index; i < end_index; ++i){
+		edge_index = graph->dest_nodes_to_edges_edge_list[i];
+		// other threads may be claiming unowned nodes, but never for this splash
+		if(__atomic_load_n(&owners[graph->edges_src_index[edge_index]], __ATOMIC_RELAXED) == owner){
+			incoming = messages;
+		}
+		else{
+			incoming = boundary_messages;
+		}
+		combine_message(message_buffer, incoming, num_variables, MAX_STATES * edge_index);
+
+		//remember what was read so the residual only counts later changes
+		for(k = 0; k < graph->edges_y_dim[edge_index]; ++k){
+			read_messages[MAX_STATES * edge_index + k] = incoming[MAX_STATES * edge_index + k];
+		}
+	}
+
+	send_message_for_node_in_place(graph->src_nodes_to_edges_node_list, graph->src_nodes_to_edges_edge_list, message_buffer,
+								   graph->current_num_edges, graph->edges_joint_probabilities, messages,
+								   graph->edges_x_dim, graph->edges_y_dim, graph->current_num_vertices, node_index);
+}
+
+// claims the node for the given splash; fails if another splash owns it this round
+static char splash_try_claim(unsigned int * owners, unsigned int node_index, unsigned int owner){
+	return (char)__sync_bool_compare_and_swap(&owners[node_index], 0, owner);
+}
+
+// breadth first over both edge directions, claiming nodes until the splash is full
+static unsigned int grow_splash(Graph_t graph, unsigned int * owners, unsigned int owner, unsigned int root, unsigned int * splash, unsigned int splash_size){
+	unsigned int head, size, i, node_index, start_index, end_index, neighbor;
+
+	splash[0] = root;
+	size = 1;
+	for(head = 0; head < size && size < splash_size; ++head){
+		node_index = splash[head];
+
+		start_index = graph->src_nodes_to_edges_node_list[node_index];
+		if(node_index + 1 == graph->current_num_vertices){
+			end_index = graph->current_num_edges;
+		}
+		else{
+			end_index = graph->src_nodes_to_edges_node_list[node_index + 1];
+		}
+		for(i = start_index; i < end_index && size < splash_size; ++i){
+			neighbor = graph->edges_dest_index[graph->src_nodes_to_edges_edge_list[i]];
+			if(splash_try_claim(owners, neighbor, owner)){
+				splash[size] = neighbor;
+				size += 1;
+			}
+		}
+
+		start_index = graph->dest_nodes_to_edges_node_list[node_index];
+		if(node_index + 1 == graph->current_num_vertices){
+			end_index = graph->current_num_edges;
+		}
+		else{
+			end_index = graph->dest_nodes_to_edges_node_list[node_index + 1];
+		}
+		for(i = start_index; i < end_index && size < splash_size; ++i){
+			neighbor = graph->edges_src_index[graph->dest_nodes_to_edges_edge_list[i]];
+			if(splash_try_claim(owners, neighbor, owner)){
+				splash[size] = neighbor;
+				size += 1;
+			}
+		}
+	}
+	return size;
+}
+
+/**
+ * Splash BP: grows a bounded breadth first tree around each high residual root and sweeps it leaves-to-root then root-to-leaves.
+ * Splashes run concurrently; a node belongs to at most one splash per round, and messages crossing between splashes are
+ * read from a snapshot taken at the start of the round. Returns the number of rounds.
+ */
+unsigned int splash_propagate_until(Graph_t graph, float convergence, unsigned int max_iterations, unsigned int splash_size){
+	unsigned int i, j, k, num_vertices, num_edges, num_roots, size, root;
+	float * messages;
+	float * boundary_messages;
+	float * read_messages;
+	float * residuals;
+	unsigned int * owners;
+	unsigned int * splash;
+	struct residual_entry * roots;
+
+	assert(splash_size > 0);
+
+	num_roots = 0;
+
+	num_vertices = graph->current_num_vertices;
+	num_edges = graph->current_num_edges;
+
+	// the seeded (and most recent) messages live in the previous buffer
+	messages = *graph->previous_edge_messages;
+
+	// seeded messages were computed as if every incoming message was uniform
+	read_messages = (float *)malloc(sizeof(float) * MAX_STATES * num_edges);
+	assert(read_messages);
+	for(j = 0; j < num_edges; ++j){
+		for(k = 0; k < graph->edges_y_dim[j]; ++k){
+			read_messages[MAX_STATES * j + k] = 1.0f / graph->edges_y_dim[j];
+		}
+	}
+
+	boundary_messages = (float *)malloc(sizeof(float) * MAX_STATES * num_edges);
+	assert(boundary_messages);
+	residuals = (float *)malloc(sizeof(float) * num_vertices);
+	assert(residuals);
+	owners = (unsigned int *)calloc(sizeof(unsigned int), num_vertices);
+	assert(owners);
+	roots = (struct residual_entry *)malloc(sizeof(struct residual_entry) * num_vertices);
+	assert(roots);
+
+	for(i = 0; i < max_iterations; ++i){
+#pragma omp parallel for default(none) shared(graph, messages, read_messages, residuals, owners, num_vertices) private(j)
+		for(j = 0; j < num_vertices; ++j){
+			residuals[j] = splash_node_residual(graph, messages, read_messages, j);
+			owners[j] = 0;
+		}
+
+		num_roots = 0;
+		for(j = 0; j < num_vertices; ++j){
+			if(residuals[j] >= convergence){
+				roots[num_roots].residual = residuals[j];
+				roots[num_roots].node_index = j;
+				num_roots += 1;
+			}
+		}
+		if(num_roots == 0){
+			break;
+		}
+		qsort(roots, num_roots, sizeof(struct residual_entry), compare_residual_entries);
+
+		memcpy(boundary_messages, messages, sizeof(float) * MAX_STATES * num_edges);
+
+#pragma omp parallel default(none) shared(graph, messages, boundary_messages, read_messages, owners, roots, num_roots, splash_size) private(j, k, size, root, splash)
+		{
+			splash = (unsigned int *)malloc(sizeof(unsigned int) * splash_size);
+			assert(splash);
+
+#pragma omp for schedule(dynamic, 1)
+			for(j = 0; j < num_roots; ++j){
+				root = roots[j].node_index;
+				if(!splash_try_claim(owners, root, j + 1)){
+					continue;
+				}
+				size = grow_splash(graph, owners, j + 1, root, splash, splash_size);
+
+				for(k = size; k > 0; --k){
+					splash_update_node(graph, messages, boundary_messages, read_messages, owners, j + 1, splash[k - 1]);
+				}
+				for(k = 1; k < size; ++k){
+					splash_update_node(graph, messages, boundary_messages, read_messages, owners, j + 1, splash[k]);
+				}
+			}
+
+			free(splash);
+		}
+	}
+	if(i == max_iterations){
+		printf("No Convergence: %d nodes still above the residual threshold\n", num_roots);
+	}
+
+	free(boundary_messages);
+	free(read_messages);
+	free(residuals);
+	free(owners);
+	free(roots);
+
+	return i;
+}
+
+static unsigned int loopy_propagate_iterations_acc(unsigned int num_vertices, unsigned int num_edges,
+										   unsigned int *dest_node_to_edges_nodes, unsigned int *dest_node_to_edges_edges,
+										   unsigned int *src_node_to_edges_nodes, unsigned int *src_node_to_edges_edges,
+										   float * node_states, unsigned int * num_vars,
+										   float ** previous_messages, float ** current_messages,
+										   float * joint_probabilities, unsigned int * num_src, unsigned int * num_dest,
+										   unsigned int max_iterations,
+										   float convergence){
+	unsigned int i, j, k, num_variables, num_iter;
+	float delta, previous_delta, diff;
+	float * prev_messages;
+	float * curr_messages;
+	float * temp;
+
+	prev_messages = *previous_messages;
+	curr_messages =  *current_messages;
+
+
+	float message_buffer[MAX_STATES];
+
+	num_iter = 0;
+
+	previous_delta = -1.0f;
+	delta = 0.0f;
+
+    for(i = 0; i < max_iterations; i+= BATCH_SIZE) {
+#pragma acc data present_or_copy(node_states[0:(MAX_STATES * num_vertices)], prev_messages[0:(MAX_STATES * num_edges)], curr_messages[0:(MAX_STATES * num_edges)]) present_or_copyin(dest_node_to_edges_nodes[0:num_vertices], dest_node_to_edges_edges[0:num_edges], src_node_to_edges_nodes[0:num_vertices], src_node_to_edges_edges[0:num_edges], num_vars[0:num_vertices], joint_probabilities[0:(num_edges * MAX_STATES * MAX_STATES)], num_src[0:num_edges], num_dest[0:num_edges])
+        {
+            //printf("Current iteration: %d\n", i+1);
+            for (j = 0; j < BATCH_SIZE; ++j) {
+#pragma acc kernels
+                for (k = 0; k < num_vertices; ++k) {
+                    num_variables = num_vars[k];
+
+                    initialize_message_buffer(message_buffer, node_states, k, num_variables);
+
+                    //read incoming messages
+                    read_incoming_messages(message_buffer, dest_node_to_edges_nodes, dest_node_to_edges_edges, prev_messages, num_edges, num_vertices,
+                                           num_variables, k);
+
+/*
+		printf("Message at node\n");
+		print_node(graph, i);
+		printf("[\t");
+		for(j = 0; j < num_variables; ++j){
+			printf("%.6lf\t", message_buffer[j]);
+		}
+		printf("\t]\n");*/
+
+
+                    //send message
+                    send_message_for_node(src_node_to_edges_nodes, src_node_to_edges_edges, message_buffer, num_edges, joint_probabilities,
+                                          curr_messages, num_src, num_dest, num_vertices, k);
+
+                }
+
+#pragma acc kernels
+                for (k = 0; k < num_vertices; ++k) {
+                    marginalize_node_acc(node_states, num_vars, k, curr_messages, dest_node_to_edges_nodes, dest_node_to_edges_edges, num_vertices,
+                                         num_edges);
+                }
+
+                //swap previous and current
+                temp = prev_messages;
+                prev_messages = curr_messages;
+                curr_messages = temp;
+
+            }
+
+
+            delta = 0.0f;
+#pragma acc kernels
+            for (j = 0; j < num_edges; ++j) {
+                for (k = 0; k < num_dest[j]; ++k) {
+                    diff = prev_messages[MAX_STATES * j + k] - curr_messages[MAX_STATES * j + k];
+                    if (diff != diff) {
+                        diff = 0.0f;
+                    }
+                    delta += fabs(diff);
+                }
+            }
+        }
+        if(delta < convergence || fabs(delta - previous_delta) < convergence){
+            break;
+        }
+        previous_delta = delta;
+        num_iter += BATCH_SIZE;
+    }
+	if(i == max_iterations) {
+		printf("No Convergence: previous: %f vs current: %f\n", previous_delta, delta);
+	}
+
+
+	return num_iter;
+}
+
+unsigned int loopy_progagate_until_acc(Graph_t graph, float convergence, unsigned int max_iterations){
+	unsigned int iter;
+
+	/*printf("===BEFORE====\n");
+	print_nodes(graph);
+	print_edges(graph);
+*/
+	iter = loopy_propagate_iterations_acc(graph->current_num_vertices, graph->current_num_edges,
+	graph->dest_nodes_to_edges_node_list, graph->dest_nodes_to_edges_edge_list,
+										  graph->src_nodes_to_edges_node_list, graph->src_nodes_to_edges_edge_list,
+	graph->node_states, graph->node_num_vars,
+	graph->previous_edge_messages, graph->current_edge_messages, graph->edges_joint_probabilities,
+										  graph->edges_x_dim, graph->edges_y_dim,
+										  max_iterations, convergence);
+
+	/*printf("===AFTER====\n");
+	print_nodes(graph);
+	print_edges(graph);*/
+
+	return iter;
+}
+
+static unsigned int loopy_propagate_iterations_edges_acc(unsigned int num_vertices, unsigned int num_edges,
+														 float * node_states, unsigned int * num_vars,
+														 float ** previous_edge_messages, float ** current_edge_messages,
+														 float * joint_probabilities,
+														 unsigned int * edges_src_index, unsigned int * edges_dest_index,
+														 unsigned int * num_src, unsigned int * num_dest,
+														 unsigned int max_iterations, float convergence){
+	unsigned int i, j, k, num_iter, src_node_index, dest_node_index;
+	float delta, previous_delta, diff;
+	float * prev_messages;
+	float * curr_messages;
+	float * temp;
+
+	prev_messages = *previous_edge_messages;
+	curr_messages =  *current_edge_messages;
+
+
+	num_iter = 0;
+
+	previous_delta = -1.0f;
+	delta = 0.0f;
+
+	for(i = 0; i < max_iterations; i+= BATCH_SIZE) {
+#pragma acc data present_or_copy(node_states[0:(MAX_STATES * num_vertices)], prev_messages[0:(MAX_STATES * num_edges)], curr_messages[0:(MAX_STATES * num_edges)]) present_or_copyin(num_vars[0:num_vertices], joint_probabilities[0:(num_edges * MAX_STATES * MAX_STATES)], num_src[0:num_edges], num_dest[0:num_edges], edges_src_index[0:num_edges])
+		{
+			//printf("Current iteration: %d\n", i+1);
+			for (j = 0; j < BATCH_SIZE; ++j) {
+
+#pragma acc kernels
+                for(k = 0; k < num_edges * MAX_STATES; ++k){
+					prev_messages[k] = curr_messages[k];
+				}
+#pragma acc kernels
+				for(k = 0; k < num_edges; ++k){
+					src_node_index = edges_src_index[k];
+					send_message_for_edge_iteration(node_states, src_node_index, k, joint_probabilities, curr_messages, num_src, num_dest);
+				}
+
+#pragma acc kernels
+				for(k = 0; k < num_edges; ++k){
+					dest_node_index = edges_dest_index[k];
+					combine_loopy_edge(i, curr_messages, dest_node_index, node_states, num_dest[k]);
+				}
+#pragma acc kernels
+				for(k = 0; k < num_vertices; ++k){
+					marginalize_loopy_node_edge(node_states, num_vars[k]);
+				}
+
+
+				//swap previous and current
+				temp = prev_messages;
+				prev_messages = curr_messages;
+				curr_messages = temp;
+
+			}
+
+
+			delta = 0.0f;
+#pragma acc kernels
+			for (j = 0; j < num_edges; ++j) {
+				for (k = 0; k < num_dest[j]; ++k) {
+					diff = prev_messages[MAX_STATES * j + k] - curr_messages[MAX_STATES * j + k];
+					if (diff != diff) {
+						diff = 0.0f;
+					}
+					delta += fabs(diff);
+				}
+			}
+		}
+		if(delta < convergence || fabs(delta - previous_delta) < convergence){
+			break;
+		}
+		previous_delta = delta;
+		num_iter += BATCH_SIZE;
 	}
 	if(i == max_iterations) {
 		printf("No Convergence: previous: %f vs current: %f\n", previous_delta, delta);
 	}
 
 
-	return num_iter;
+	return num_iter;
+}
+
+unsigned int loopy_progagate_until_edge_acc(Graph_t graph, float convergence, unsigned int max_iterations){
+    unsigned int iter;
+
+    /*printf("===BEFORE====\n");
+    print_nodes(graph);
+    print_edges(graph);
+*/
+    iter = loopy_propagate_iterations_edges_acc(graph->current_num_vertices, graph->current_num_edges,
+    graph->node_states, graph->node_num_vars,
+    graph->previous_edge_messages, graph->current_edge_messages,
+    graph->edges_joint_probabilities,
+    graph->edges_src_index, graph->edges_dest_index,
+    graph->edges_x_dim, graph->edges_y_dim,
+    max_iterations, convergence);
+
+    /*printf("===AFTER====\n");
+    print_nodes(graph);
+    print_edges(graph);*/
+
+    return iter;
+}
+
+void calculate_diameter(Graph_t graph){
+    // calculate diameter using floyd-warshall
+    int ** dist;
+	int ** g;
+    unsigned int i, j, k, start_index, end_index;
+	int curr_dist;
+
+	dist = (int **)malloc(sizeof(int *) * graph->current_num_vertices);
+	assert(dist);
+	g = (int **)malloc(sizeof(int *) * graph->current_num_vertices);
+	assert(g);
+	for(i = 0; i < graph->current_num_vertices; ++i){
+		dist[i] = (int *)malloc(sizeof(int) * graph->current_num_vertices);
+		assert(dist[i]);
+		g[i] = (int *)malloc(sizeof(int) * graph->current_num_vertices);
+		assert(g[i]);
+	}
+
+	// fill in g based on edges
+	for(i = 0; i < graph->current_num_vertices; ++i){
+		for(j = 0; j < graph->current_num_vertices; ++j){
+			g[i][j] = WEIGHT_INFINITY;
+		}
+	}
+	for(i = 0; i < graph->current_num_vertices; ++i){
+		 start_index = graph->src_nodes_to_edges_node_list[i];
+		if(i + 1 == graph->current_num_vertices){
+			end_index = graph->current_num_edges;
+		}
+		else{
+			end_index = graph->src_nodes_to_edges_node_list[i+1];
+		}
+		for(j = start_index; j < end_index; ++j){
+			k = graph->src_nodes_to_edges_edge_list[j];
+			g[i][graph->edges_dest_index[k]] = 1;
+		}
+	}
+
+	for(i = 0; i < graph->current_num_vertices; ++i){
+		for(j = 0; j < graph->current_num_vertices; ++j){
+			dist[i][j] = g[i][j];
+		}
+	}
+
+	for(k = 0; k < graph->current_num_vertices; ++k){
+		#pragma omp parallel for shared(dist, graph) private(curr_dist, i, j)
+		for(i = 0; i < graph->current_num_vertices; ++i){
+			for(j = 0; j < graph->current_num_vertices; ++j){
+				curr_dist = dist[i][k] + dist[k][j];
+				if(curr_dist < dist[i][j]){
+					dist[i][j] = curr_dist;
+				}
+			}
+		}
+	}
+
+	graph->diameter = -1;
+
+	for(i = 0; i < graph->current_num_vertices; ++i){
+		for(j = 0; j < graph->current_num_vertices; ++j){
+			if(dist[i][j] != WEIGHT_INFINITY && dist[i][j] > graph->diameter){
+				graph->diameter = dist[i][j];
+			}
+		}
+		free(g[i]);
+		free(dist[i]);
+	}
+	free(g);
+	free(dist);
+}
+
+static char nodes_adjacent(unsigned long long * adjacency, unsigned int words, unsigned int a, unsigned int b){
+	return (char)((adjacency[words * a + b / 64] >> (b % 64)) & 1ULL);
+}
+
+static void connect_nodes(unsigned long long * adjacency, unsigned int words, unsigned int a, unsigned int b){
+	if(a == b){
+		return;
+	}
+	adjacency[words * a + b / 64] |= 1ULL << (b % 64);
+	adjacency[words * b + a / 64] |= 1ULL << (a % 64);
+}
+
+static unsigned int collect_neighbors(unsigned long long * adjacency, unsigned int words, unsigned int node_index, unsigned int * neighbors){
+	unsigned int i, b, count;
+	unsigned long long word;
+
+	count = 0;
+	for(i = 0; i < words; ++i){
+		word = adjacency[words * node_index + i];
+		for(b = 0; word != 0ULL; ++b, word >>= 1){
+			if(word & 1ULL){
+				neighbors[count] = 64 * i + b;
+				count += 1;
+			}
+		}
+	}
+	return count;
+}
+
+// an edge is covered when one endpoint lists the other as a parent in its table
+static char edge_has_factor(Graph_t graph, unsigned int src_index, unsigned int dest_index){
+	unsigned int i;
+
+	for(i = 0; i < graph->node_num_parents[dest_index]; ++i){
+		if(graph->node_factors[dest_index] != NULL && graph->node_parents[MAX_DEGREE * dest_index + i] == src_index){
+			return 1;
+		}
+	}
+	for(i = 0; i < graph->node_num_parents[src_index]; ++i){
+		if(graph->node_factors[src_index] != NULL && graph->node_parents[MAX_DEGREE * src_index + i] == dest_index){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * map[e] = index into the table over sub_nodes of entry e of the table over nodes; tables put their last node fastest
+ */
+static void build_index_map(Graph_t graph, unsigned int * nodes, unsigned int num_nodes, unsigned int * sub_nodes, unsigned int num_sub_nodes,
+							unsigned int * map){
+	unsigned int i, j, entry, size, index, stride;
+	unsigned int * sub_strides;
+	unsigned int * digits;
+
+	sub_strides = (unsigned int *)calloc(sizeof(unsigned int), (size_t)num_nodes + 1);
+	assert(sub_strides);
+	digits = (unsigned int *)calloc(sizeof(unsigned int), (size_t)num_nodes + 1);
+	assert(digits);
+
+	stride = 1;
+	for(j = num_sub_nodes; j > 0; --j){
+		for(i = 0; i < num_nodes; ++i){
+			if(nodes[i] == sub_nodes[j - 1]){
+				sub_strides[i] = stride;
+			}
+		}
+		stride *= graph->node_num_vars[sub_nodes[j - 1]];
+	}
+
+	size = 1;
+	for(i = 0; i < num_nodes; ++i){
+		size *= graph->node_num_vars[nodes[i]];
+	}
+
+	index = 0;
+	for(entry = 0; entry < size; ++entry){
+		map[entry] = index;
+		for(i = num_nodes; i > 0; --i){
+			digits[i - 1] += 1;
+			index += sub_strides[i - 1];
+			if(digits[i - 1] < graph->node_num_vars[nodes[i - 1]]){
+				break;
+			}
+			index -= digits[i - 1] * sub_strides[i - 1];
+			digits[i - 1] = 0;
+		}
+	}
+
+	free(sub_strides);
+	free(digits);
+}
+
+static void multiply_potential(float * potential, unsigned int size, unsigned int * map, float * factor){
+	unsigned int i;
+
+	for(i = 0; i < size; ++i){
+		potential[i] *= factor[map[i]];
+	}
+}
+
+static void marginalize_potential(float * potential, unsigned int size, unsigned int * map, float * marginal, unsigned int marginal_size){
+	unsigned int i;
+
+	for(i = 0; i < marginal_size; ++i){
+		marginal[i] = 0.0f;
+	}
+	for(i = 0; i < size; ++i){
+		marginal[map[i]] += potential[i];
+	}
+}
+
+// Hugin update: separator takes the new (normalised) marginal, ratio gets new / old for the receiving clique
+static void update_separator(float * potential, unsigned int size, unsigned int * map, float * separator, float * ratio, unsigned int separator_size){
+	unsigned int i;
+	float sum, value;
+
+	marginalize_potential(potential, size, map, ratio, separator_size);
+
+	sum = 0.0f;
+	for(i = 0; i < separator_size; ++i){
+		sum += ratio[i];
+	}
+	if(sum <= 0.0f){
+		sum = 1.0f;
+	}
+	for(i = 0; i < separator_size; ++i){
+		value = ratio[i] / sum;
+		if(separator[i] > 0.0f){
+			ratio[i] = value / separator[i];
+		}
+		else{
+			ratio[i] = 0.0f;
+		}
+		separator[i] = value;
+	}
+}
+
+// counting sort of cliques by key into a CSR of num_keys buckets
+static void bucket_cliques(unsigned int * keys, unsigned int num_cliques, unsigned int num_keys, unsigned int ** key_list, unsigned int ** clique_list){
+	unsigned int i, total, count;
+	unsigned int * position;
+
+	*key_list = (unsigned int *)calloc(sizeof(unsigned int), (size_t)num_keys + 1);
+	assert(*key_list);
+	*clique_list = (unsigned int *)malloc(sizeof(unsigned int) * num_cliques);
+	assert(*clique_list);
+	position = (unsigned int *)malloc(sizeof(unsigned int) * (num_keys + 1));
+	assert(position);
+
+	for(i = 0; i < num_cliques; ++i){
+		(*key_list)[keys[i]] += 1;
+	}
+	total = 0;
+	for(i = 0; i <= num_keys; ++i){
+		count = (*key_list)[i];
+		(*key_list)[i] = total;
+		position[i] = total;
+		total += count;
+	}
+	for(i = 0; i < num_cliques; ++i){
+		(*clique_list)[position[keys[i]]] = i;
+		position[keys[i]] += 1;
+	}
+
+	free(position);
+}
+
+/**
+ * Builds a junction tree from the stored CPTs: moralise, eliminate with min-fill, and keep one clique per elimination step
+ * (the parent of a clique is the clique of its first-eliminated neighbour). Returns NULL if an edge has no CPT behind it
+ * or a clique would exceed MAX_CLIQUE_SIZE entries.
+ */
+JunctionTree_t create_junction_tree(Graph_t graph){
+	unsigned int i, j, k, step, node_index, num_vertices, words, best, num_neighbors, num_second, size, clique_capacity, parent, num_clique_nodes;
+	unsigned long long total_potentials, total_separators, total_parent_maps;
+	unsigned long long * adjacency;
+	unsigned int * neighbors;
+	unsigned int * second_neighbors;
+	unsigned int * fill_ins;
+	unsigned int * elimination_steps;
+	unsigned int * elimination_order;
+	unsigned int * heights;
+	unsigned int * depths;
+	double * weights;
+	char * eliminated;
+	char * dirty;
+	JunctionTree_t tree;
+
+	num_vertices = graph->current_num_vertices;
+	assert(num_vertices > 0);
+
+	for(i = 0; i < graph->current_num_edges; ++i){
+		if(!edge_has_factor(graph, graph->edges_src_index[i], graph->edges_dest_index[i])){
+			return NULL;
+		}
+	}
+
+	//moralise
+	words = (num_vertices + 63) / 64;
+	adjacency = (unsigned long long *)calloc(sizeof(unsigned long long), (size_t)words * num_vertices);
+	assert(adjacency);
+	for(i = 0; i < num_vertices; ++i){
+		if(graph->node_factors[i] == NULL){
+			continue;
+		}
+		for(j = 0; j < graph->node_num_parents[i]; ++j){
+			connect_nodes(adjacency, words, i, graph->node_parents[MAX_DEGREE * i + j]);
+			for(k = j + 1; k < graph->node_num_parents[i]; ++k){
+				connect_nodes(adjacency, words, graph->node_parents[MAX_DEGREE * i + j], graph->node_parents[MAX_DEGREE * i + k]);
+			}
+		}
+	}
+
+	tree = (JunctionTree_t)calloc(sizeof(struct junction_tree), 1);
+	assert(tree);
+	tree->num_cliques = num_vertices;
+	tree->cliques_to_nodes_clique_list = (unsigned int *)malloc(sizeof(unsigned int) * (num_vertices + 1));
+	assert(tree->cliques_to_nodes_clique_list);
+	clique_capacity = 4 * num_vertices;
+	tree->cliques_to_nodes_node_list = (unsigned int *)malloc(sizeof(unsigned int) * clique_capacity);
+	assert(tree->cliques_to_nodes_node_list);
+
+	neighbors = (unsigned int *)malloc(sizeof(unsigned int) * num_vertices);
+	assert(neighbors);
+	second_neighbors = (unsigned int *)malloc(sizeof(unsigned int) * num_vertices);
+	assert(second_neighbors);
+	fill_ins = (unsigned int *)malloc(sizeof(unsigned int) * num_vertices);
+	assert(fill_ins);
+	weights = (double *)malloc(sizeof(double) * num_vertices);
+	assert(weights);
+	elimination_steps = (unsigned int *)malloc(sizeof(unsigned int) * num_vertices);
+	assert(elimination_steps);
+	elimination_order = (unsigned int *)malloc(sizeof(unsigned int) * num_vertices);
+	assert(elimination_order);
+	eliminated = (char *)calloc(sizeof(char), (size_t)num_vertices);
+	assert(eliminated);
+	dirty = (char *)malloc(sizeof(char) * num_vertices);
+	assert(dirty);
+	memset(dirty, 1, num_vertices);
+
+	//min-fill elimination; scores only change within two hops of the eliminated node
+	tree->cliques_to_nodes_clique_list[0] = 0;
+	for(step = 0; step < num_vertices; ++step){
+		best = num_vertices;
+		for(i = 0; i < num_vertices; ++i){
+			if(eliminated[i]){
+				continue;
+			}
+			if(dirty[i]){
+				num_neighbors = collect_neighbors(adjacency, words, i, neighbors);
+				fill_ins[i] = 0;
+				weights[i] = graph->node_num_vars[i];
+				for(j = 0; j < num_neighbors; ++j){
+					weights[i] *= graph->node_num_vars[neighbors[j]];
+					for(k = j + 1; k < num_neighbors; ++k){
+						if(!nodes_adjacent(adjacency, words, neighbors[j], neighbors[k])){
+							fill_ins[i] += 1;
+						}
+					}
+				}
+				dirty[i] = 0;
+			}
+			if(best == num_vertices || fill_ins[i] < fill_ins[best] || (fill_ins[i] == fill_ins[best] && weights[i] < weights[best])){
+				best = i;
+			}
+		}
+
+		if(weights[best] > (double)MAX_CLIQUE_SIZE){
+			break;
+		}
+
+		num_neighbors = collect_neighbors(adjacency, words, best, neighbors);
+		if(tree->cliques_to_nodes_clique_list[step] + num_neighbors + 1 > clique_capacity){
+			clique_capacity = 2 * clique_capacity + num_neighbors + 1;
+			tree->cliques_to_nodes_node_list = (unsigned int *)realloc(tree->cliques_to_nodes_node_list, sizeof(unsigned int) * clique_capacity);
+			assert(tree->cliques_to_nodes_node_list);
+		}
+
+		//clique nodes in ascending order; neighbors already come out sorted
+		k = tree->cliques_to_nodes_clique_list[step];
+		for(j = 0; j < num_neighbors && neighbors[j] < best; ++j){
+			tree->cliques_to_nodes_node_list[k++] = neighbors[j];
+		}
+		tree->cliques_to_nodes_node_list[k++] = best;
+		for(; j < num_neighbors; ++j){
+			tree->cliques_to_nodes_node_list[k++] = neighbors[j];
+		}
+		tree->cliques_to_nodes_clique_list[step + 1] = k;
+
+		for(j = 0; j < num_neighbors; ++j){
+			for(k = j + 1; k < num_neighbors; ++k){
+				connect_nodes(adjacency, words, neighbors[j], neighbors[k]);
+			}
+		}
+		for(j = 0; j < num_neighbors; ++j){
+			adjacency[words * neighbors[j] + best / 64] &= ~(1ULL << (best % 64));
+			dirty[neighbors[j]] = 1;
+			num_second = collect_neighbors(adjacency, words, neighbors[j], second_neighbors);
+			for(k = 0; k < num_second; ++k){
+				dirty[second_neighbors[k]] = 1;
+			}
+		}
+		for(j = 0; j < words; ++j){
+			adjacency[words * best + j] = 0ULL;
+		}
+		eliminated[best] = 1;
+		elimination_steps[best] = step;
+		elimination_order[step] = best;
+	}
+
+	free(adjacency);
+	free(second_neighbors);
+	free(fill_ins);
+	free(weights);
+	free(eliminated);
+	free(dirty);
+
+	if(step < num_vertices){
+		free(neighbors);
+		free(elimination_steps);
+		free(elimination_order);
+		junction_tree_destroy(tree);
+		return NULL;
+	}
+
+	//parents are always eliminated later, so every child comes before its parent
+	tree->clique_parents = (unsigned int *)malloc(sizeof(unsigned int) * num_vertices);
+	assert(tree->clique_parents);
+	tree->potential_offsets = (unsigned int *)malloc(sizeof(unsigned int) * (num_vertices + 1));
+	assert(tree->potential_offsets);
+	tree->separator_offsets = (unsigned int *)malloc(sizeof(unsigned int) * (num_vertices + 1));
+	assert(tree->separator_offsets);
+	tree->parent_map_offsets = (unsigned int *)malloc(sizeof(unsigned int) * (num_vertices + 1));
+	assert(tree->parent_map_offsets);
+
+	total_potentials = 0;
+	total_separators = 0;
+	tree->max_potential_size = 0;
+	for(i = 0; i < num_vertices; ++i){
+		tree->potential_offsets[i] = (unsigned int)total_potentials;
+		tree->separator_offsets[i] = (unsigned int)total_separators;
+
+		parent = num_vertices;
+		size = 1;
+		for(j = tree->cliques_to_nodes_clique_list[i]; j < tree->cliques_to_nodes_clique_list[i + 1]; ++j){
+			node_index = tree->cliques_to_nodes_node_list[j];
+			size *= graph->node_num_vars[node_index];
+			if(node_index != elimination_order[i] && (parent == num_vertices || elimination_steps[node_index] < parent)){
+				parent = elimination_steps[node_index];
+			}
+		}
+		tree->clique_parents[i] = parent;
+		if(size > tree->max_potential_size){
+			tree->max_potential_size = size;
+		}
+		total_potentials += size;
+		if(parent != num_vertices){
+			total_separators += size / graph->node_num_vars[elimination_order[i]];
+		}
+	}
+	tree->potential_offsets[num_vertices] = (unsigned int)total_potentials;
+	tree->separator_offsets[num_vertices] = (unsigned int)total_separators;
+
+	total_parent_maps = 0;
+	for(i = 0; i < num_vertices; ++i){
+		tree->parent_map_offsets[i] = (unsigned int)total_parent_maps;
+		parent = tree->clique_parents[i];
+		if(parent != num_vertices){
+			total_parent_maps += tree->potential_offsets[parent + 1] - tree->potential_offsets[parent];
+		}
+	}
+	tree->parent_map_offsets[num_vertices] = (unsigned int)total_parent_maps;
+
+	if(total_potentials + total_parent_maps > 0x7fffffffULL){
+		free(neighbors);
+		free(elimination_steps);
+		free(elimination_order);
+		junction_tree_destroy(tree);
+		return NULL;
+	}
+
+	//where each node's marginal is read and where its CPT is multiplied in
+	tree->node_cliques = (unsigned int *)malloc(sizeof(unsigned int) * num_vertices);
+	assert(tree->node_cliques);
+	tree->factor_cliques = (unsigned int *)malloc(sizeof(unsigned int) * num_vertices);
+	assert(tree->factor_cliques);
+	for(i = 0; i < num_vertices; ++i){
+		tree->node_cliques[i] = elimination_steps[i];
+		tree->factor_cliques[i] = elimination_steps[i];
+		if(graph->node_factors[i] != NULL){
+			for(j = 0; j < graph->node_num_parents[i]; ++j){
+				step = elimination_steps[graph->node_parents[MAX_DEGREE * i + j]];
+				if(step < tree->factor_cliques[i]){
+					tree->factor_cliques[i] = step;
+				}
+			}
+		}
+	}
+
+	//children grouped by parent; roots land in the extra bucket
+	bucket_cliques(tree->clique_parents, num_vertices, num_vertices + 1, &tree->clique_children_list, &tree->clique_children);
+
+	heights = (unsigned int *)calloc(sizeof(unsigned int), (size_t)num_vertices);
+	assert(heights);
+	depths = (unsigned int *)calloc(sizeof(unsigned int), (size_t)num_vertices);
+	assert(depths);
+	tree->num_heights = 1;
+	for(i = 0; i < num_vertices; ++i){
+		parent = tree->clique_parents[i];
+		if(parent != num_vertices && heights[i] + 1 > heights[parent]){
+			heights[parent] = heights[i] + 1;
+		}
+		if(heights[i] + 1 > tree->num_heights){
+			tree->num_heights = heights[i] + 1;
+		}
+	}
+	tree->num_depths = 1;
+	for(i = num_vertices; i > 0; --i){
+		parent = tree->clique_parents[i - 1];
+		if(parent != num_vertices){
+			depths[i - 1] = depths[parent] + 1;
+		}
+		if(depths[i - 1] + 1 > tree->num_depths){
+			tree->num_depths = depths[i - 1] + 1;
+		}
+	}
+	bucket_cliques(heights, num_vertices, tree->num_heights, &tree->heights_to_cliques_height_list, &tree->heights_to_cliques_clique_list);
+	bucket_cliques(depths, num_vertices, tree->num_depths, &tree->depths_to_cliques_depth_list, &tree->depths_to_cliques_clique_list);
+	free(heights);
+	free(depths);
+
+	tree->potentials = (float *)malloc(sizeof(float) * (total_potentials + 1));
+	assert(tree->potentials);
+	tree->separators = (float *)malloc(sizeof(float) * (total_separators + 1));
+	assert(tree->separators);
+	tree->separator_ratios = (float *)malloc(sizeof(float) * (total_separators + 1));
+	assert(tree->separator_ratios);
+	tree->separator_maps = (unsigned int *)malloc(sizeof(unsigned int) * (total_potentials + 1));
+	assert(tree->separator_maps);
+	tree->parent_separator_maps = (unsigned int *)malloc(sizeof(unsigned int) * (total_parent_maps + 1));
+	assert(tree->parent_separator_maps);
+
+	//separator of a clique is the clique minus the node eliminated in it
+	for(i = 0; i < num_vertices; ++i){
+		parent = tree->clique_parents[i];
+		if(parent == num_vertices){
+			continue;
+		}
+		num_clique_nodes = 0;
+		for(j = tree->cliques_to_nodes_clique_list[i]; j < tree->cliques_to_nodes_clique_list[i + 1]; ++j){
+			if(tree->cliques_to_nodes_node_list[j] != elimination_order[i]){
+				neighbors[num_clique_nodes] = tree->cliques_to_nodes_node_list[j];
+				num_clique_nodes += 1;
+			}
+		}
+		build_index_map(graph, &tree->cliques_to_nodes_node_list[tree->cliques_to_nodes_clique_list[i]],
+						tree->cliques_to_nodes_clique_list[i + 1] - tree->cliques_to_nodes_clique_list[i],
+						neighbors, num_clique_nodes, &tree->separator_maps[tree->potential_offsets[i]]);
+		build_index_map(graph, &tree->cliques_to_nodes_node_list[tree->cliques_to_nodes_clique_list[parent]],
+						tree->cliques_to_nodes_clique_list[parent + 1] - tree->cliques_to_nodes_clique_list[parent],
+						neighbors, num_clique_nodes, &tree->parent_separator_maps[tree->parent_map_offsets[i]]);
+	}
+
+	free(neighbors);
+	free(elimination_steps);
+	free(elimination_order);
+
+	return tree;
+}
+
+/**
+ * Two-pass Hugin propagation. Collect runs by clique height and distribute by depth so each level is processed in parallel;
+ * the calibrated potentials stay in the tree for junction_tree_marginalize_nodes and node_states are only read, so the tree
+ * can be propagated again after the evidence changes.
+ */
+void junction_tree_propagate(JunctionTree_t tree, Graph_t graph){
+	unsigned int i, j, c, child, parent, level, num_cliques;
+	unsigned int scope[MAX_DEGREE + 1];
+	unsigned int * map;
+
+	num_cliques = tree->num_cliques;
+	assert(num_cliques == graph->current_num_vertices);
+
+	for(i = 0; i < tree->potential_offsets[num_cliques]; ++i){
+		tree->potentials[i] = 1.0f;
+	}
+	for(i = 0; i < tree->separator_offsets[num_cliques]; ++i){
+		tree->separators[i] = 1.0f;
+	}
+
+	//CPTs and node states (priors or evidence) into their cliques
+	map = (unsigned int *)malloc(sizeof(unsigned int) * tree->max_potential_size);
+	assert(map);
+	for(i = 0; i < num_cliques; ++i){
+		if(graph->node_factors[i] != NULL){
+			c = tree->factor_cliques[i];
+			scope[0] = i;
+			for(j = 0; j < graph->node_num_parents[i]; ++j){
+				scope[j + 1] = graph->node_parents[MAX_DEGREE * i + j];
+			}
+			build_index_map(graph, &tree->cliques_to_nodes_node_list[tree->cliques_to_nodes_clique_list[c]],
+							tree->cliques_to_nodes_clique_list[c + 1] - tree->cliques_to_nodes_clique_list[c],
+							scope, graph->node_num_parents[i] + 1, map);
+			multiply_potential(&tree->potentials[tree->potential_offsets[c]], tree->potential_offsets[c + 1] - tree->potential_offsets[c], map, graph->node_factors[i]);
+		}
+
+		c = tree->node_cliques[i];
+		build_index_map(graph, &tree->cliques_to_nodes_node_list[tree->cliques_to_nodes_clique_list[c]],
+						tree->cliques_to_nodes_clique_list[c + 1] - tree->cliques_to_nodes_clique_list[c],
+						&i, 1, map);
+		multiply_potential(&tree->potentials[tree->potential_offsets[c]], tree->potential_offsets[c + 1] - tree->potential_offsets[c], map, &graph->node_states[MAX_STATES * i]);
+	}
+	free(map);
+
+	//collect: a clique absorbs its children, which all sit at lower heights, then reports to its parent
+	for(level = 0; level < tree->num_heights; ++level){
+#pragma omp parallel for default(none) shared(tree, level, num_cliques) private(i, j, c, child, parent) schedule(dynamic, 1)
+		for(i = tree->heights_to_cliques_height_list[level]; i < tree->heights_to_cliques_height_list[level + 1]; ++i){
+			c = tree->heights_to_cliques_clique_list[i];
+			for(j = tree->clique_children_list[c]; j < tree->clique_children_list[c + 1]; ++j){
+				child = tree->clique_children[j];
+				multiply_potential(&tree->potentials[tree->potential_offsets[c]], tree->potential_offsets[c + 1] - tree->potential_offsets[c],
+								   &tree->parent_separator_maps[tree->parent_map_offsets[child]], &tree->separator_ratios[tree->separator_offsets[child]]);
+			}
+			parent = tree->clique_parents[c];
+			if(parent != num_cliques){
+				update_separator(&tree->potentials[tree->potential_offsets[c]], tree->potential_offsets[c + 1] - tree->potential_offsets[c],
+								 &tree->separator_maps[tree->potential_offsets[c]], &tree->separators[tree->separator_offsets[c]],
+								 &tree->separator_ratios[tree->separator_offsets[c]], tree->separator_offsets[c + 1] - tree->separator_offsets[c]);
+			}
+		}
+	}
+
+	//distribute: each clique pulls from its calibrated parent
+	for(level = 1; level < tree->num_depths; ++level){
+#pragma omp parallel for default(none) shared(tree, level) private(i, c, parent) schedule(dynamic, 1)
+		for(i = tree->depths_to_cliques_depth_list[level]; i < tree->depths_to_cliques_depth_list[level + 1]; ++i){
+			c = tree->depths_to_cliques_clique_list[i];
+			parent = tree->clique_parents[c];
+			update_separator(&tree->potentials[tree->potential_offsets[parent]], tree->potential_offsets[parent + 1] - tree->potential_offsets[parent],
+							 &tree->parent_separator_maps[tree->parent_map_offsets[c]], &tree->separators[tree->separator_offsets[c]],
+							 &tree->separator_ratios[tree->separator_offsets[c]], tree->separator_offsets[c + 1] - tree->separator_offsets[c]);
+			multiply_potential(&tree->potentials[tree->potential_offsets[c]], tree->potential_offsets[c + 1] - tree->potential_offsets[c],
+							   &tree->separator_maps[tree->potential_offsets[c]], &tree->separator_ratios[tree->separator_offsets[c]]);
+		}
+	}
+}
+
+/**
+ * Reads the marginals of the requested nodes out of a calibrated tree.
+ * beliefs[MAX_STATES * n] receives the normalized marginal of nodes[n], matching marginalize_loopy_nodes.
+ */
+void junction_tree_marginalize_nodes(JunctionTree_t tree, Graph_t graph, unsigned int * nodes, unsigned int num_nodes, float * beliefs){
+	unsigned int i, j, k, n, c, node_index, num_clique_nodes, size, stride, num_variables;
+	float sum;
+	float marginal[MAX_STATES];
+	float * potential;
+
+#pragma omp parallel for default(none) shared(tree, graph, nodes, num_nodes, beliefs) private(i, j, k, n, c, node_index, num_clique_nodes, num_variables, size, stride, sum, marginal, potential)
+	for(n = 0; n < num_nodes; ++n){
+		i = nodes[n];
+		c = tree->node_cliques[i];
+		potential = &tree->potentials[tree->potential_offsets[c]];
+		size = tree->potential_offsets[c + 1] - tree->potential_offsets[c];
+		num_variables = graph->node_num_vars[i];
+		num_clique_nodes = tree->cliques_to_nodes_clique_list[c + 1] - tree->cliques_to_nodes_clique_list[c];
+
+		stride = 1;
+		for(j = num_clique_nodes; j > 0; --j){
+			node_index = tree->cliques_to_nodes_node_list[tree->cliques_to_nodes_clique_list[c] + j - 1];
+			if(node_index == i){
+				break;
+			}
+			stride *= graph->node_num_vars[node_index];
+		}
+
+		for(k = 0; k < num_variables; ++k){
+			marginal[k] = 0.0f;
+		}
+		for(j = 0; j < size; ++j){
+			marginal[(j / stride) % num_variables] += potential[j];
+		}
+		sum = 0.0f;
+		for(k = 0; k < num_variables; ++k){
+			sum += marginal[k];
+		}
+		if(sum <= 0.0f){
+			sum = 1.0f;
+		}
+		for(k = 0; k < num_variables; ++k){
+			beliefs[MAX_STATES * n + k] = marginal[k] / sum;
+		}
+	}
+}
+
+void junction_tree_destroy(JunctionTree_t tree){
+	free(tree->cliques_to_nodes_clique_list);
+	free(tree->cliques_to_nodes_node_list);
+	free(tree->clique_parents);
+	free(tree->clique_children_list);
+	free(tree->clique_children);
+	free(tree->node_cliques);
+	free(tree->factor_cliques);
+	free(tree->potential_offsets);
+	free(tree->potentials);
+	free(tree->separator_offsets);
+	free(tree->separators);
+	free(tree->separator_ratios);
+	free(tree->separator_maps);
+	free(tree->parent_map_offsets);
+	free(tree->parent_separator_maps);
+	free(tree->heights_to_cliques_height_list);
+	free(tree->heights_to_cliques_clique_list);
+	free(tree->depths_to_cliques_depth_list);
+	free(tree->depths_to_cliques_clique_list);
+	free(tree);
+}
+
+// maps each edge u->v to its partner v->u, or num_edges when there is none
+static unsigned int * build_reverse_edges(Graph_t graph){
+	unsigned int i, j, num_vertices, num_edges, in_start, in_end, out_start, out_end, edge_index;
+	unsigned int * reverse_edges;
+	unsigned int * in_edge_from;
+
+	num_vertices = graph->current_num_vertices;
+	num_edges = graph->current_num_edges;
+
+	reverse_edges = (unsigned int *)malloc(sizeof(unsigned int) * num_edges);
+	assert(reverse_edges);
+	in_edge_from = (unsigned int *)malloc(sizeof(unsigned int) * num_vertices);
+	assert(in_edge_from);
+
+	for(i = 0; i < num_vertices; ++i){
+		in_edge_from[i] = num_edges;
+	}
+	for(i = 0; i < num_vertices; ++i){
+		in_start = graph->dest_nodes_to_edges_node_list[i];
+		out_start = graph->src_nodes_to_edges_node_list[i];
+		if(i + 1 == num_vertices){
+			in_end = num_edges;
+			out_end = num_edges;
+		}
+		else{
+			in_end = graph->dest_nodes_to_edges_node_list[i + 1];
+			out_end = graph->src_nodes_to_edges_node_list[i + 1];
+		}
+		for(j = in_start; j < in_end; ++j){
+			edge_index = graph->dest_nodes_to_edges_edge_list[j];
+			in_edge_from[graph->edges_src_index[edge_index]] = edge_index;
+		}
+		for(j = out_start; j < out_end; ++j){
+			edge_index = graph->src_nodes_to_edges_edge_list[j];
+			reverse_edges[edge_index] = in_edge_from[graph->edges_dest_index[edge_index]];
+		}
+		for(j = in_start; j < in_end; ++j){
+			in_edge_from[graph->edges_src_index[graph->dest_nodes_to_edges_edge_list[j]]] = num_edges;
+		}
+	}
+
+	free(in_edge_from);
+	return reverse_edges;
+}
+
+static unsigned int node_in_degree(Graph_t graph, unsigned int node_index){
+	if(node_index + 1 == graph->current_num_vertices){
+		return graph->current_num_edges - graph->dest_nodes_to_edges_node_list[node_index];
+	}
+	return graph->dest_nodes_to_edges_node_list[node_index + 1] - graph->dest_nodes_to_edges_node_list[node_index];
+}
+
+// node belief times every incoming message except the one on excluded_edge
+static void task_message_buffer(Graph_t graph, unsigned int node_index, unsigned int excluded_edge, float * messages, float * message_buffer){
+	unsigned int i, num_variables, start_index, end_index, edge_index;
+
+	num_variables = graph->node_num_vars[node_index];
+	for(i = 0; i < num_variables; ++i){
+		message_buffer[i] = graph->node_states[MAX_STATES * node_index + i];
+	}
+
+	start_index = graph->dest_nodes_to_edges_node_list[node_index];
+	if(node_index + 1 == graph->current_num_vertices){
+		end_index = graph->current_num_edges;
+	}
+	else{
+		end_index = graph->dest_nodes_to_edges_node_list[node_index + 1];
+	}
+	for(i = start_index; i < end_index; ++i){
+		edge_index = graph->dest_nodes_to_edges_edge_list[i];
+		if(edge_index != excluded_edge){
+			combine_message(message_buffer, messages, num_variables, MAX_STATES * edge_index);
+		}
+	}
+}
+
+struct task_state {
+	unsigned int * reverse_edges;
+	char * delivered;
+	char * claimed;
+	unsigned int * received;
+	unsigned int * remaining;
+};
+
+struct task_entry {
+	unsigned int node_index;
+	unsigned int count;
+};
+
+struct task_stack {
+	struct task_entry * entries;
+	unsigned int size;
+	unsigned int capacity;
+};
+
+static void task_stack_push(struct task_stack * stack, unsigned int node_index, unsigned int count){
+	if(stack->size == stack->capacity){
+		stack->capacity = 2 * stack->capacity;
+		stack->entries = (struct task_entry *)realloc(stack->entries, sizeof(struct task_entry) * stack->capacity);
+		assert(stack->entries);
+	}
+	stack->entries[stack->size].node_index = node_index;
+	stack->entries[stack->size].count = count;
+	stack->size += 1;
+}
+
+// a node is final once every message into it has arrived and every message out of it has been computed from its belief
+static void task_retire(Graph_t graph, unsigned int node_index, struct task_state * state){
+	if(__sync_sub_and_fetch(&state->remaining[node_index], 1) == 0){
+		marginalize_node_acc(graph->node_states, graph->node_num_vars, node_index, graph->edges_messages,
+							 graph->dest_nodes_to_edges_node_list, graph->dest_nodes_to_edges_edge_list,
+							 graph->current_num_vertices, graph->current_num_edges);
+	}
+}
+
+// sends on an edge this thread claimed and queues the receiver once it has enough inputs to fire
+static void task_send(Graph_t graph, unsigned int edge_index, float * message_buffer, struct task_state * state,
+					  struct task_stack * stack){
+	unsigned int dest_index, count, in_degree;
+
+	send_message_for_edge(message_buffer, edge_index, graph->edges_joint_probabilities, graph->edges_messages, graph->edges_x_dim, graph->edges_y_dim);
+	__atomic_store_n(&state->delivered[edge_index], 1, __ATOMIC_RELEASE);
+
+	dest_index = graph->edges_dest_index[edge_index];
+	count = __sync_add_and_fetch(&state->received[dest_index], 1);
+	in_degree = node_in_degree(graph, dest_index);
+	if(count + 1 == in_degree || count == in_degree){
+		task_stack_push(stack, dest_index, count);
+	}
+
+	task_retire(graph, dest_index, state);
+	task_retire(graph, graph->edges_src_index[edge_index], state);
+}
+
+/**
+ * Fires a node that has received count of its incoming messages.
+ * With one message missing it can answer the sender of that message; with all of them it answers everyone else.
+ */
+static void task_fire_node(Graph_t graph, unsigned int node_index, unsigned int count, struct task_state * state,
+						   struct task_stack * stack){
+	unsigned int i, k, start_index, end_index, edge_index, reverse_index, num_edges, num_variables, in_degree;
+	float full_buffer[MAX_STATES];
+	float message_buffer[MAX_STATES];
+	float excluded;
+
+	num_edges = graph->current_num_edges;
+	num_variables = graph->node_num_vars[node_index];
+	in_degree = node_in_degree(graph, node_index);
+
+	start_index = graph->dest_nodes_to_edges_node_list[node_index];
+	end_index = start_index + in_degree;
+
+	if(count + 1 == in_degree){
+		//the last missing message may already have arrived; the thread delivering it then answers instead
+		for(i = start_index; i < end_index; ++i){
+			reverse_index = graph->dest_nodes_to_edges_edge_list[i];
+			if(__atomic_load_n(&state->delivered[reverse_index], __ATOMIC_ACQUIRE) == 0){
+				edge_index = state->reverse_edges[reverse_index];
+				if(edge_index < num_edges && __sync_bool_compare_and_swap(&state->claimed[edge_index], 0, 1)){
+					task_message_buffer(graph, node_index, reverse_index, graph->edges_messages, message_buffer);
+					task_send(graph, edge_index, message_buffer, state, stack);
+				}
+				break;
+			}
+		}
+		return;
+	}
+
+	task_message_buffer(graph, node_index, num_edges, graph->edges_messages, full_buffer);
+
+	start_index = graph->src_nodes_to_edges_node_list[node_index];
+	if(node_index + 1 == graph->current_num_vertices){
+		end_index = num_edges;
+	}
+	else{
+		end_index = graph->src_nodes_to_edges_node_list[node_index + 1];
+	}
+	for(i = start_index; i < end_index; ++i){
+		edge_index = graph->src_nodes_to_edges_edge_list[i];
+		if(!__sync_bool_compare_and_swap(&state->claimed[edge_index], 0, 1)){
+			continue;
+		}
+		reverse_index = state->reverse_edges[edge_index];
+		if(reverse_index == num_edges){
+			task_send(graph, edge_index, full_buffer, state, stack);
+			continue;
+		}
+		//divide the receiver's own message back out, recomputing when that would divide by zero
+		for(k = 0; k < num_variables; ++k){
+			excluded = graph->edges_messages[MAX_STATES * reverse_index + k];
+			if(excluded <= 0.0f){
+				break;
+			}
+			message_buffer[k] = full_buffer[k] / excluded;
+		}
+		if(k < num_variables){
+			task_message_buffer(graph, node_index, reverse_index, graph->edges_messages, message_buffer);
+		}
+		task_send(graph, edge_index, message_buffer, state, stack);
+	}
+}
+
+static void task_run(Graph_t graph, unsigned int node_index, unsigned int count, struct task_state * state){
+	struct task_stack stack;
+	struct task_entry entry;
+#ifdef _OPENMP
+	unsigned int base;
+#endif
+
+	stack.size = 0;
+	stack.capacity = 16;
+	stack.entries = (struct task_entry *)malloc(sizeof(struct task_entry) * stack.capacity);
+	assert(stack.entries);
+
+	task_stack_push(&stack, node_index, count);
+	while(stack.size > 0){
+		stack.size -= 1;
+		entry = stack.entries[stack.size];
+#ifdef _OPENMP
+		base = stack.size;
+#endif
+		task_fire_node(graph, entry.node_index, entry.count, state, &stack);
+#ifdef _OPENMP
+		//keep one ready node for this task and hand the rest to idle threads
+		while(stack.size > base + 1){
+			stack.size -= 1;
+			entry = stack.entries[stack.size];
+#pragma omp task default(none) firstprivate(graph, entry, state)
+			task_run(graph, entry.node_index, entry.count, state);
+		}
+#endif
+	}
+
+	free(stack.entries);
+}
+
+/**
+ * Tree BP as a dependency graph: a message fires as soon as the messages it depends on have arrived instead of waiting on a level barrier,
+ * so a subtree starts distributing as soon as its collect finishes. Per node atomic counters drive OpenMP tasks.
+ * Nodes are marginalized as soon as they are final; messages that can never fire (cycles) stay uniform.
+ */
+void propagate_using_tasks(Graph_t graph){
+	unsigned int i, k, num_vertices, num_edges;
+	struct task_state state;
+	struct task_state * shared_state;
+
+	num_vertices = graph->current_num_vertices;
+	num_edges = graph->current_num_edges;
+
+	state.reverse_edges = build_reverse_edges(graph);
+	state.received = (unsigned int *)calloc(num_vertices, sizeof(unsigned int));
+	assert(state.received);
+	state.remaining = (unsigned int *)malloc(sizeof(unsigned int) * num_vertices);
+	assert(state.remaining);
+	state.delivered = (char *)calloc(num_edges, sizeof(char));
+	assert(state.delivered);
+	state.claimed = (char *)calloc(num_edges, sizeof(char));
+	assert(state.claimed);
+	shared_state = &state;
+
+	for(i = 0; i < num_vertices; ++i){
+		state.remaining[i] = node_degree(graph, i);
+	}
+	for(i = 0; i < num_edges; ++i){
+		for(k = 0; k < graph->edges_y_dim[i]; ++k){
+			graph->edges_messages[MAX_STATES * i + k] = 1.0f;
+		}
+	}
+
+#pragma omp parallel default(none) shared(graph, num_vertices, shared_state) private(i)
+	{
+#pragma omp single
+		{
+			for(i = 0; i < num_vertices; ++i){
+				if(node_in_degree(graph, i) <= 1){
+#pragma omp task default(none) firstprivate(graph, i, shared_state)
+					task_run(graph, i, 0, shared_state);
+				}
+			}
+		}
+	}
+
+	//isolated nodes and nodes left waiting on a cycle
+	for(i = 0; i < num_vertices; ++i){
+		if(state.remaining[i] != 0 || node_degree(graph, i) == 0){
+			marginalize_node_acc(graph->node_states, graph->node_num_vars, i, graph->edges_messages,
+								 graph->dest_nodes_to_edges_node_list, graph->dest_nodes_to_edges_edge_list,
+								 num_vertices, num_edges);
+		}
+	}
+
+	free(state.reverse_edges);
+	free(state.received);
+	free(state.remaining);
+	free(state.delivered);
+	free(state.claimed);
+}
+
+// a neighbour is the source of an incoming edge, or the destination of an outgoing edge that has no partner coming back
+static void release_neighbor(Graph_t graph, unsigned int neighbor_index, unsigned int round, unsigned int * degrees, unsigned int * end_index){
+	unsigned int slot, num_vertices;
+
+	num_vertices = graph->current_num_vertices;
+	if(graph->node_levels[neighbor_index] == num_vertices && __sync_sub_and_fetch(&degrees[neighbor_index], 1) == 1 &&
+	   __sync_bool_compare_and_swap(&graph->node_levels[neighbor_index], num_vertices, round + 1)){
+#pragma omp atomic capture
+		slot = (*end_index)++;
+
+		graph->levels_to_nodes[slot] = neighbor_index;
+	}
+}
+
+/**
+ * Peels the graph down to its 2-core: round r of levels_to_nodes holds the nodes left with at most one unpeeled neighbour in that round,
+ * and the final level holds the core (empty for a forest). node_levels records each node's round.
+ */
+void init_core_levels_to_nodes(Graph_t graph){
+	unsigned int i, j, num_vertices, num_edges, round, end_index, round_start, round_end, in_start, in_end, out_start, out_end, node_index, edge_index;
+	unsigned int * degrees;
+	unsigned int * reverse_edges;
+
+	num_vertices = graph->current_num_vertices;
+	num_edges = graph->current_num_edges;
+
+	degrees = (unsigned int *)malloc(sizeof(unsigned int) * num_vertices);
+	assert(degrees);
+	reverse_edges = build_reverse_edges(graph);
+
+	for(i = 0; i < num_vertices; ++i){
+		degrees[i] = node_in_degree(graph, i);
+	}
+	for(i = 0; i < num_edges; ++i){
+		if(reverse_edges[i] == num_edges){
+			degrees[graph->edges_src_index[i]] += 1;
+		}
+	}
+
+	end_index = num_vertices;
+	for(i = 0; i < num_vertices; ++i){
+		if(degrees[i] <= 1){
+			graph->node_levels[i] = 0;
+			graph->levels_to_nodes[end_index] = i;
+			end_index += 1;
+		}
+		else{
+			graph->node_levels[i] = num_vertices;
+		}
+	}
+
+	round = 0;
+	round_start = num_vertices;
+	while(round_start < end_index){
+		graph->levels_to_nodes[round] = round_start;
+		round_end = end_index;
+
+		//each peeled node releases its remaining neighbour; one left with a single neighbour is peeled next round
+#pragma omp parallel for default(none) shared(graph, degrees, reverse_edges, round, round_start, round_end, end_index, num_vertices, num_edges) private(i, j, node_index, edge_index, in_start, in_end, out_start, out_end)
+		for(i = round_start; i < round_end; ++i){
+			node_index = graph->levels_to_nodes[i];
+			in_start = graph->dest_nodes_to_edges_node_list[node_index];
+			in_end = in_start + node_in_degree(graph, node_index);
+			for(j = in_start; j < in_end; ++j){
+				release_neighbor(graph, graph->edges_src_index[graph->dest_nodes_to_edges_edge_list[j]], round, degrees, &end_index);
+			}
+			out_start = graph->src_nodes_to_edges_node_list[node_index];
+			if(node_index + 1 == num_vertices){
+				out_end = num_edges;
+			}
+			else{
+				out_end = graph->src_nodes_to_edges_node_list[node_index + 1];
+			}
+			for(j = out_start; j < out_end; ++j){
+				edge_index = graph->src_nodes_to_edges_edge_list[j];
+				if(reverse_edges[edge_index] == num_edges){
+					release_neighbor(graph, graph->edges_dest_index[edge_index], round, degrees, &end_index);
+				}
+			}
+		}
+
+		round += 1;
+		round_start = round_end;
+	}
+
+	// what is left is the core
+	graph->levels_to_nodes[round] = end_index;
+	for(i = 0; i < num_vertices; ++i){
+		if(graph->node_levels[i] == num_vertices){
+			graph->node_levels[i] = round;
+			graph->levels_to_nodes[end_index] = i;
+			end_index += 1;
+		}
+	}
+	graph->num_levels = round + 1;
+
+	free(degrees);
+	free(reverse_edges);
+}
+
+static unsigned int level_end_index(Graph_t graph, unsigned int level){
+	if(level + 1 == graph->num_levels){
+		return 2 * graph->current_num_vertices;
+	}
+	return graph->levels_to_nodes[level + 1];
+}
+
+// sends from every node of a level to its neighbours on lower (collect == 0) or on equal and higher (collect != 0) levels with the loopy rule,
+// reading previous_edge_messages and staging in current_edge_messages so nodes of one level never read a message another is writing;
+// returns how far the sent messages moved
+static float propagate_core_level(Graph_t graph, unsigned int level, char collect, float * previous_edge_messages, float * current_edge_messages){
+	unsigned int i, j, k, start_index, end_index, out_start, out_end, node_index, edge_index, dest_level, num_variables;
+	float delta, diff;
+	float message_buffer[MAX_STATES];
+
+	start_index = graph->levels_to_nodes[level];
+	end_index = level_end_index(graph, level);
+
+#pragma omp parallel for default(none) shared(graph, level, collect, previous_edge_messages, current_edge_messages, start_index, end_index) private(i, j, out_start, out_end, node_index, edge_index, dest_level, num_variables, message_buffer) schedule(dynamic, 16)
+	for(i = start_index; i < end_index; ++i){
+		node_index = graph->levels_to_nodes[i];
+		num_variables = graph->node_num_vars[node_index];
+		initialize_message_buffer(message_buffer, graph->node_states, node_index, num_variables);
+		read_incoming_messages(message_buffer, graph->dest_nodes_to_edges_node_list, graph->dest_nodes_to_edges_edge_list, previous_edge_messages,
+							   graph->current_num_edges, graph->current_num_vertices, num_variables, node_index);
+
+		out_start = graph->src_nodes_to_edges_node_list[node_index];
+		if(node_index + 1 == graph->current_num_vertices){
+			out_end = graph->current_num_edges;
+		}
+		else{
+			out_end = graph->src_nodes_to_edges_node_list[node_index + 1];
+		}
+		for(j = out_start; j < out_end; ++j){
+			edge_index = graph->src_nodes_to_edges_edge_list[j];
+			dest_level = graph->node_levels[graph->edges_dest_index[edge_index]];
+			if((collect != 0) == (dest_level >= level)){
+				send_message_for_edge(message_buffer, edge_index, graph->edges_joint_probabilities, current_edge_messages, graph->edges_x_dim, graph->edges_y_dim);
+			}
+		}
+	}
+
+	delta = 0.0f;
+#pragma omp parallel for default(none) shared(graph, level, collect, previous_edge_messages, current_edge_messages, start_index, end_index) private(i, j, k, out_start, out_end, node_index, edge_index, dest_level, diff) reduction(+:delta) schedule(dynamic, 16)
+	for(i = start_index; i < end_index; ++i){
+		node_index = graph->levels_to_nodes[i];
+		out_start = graph->src_nodes_to_edges_node_list[node_index];
+		if(node_index + 1 == graph->current_num_vertices){
+			out_end = graph->current_num_edges;
+		}
+		else{
+			out_end = graph->src_nodes_to_edges_node_list[node_index + 1];
+		}
+		for(j = out_start; j < out_end; ++j){
+			edge_index = graph->src_nodes_to_edges_edge_list[j];
+			dest_level = graph->node_levels[graph->edges_dest_index[edge_index]];
+			if((collect != 0) == (dest_level >= level)){
+				for(k = 0; k < graph->edges_y_dim[edge_index]; ++k){
+					diff = current_edge_messages[MAX_STATES * edge_index + k] - previous_edge_messages[MAX_STATES * edge_index + k];
+					if(diff != diff){
+						diff = 0.0f;
+					}
+					delta += fabs(diff);
+					previous_edge_messages[MAX_STATES * edge_index + k] = current_edge_messages[MAX_STATES * edge_index + k];
+				}
+			}
+		}
+	}
+	return delta;
+}
+
+/**
+ * Loopy BP scheduled around the 2-core: each iteration sweeps the peeled trees level by level into the core (collect), runs one sweep over
+ * the core, and sweeps back out to the leaves (distribute). Every pass uses the same message rule as loopy_propagate_until (a node's belief
+ * times all of its incoming messages), so it converges to the same fixed point; the fringe passes just carry a change across a whole tree in
+ * one iteration instead of one hop. Expects init_previous_edge and init_core_levels_to_nodes; returns the number of iterations.
+ */
+unsigned int loopy_propagate_until_core(Graph_t graph, float convergence, unsigned int max_iterations){
+	unsigned int i, l, core_level, core_start;
+	float delta, previous_delta;
+	float * previous_edge_messages;
+	float * current_edge_messages;
+
+	previous_edge_messages = *graph->previous_edge_messages;
+	current_edge_messages = *graph->current_edge_messages;
+
+	core_level = graph->num_levels - 1;
+	core_start = graph->levels_to_nodes[core_level];
+
+	previous_delta = -1.0f;
+	delta = 0.0f;
+
+	for(i = 0; i < max_iterations; ++i){
+		delta = 0.0f;
+		for(l = 0; l < core_level; ++l){
+			delta += propagate_core_level(graph, l, 1, previous_edge_messages, current_edge_messages);
+		}
+		if(core_start < 2 * graph->current_num_vertices){
+			delta += loopy_sweep_node_list(graph, graph->levels_to_nodes + core_start, 2 * graph->current_num_vertices - core_start,
+										   previous_edge_messages, current_edge_messages);
+		}
+		for(l = core_level; l > 0; --l){
+			delta += propagate_core_level(graph, l - 1, 0, previous_edge_messages, current_edge_messages);
+		}
+
+		if(delta < convergence || fabs(delta - previous_delta) < convergence){
+			break;
+		}
+		if(i < max_iterations - 1) {
+			previous_delta = delta;
+		}
+	}
+	if(i == max_iterations){
+		printf("No Convergence: previous: %f vs current: %f\n", previous_delta, delta);
+	}
+
+	return i;
+}
+
+struct partition_block {
+	unsigned int num_nodes;
+	unsigned int * nodes;
+	unsigned int * num_vars;
+	float * node_states;
+
+	unsigned int num_edges;
+	unsigned int * out_offsets;
+	unsigned int * in_offsets;
+	unsigned int * in_slots;
+	unsigned int * edges;
+	unsigned int * x_dim;
+	unsigned int * y_dim;
+	float * joint_probabilities;
+
+	unsigned int num_boundary_nodes;
+	unsigned int * node_order;
+
+	unsigned int num_ghosts;
+	unsigned int * ghost_partitions;
+	unsigned int * ghost_edges;
+
+	unsigned int num_sends;
+	unsigned int * send_edges;
+	unsigned int * send_partitions;
+	unsigned int * send_slots;
+
+	float * messages[2];
+	unsigned int current;
+	float delta;
+};
+
+// index of every edge within its sender's part
+static unsigned int * build_edge_local_index(Graph_t graph){
+	unsigned int j, p, k, edge_count, node_index, start_index, end_index, num_vertices, num_edges;
+	unsigned int * edge_local_index;
+
+	num_vertices = graph->current_num_vertices;
+	num_edges = graph->current_num_edges;
+
+	edge_local_index = (unsigned int *)malloc(sizeof(unsigned int) * (num_edges + 1));
+	assert(edge_local_index);
+	for(p = 0; p < graph->num_partitions; ++p){
+		edge_count = 0;
+		for(j = graph->partitions_to_nodes_partition_list[p]; j < graph->partitions_to_nodes_partition_list[p + 1]; ++j){
+			node_index = graph->partitions_to_nodes_node_list[j];
+			start_index = graph->src_nodes_to_edges_node_list[node_index];
+			end_index = (node_index + 1 == num_vertices) ? num_edges : graph->src_nodes_to_edges_node_list[node_index + 1];
+			for(k = start_index; k < end_index; ++k){
+				edge_local_index[graph->src_nodes_to_edges_edge_list[k]] = edge_count;
+				edge_count += 1;
+			}
+		}
+	}
+	return edge_local_index;
+}
+
+// builds one partition's block; called by the thread that iterates it so every array is first touched on its socket
+static void build_partition_block(Graph_t graph, unsigned int partition, unsigned int * edge_local_index, struct partition_block * block){
+	unsigned int i, j, node_index, edge_index, src_partition, start_index, end_index, num_vertices, num_edges, num_in, edge_count, ghost_count, slot;
+	char is_boundary;
+	float * messages;
+
+	num_vertices = graph->current_num_vertices;
+	num_edges = graph->current_num_edges;
+	messages = *graph->previous_edge_messages;
+
+	block->num_nodes = graph->partitions_to_nodes_partition_list[partition + 1] - graph->partitions_to_nodes_partition_list[partition];
+	block->nodes = graph->partitions_to_nodes_node_list + graph->partitions_to_nodes_partition_list[partition];
+
+	block->num_edges = 0;
+	block->num_ghosts = 0;
+	num_in = 0;
+	for(i = 0; i < block->num_nodes; ++i){
+		node_index = block->nodes[i];
+		start_index = graph->src_nodes_to_edges_node_list[node_index];
+		end_index = (node_index + 1 == num_vertices) ? num_edges : graph->src_nodes_to_edges_node_list[node_index + 1];
+		block->num_edges += end_index - start_index;
+
+		start_index = graph->dest_nodes_to_edges_node_list[node_index];
+		end_index = (node_index + 1 == num_vertices) ? num_edges : graph->dest_nodes_to_edges_node_list[node_index + 1];
+		num_in += end_index - start_index;
+		for(j = start_index; j < end_index; ++j){
+			if(graph->node_partitions[graph->edges_src_index[graph->dest_nodes_to_edges_edge_list[j]]] != partition){
+				block->num_ghosts += 1;
+			}
+		}
+	}
+
+	block->num_vars = (unsigned int *)malloc(sizeof(unsigned int) * (block->num_nodes + 1));
+	assert(block->num_vars);
+	block->node_states = (float *)malloc(sizeof(float) * MAX_STATES * (block->num_nodes + 1));
+	assert(block->node_states);
+	block->out_offsets = (unsigned int *)malloc(sizeof(unsigned int) * (block->num_nodes + 1));
+	assert(block->out_offsets);
+	block->in_offsets = (unsigned int *)malloc(sizeof(unsigned int) * (block->num_nodes + 1));
+	assert(block->in_offsets);
+	block->in_slots = (unsigned int *)malloc(sizeof(unsigned int) * (num_in + 1));
+	assert(block->in_slots);
+	block->edges = (unsigned int *)malloc(sizeof(unsigned int) * (block->num_edges + 1));
+	assert(block->edges);
+	block->x_dim = (unsigned int *)malloc(sizeof(unsigned int) * (block->num_edges + 1));
+	assert(block->x_dim);
+	block->y_dim = (unsigned int *)malloc(sizeof(unsigned int) * (block->num_edges + 1));
+	assert(block->y_dim);
+	block->joint_probabilities = (float *)malloc(sizeof(float) * MAX_STATES * MAX_STATES * (block->num_edges + 1));
+	assert(block->joint_probabilities);
+	block->node_order = (unsigned int *)malloc(sizeof(unsigned int) * (block->num_nodes + 1));
+	assert(block->node_order);
+	block->ghost_partitions = (unsigned int *)malloc(sizeof(unsigned int) * (block->num_ghosts + 1));
+	assert(block->ghost_partitions);
+	block->ghost_edges = (unsigned int *)malloc(sizeof(unsigned int) * (block->num_ghosts + 1));
+	assert(block->ghost_edges);
+	block->messages[0] = (float *)malloc(sizeof(float) * MAX_STATES * (block->num_edges + block->num_ghosts + 1));
+	assert(block->messages[0]);
+	block->messages[1] = (float *)malloc(sizeof(float) * MAX_STATES * (block->num_edges + block->num_ghosts + 1));
+	assert(block->messages[1]);
+
+	// local edges are the ones this partition sends on, in node order; ghosts follow them in the message arrays
+	edge_count = 0;
+	ghost_count = 0;
+	num_in = 0;
+	block->num_boundary_nodes = 0;
+	for(i = 0; i < block->num_nodes; ++i){
+		node_index = block->nodes[i];
+		block->num_vars[i] = graph->node_num_vars[node_index];
+		memcpy(block->node_states + MAX_STATES * i, graph->node_states + MAX_STATES * node_index, sizeof(float) * MAX_STATES);
+
+		block->out_offsets[i] = edge_count;
+		start_index = graph->src_nodes_to_edges_node_list[node_index];
+		end_index = (node_index + 1 == num_vertices) ? num_edges : graph->src_nodes_to_edges_node_list[node_index + 1];
+		is_boundary = 0;
+		for(j = start_index; j < end_index; ++j){
+			edge_index = graph->src_nodes_to_edges_edge_list[j];
+			if(graph->node_partitions[graph->edges_dest_index[edge_index]] != partition){
+				is_boundary = 1;
+			}
+			block->edges[edge_count] = edge_index;
+			block->x_dim[edge_count] = graph->edges_x_dim[edge_index];
+			block->y_dim[edge_count] = graph->edges_y_dim[edge_index];
+			memcpy(block->joint_probabilities + MAX_STATES * MAX_STATES * edge_count, graph->edges_joint_probabilities + MAX_STATES * MAX_STATES * edge_index,
+				   sizeof(float) * MAX_STATES * MAX_STATES);
+			memcpy(block->messages[0] + MAX_STATES * edge_count, messages + MAX_STATES * edge_index, sizeof(float) * MAX_STATES);
+			edge_count += 1;
+		}
+
+		block->in_offsets[i] = num_in;
+		start_index = graph->dest_nodes_to_edges_node_list[node_index];
+		end_index = (node_index + 1 == num_vertices) ? num_edges : graph->dest_nodes_to_edges_node_list[node_index + 1];
+		for(j = start_index; j < end_index; ++j){
+			edge_index = graph->dest_nodes_to_edges_edge_list[j];
+			src_partition = graph->node_partitions[graph->edges_src_index[edge_index]];
+			if(src_partition == partition){
+				slot = edge_local_index[edge_index];
+			}
+			else{
+				slot = block->num_edges + ghost_count;
+				block->ghost_partitions[ghost_count] = src_partition;
+				block->ghost_edges[ghost_count] = edge_local_index[edge_index];
+				memcpy(block->messages[0] + MAX_STATES * slot, messages + MAX_STATES * edge_index, sizeof(float) * MAX_STATES);
+				ghost_count += 1;
+			}
+			block->in_slots[num_in] = slot;
+			num_in += 1;
+		}
+
+		// boundary nodes go first in the sweep order, interior nodes fill from the back
+		if(is_boundary){
+			block->node_order[block->num_boundary_nodes] = i;
+			block->num_boundary_nodes += 1;
+		}
+		else{
+			block->node_order[block->num_nodes - 1 - (i - block->num_boundary_nodes)] = i;
+		}
+	}
+	block->out_offsets[block->num_nodes] = edge_count;
+	block->in_offsets[block->num_nodes] = num_in;
+
+	memcpy(block->messages[1], block->messages[0], sizeof(float) * MAX_STATES * (block->num_edges + block->num_ghosts));
+}
+
+// the send side of the ghosts: where each boundary message of partition goes in the blocks that read it
+static void build_partition_sends(struct partition_block * blocks, unsigned int num_partitions, unsigned int partition){
+	unsigned int p, i, count;
+	struct partition_block * block;
+
+	block = &blocks[partition];
+	block->num_sends = 0;
+	for(p = 0; p < num_partitions; ++p){
+		for(i = 0; i < blocks[p].num_ghosts; ++i){
+			if(blocks[p].ghost_partitions[i] == partition){
+				block->num_sends += 1;
+			}
+		}
+	}
+
+	block->send_edges = (unsigned int *)malloc(sizeof(unsigned int) * (block->num_sends + 1));
+	assert(block->send_edges);
+	block->send_partitions = (unsigned int *)malloc(sizeof(unsigned int) * (block->num_sends + 1));
+	assert(block->send_partitions);
+	block->send_slots = (unsigned int *)malloc(sizeof(unsigned int) * (block->num_sends + 1));
+	assert(block->send_slots);
+
+	count = 0;
+	for(p = 0; p < num_partitions; ++p){
+		for(i = 0; i < blocks[p].num_ghosts; ++i){
+			if(blocks[p].ghost_partitions[i] == partition){
+				block->send_edges[count] = blocks[p].ghost_edges[i];
+				block->send_partitions[count] = p;
+				block->send_slots[count] = blocks[p].num_edges + i;
+				count += 1;
+			}
+		}
+	}
+}
+
+// Jacobi update of the nodes node_order[first, last): reads messages[1 - current], writes their edges into messages[current]
+static void propagate_partition_nodes(struct partition_block * block, unsigned int current, unsigned int first, unsigned int last){
+	unsigned int i, j, k, n, edge_index;
+	float diff;
+	float message_buffer[MAX_STATES];
+	float * previous_messages;
+	float * current_messages;
+
+	previous_messages = block->messages[1 - current];
+	current_messages = block->messages[current];
+
+	for(n = first; n < last; ++n){
+		i = block->node_order[n];
+		for(k = 0; k < block->num_vars[i]; ++k){
+			message_buffer[k] = block->node_states[MAX_STATES * i + k];
+		}
+		for(j = block->in_offsets[i]; j < block->in_offsets[i + 1]; ++j){
+			combine_message(message_buffer, previous_messages, block->num_vars[i], MAX_STATES * block->in_slots[j]);
+		}
+		for(edge_index = block->out_offsets[i]; edge_index < block->out_offsets[i + 1]; ++edge_index){
+			transfer_belief(block->joint_probabilities + MAX_STATES * MAX_STATES * edge_index, message_buffer, block->x_dim[edge_index], block->y_dim[edge_index],
+							current_messages + MAX_STATES * edge_index);
+			for(k = 0; k < block->y_dim[edge_index]; ++k){
+				diff = current_messages[MAX_STATES * edge_index + k] - previous_messages[MAX_STATES * edge_index + k];
+				if(diff != diff){
+					diff = 0.0f;
+				}
+				block->delta += fabs(diff);
+			}
+		}
+	}
+}
+
+// pushes partition's boundary messages into the ghost slots of messages[current] in the blocks that read them;
+// readers only touch those slots in the next iteration, so no lock is needed
+static void send_partition_ghosts(struct partition_block * blocks, unsigned int partition, unsigned int current){
+	unsigned int i;
+	struct partition_block * block;
+
+	block = &blocks[partition];
+	for(i = 0; i < block->num_sends; ++i){
+		memcpy(blocks[block->send_partitions[i]].messages[current] + MAX_STATES * block->send_slots[i],
+			   block->messages[current] + MAX_STATES * block->send_edges[i], sizeof(float) * MAX_STATES);
+	}
+}
+
+// one pipelined iteration of a partition: boundary nodes, post their messages, then the interior while they travel
+static void propagate_partition_block(struct partition_block * blocks, unsigned int partition, unsigned int current){
+	struct partition_block * block;
+
+	block = &blocks[partition];
+	block->delta = 0.0f;
+	propagate_partition_nodes(block, current, 0, block->num_boundary_nodes);
+	send_partition_ghosts(blocks, partition, current);
+	propagate_partition_nodes(block, current, block->num_boundary_nodes, block->num_nodes);
+}
+
+// copies the newest boundary messages of the owners into both message buffers of partition's ghost slots
+static void pull_partition_ghosts(struct partition_block * blocks, unsigned int partition){
+	unsigned int i;
+	float * message;
+	struct partition_block * block;
+	struct partition_block * owner;
+
+	block = &blocks[partition];
+	for(i = 0; i < block->num_ghosts; ++i){
+		owner = &blocks[block->ghost_partitions[i]];
+		message = owner->messages[owner->current] + MAX_STATES * block->ghost_edges[i];
+		memcpy(block->messages[0] + MAX_STATES * (block->num_edges + i), message, sizeof(float) * MAX_STATES);
+		memcpy(block->messages[1] + MAX_STATES * (block->num_edges + i), message, sizeof(float) * MAX_STATES);
+	}
+}
+
+static void destroy_partition_block(struct partition_block * block){
+	free(block->num_vars);
+	free(block->node_states);
+	free(block->out_offsets);
+	free(block->in_offsets);
+	free(block->in_slots);
+	free(block->edges);
+	free(block->x_dim);
+	free(block->y_dim);
+	free(block->joint_probabilities);
+	free(block->node_order);
+	free(block->ghost_partitions);
+	free(block->ghost_edges);
+	free(block->send_edges);
+	free(block->send_partitions);
+	free(block->send_slots);
+	free(block->messages[0]);
+	free(block->messages[1]);
+}
+
+/**
+ * Block-Jacobi loopy BP over the parts from init_partitions_to_nodes. Each part gets a private copy of its nodes, the edges
+ * it sends on, their tables and ghost copies of the boundary messages it reads, built by the thread that owns the part so
+ * the pages land on that thread's socket. Parts iterate on local data only. Each iteration a part updates its boundary nodes
+ * first, pushes their messages straight into the readers' ghost slots, then updates its interior nodes; the end of the
+ * iteration is the only wait, so copying the boundary overlaps with the interior work of the other parts.
+ * Part p always runs on thread p of a proc_bind(spread) team; set OMP_PLACES (e.g. cores or sockets) to pin it.
+ * Same convergence test as loopy_propagate_until; the result is written back to previous_edge_messages.
+ */
+unsigned int loopy_propagate_until_partitioned(Graph_t graph, float convergence, unsigned int max_iterations){
+	unsigned int i, j, p, num_partitions, current;
+	float delta, previous_delta;
+	unsigned int * edge_local_index;
+	float * messages;
+	struct partition_block * blocks;
+
+	assert(graph->partitions_to_nodes_partition_list != NULL);
+
+	num_partitions = graph->num_partitions;
+	messages = *graph->previous_edge_messages;
+
+	edge_local_index = build_edge_local_index(graph);
+
+	blocks = (struct partition_block *)malloc(sizeof(struct partition_block) * num_partitions);
+	assert(blocks);
+
+#pragma omp parallel for default(none) shared(graph, blocks, edge_local_index, num_partitions) private(p) num_threads(num_partitions) proc_bind(spread) schedule(static, 1)
+	for(p = 0; p < num_partitions; ++p){
+		build_partition_block(graph, p, edge_local_index, &blocks[p]);
+	}
+
+#pragma omp parallel for default(none) shared(blocks, num_partitions) private(p) num_threads(num_partitions) proc_bind(spread) schedule(static, 1)
+	for(p = 0; p < num_partitions; ++p){
+		build_partition_sends(blocks, num_partitions, p);
+	}
+
+	previous_delta = -1.0f;
+	delta = 0.0f;
+	current = 1;
+
+	for(i = 0; i < max_iterations; ++i){
+#pragma omp parallel for default(none) shared(blocks, num_partitions, current) private(p) num_threads(num_partitions) proc_bind(spread) schedule(static, 1)
+		for(p = 0; p < num_partitions; ++p){
+			propagate_partition_block(blocks, p, current);
+		}
+
+		delta = 0.0f;
+		for(p = 0; p < num_partitions; ++p){
+			delta += blocks[p].delta;
+		}
+		current = 1 - current;
+
+		if(delta < convergence || fabs(delta - previous_delta) < convergence){
+			break;
+		}
+		if(i < max_iterations - 1) {
+			previous_delta = delta;
+		}
+	}
+	if(i == max_iterations){
+		printf("No Convergence: previous: %f vs current: %f\n", previous_delta, delta);
+	}
+
+	// newest messages sit in messages[1 - current] of every block
+	for(p = 0; p < num_partitions; ++p){
+		for(j = 0; j < blocks[p].num_edges; ++j){
+			memcpy(messages + MAX_STATES * blocks[p].edges[j], blocks[p].messages[1 - current] + MAX_STATES * j, sizeof(float) * MAX_STATES);
+		}
+		destroy_partition_block(&blocks[p]);
+	}
+
+	free(blocks);
+	free(edge_local_index);
+
+	return i;
+}
+
+/**
+ * Block-asynchronous loopy BP for graphs far larger than the last-level cache. init_cache_blocks_to_nodes cuts the graph
+ * into L2_CACHE_SIZE blocks (replacing any partition) and each block runs LOCAL_ITERATIONS Jacobi sweeps on its private
+ * copy while it is cache resident, with its ghost messages held fixed, stopping early once a local sweep moves it less than
+ * convergence. Ghosts are refreshed from their owners between sweeps.
+ * The delta is the one of each block's first local sweep, i.e. the change since its ghosts were refreshed. Returns the
+ * number of sweeps; the result is written back to previous_edge_messages.
+ * That stopping test is looser than the global delta of loopy_propagate_until, since a block's first sweep only sees how far
+ * its ghosts moved, so at a loose convergence beliefs can differ from it by a few times convergence (about 3e-3 at 1e-3
+ * on the bf_* benchmark graphs). The gap shrinks with convergence, as it does for the colored and splash engines.
+ */
+unsigned int loopy_propagate_until_blocked(Graph_t graph, float convergence, unsigned int max_iterations){
+	unsigned int i, j, l, p, num_blocks, current;
+	float delta, previous_delta, first_delta;
+	unsigned int * edge_local_index;
+	float * messages;
+	struct partition_block * blocks;
+	struct partition_block * block;
+
+	init_cache_blocks_to_nodes(graph, L2_CACHE_SIZE);
+
+	num_blocks = graph->num_partitions;
+	messages = *graph->previous_edge_messages;
+
+	edge_local_index = build_edge_local_index(graph);
+
+	blocks = (struct partition_block *)malloc(sizeof(struct partition_block) * num_blocks);
+	assert(blocks);
+
+#pragma omp parallel for default(none) shared(graph, blocks, edge_local_index, num_blocks) private(p) schedule(static)
+	for(p = 0; p < num_blocks; ++p){
+		build_partition_block(graph, p, edge_local_index, &blocks[p]);
+		blocks[p].current = 0;
+		blocks[p].send_edges = NULL;
+		blocks[p].send_partitions = NULL;
+		blocks[p].send_slots = NULL;
+	}
+
+	previous_delta = -1.0f;
+	delta = 0.0f;
+
+	for(i = 0; i < max_iterations; ++i){
+		if(i > 0){
+#pragma omp parallel for default(none) shared(blocks, num_blocks) private(p) schedule(static)
+			for(p = 0; p < num_blocks; ++p){
+				pull_partition_ghosts(blocks, p);
+			}
+		}
+
+#pragma omp parallel for default(none) shared(blocks, num_blocks, convergence) private(p, l, block, current, first_delta) schedule(dynamic, 1)
+		for(p = 0; p < num_blocks; ++p){
+			block = &blocks[p];
+			first_delta = 0.0f;
+			for(l = 0; l < LOCAL_ITERATIONS; ++l){
+				current = 1 - block->current;
+				block->delta = 0.0f;
+				propagate_partition_nodes(block, current, 0, block->num_nodes);
+				block->current = current;
+				if(l == 0){
+					first_delta = block->delta;
+				}
+				// settled against its current ghosts; more local sweeps would not move it
+				if(block->delta < convergence){
+					break;
+				}
+			}
+			block->delta = first_delta;
+		}
+
+		delta = 0.0f;
+		for(p = 0; p < num_blocks; ++p){
+			delta += blocks[p].delta;
+		}
+
+		if(delta < convergence || fabs(delta - previous_delta) < convergence){
+			break;
+		}
+		if(i < max_iterations - 1) {
+			previous_delta = delta;
+		}
+	}
+	if(i == max_iterations){
+		printf("No Convergence: previous: %f vs current: %f\n", previous_delta, delta);
+	}
+
+	for(p = 0; p < num_blocks; ++p){
+		for(j = 0; j < blocks[p].num_edges; ++j){
+			memcpy(messages + MAX_STATES * blocks[p].edges[j], blocks[p].messages[blocks[p].current] + MAX_STATES * j, sizeof(float) * MAX_STATES);
+		}
+		destroy_partition_block(&blocks[p]);
+	}
+
+	free(blocks);
+	free(edge_local_index);
+
+	return i;
+}
+
+/**
+ * A graph is a forest when its undirected edges, each pair of opposite edges counted once, number V minus its components.
+ * Labels components as a side effect.
+ */
+char graph_is_forest(Graph_t graph){
+	unsigned int i, num_edges, num_undirected_edges;
+	unsigned int * reverse_edges;
+
+	num_edges = graph->current_num_edges;
+	reverse_edges = build_reverse_edges(graph);
+
+	num_undirected_edges = 0;
+	for(i = 0; i < num_edges; ++i){
+		if(reverse_edges[i] == num_edges || i < reverse_edges[i]){
+			num_undirected_edges += 1;
+		}
+	}
+	free(reverse_edges);
+
+	init_components_to_nodes(graph);
+
+	return (char)(num_undirected_edges + graph->num_components == graph->current_num_vertices);
+}
+
+/**
+ * Inference entry point: forests get the exact two-pass task schedule, anything with a cycle falls back to loopy BP.
+ * Either way the messages end up in previous_edge_messages and node_states keep the priors, so marginalize_loopy_nodes
+ * reads the beliefs for both engines. engine is set to "tree" or "loopy"; returns the number of passes or iterations.
+ */
+unsigned int propagate_until(Graph_t graph, float convergence, unsigned int max_iterations, const char ** engine){
+	float * priors;
+
+	if(graph_is_forest(graph)){
+		*engine = "tree";
+
+		//the task schedule marginalizes into node_states
+		priors = (float *)malloc(sizeof(float) * MAX_STATES * graph->current_num_vertices);
+		assert(priors);
+		memcpy(priors, graph->node_states, sizeof(float) * MAX_STATES * graph->current_num_vertices);
+
+		propagate_using_tasks(graph);
+
+		memcpy(graph->node_states, priors, sizeof(float) * MAX_STATES * graph->current_num_vertices);
+		if(*graph->previous_edge_messages != graph->edges_messages){
+			memcpy(*graph->previous_edge_messages, graph->edges_messages, sizeof(float) * MAX_STATES * graph->current_num_edges);
+		}
+
+		free(priors);
+		return 2;
+	}
+
+	*engine = "loopy";
+	init_previous_edge(graph);
+	return loopy_propagate_until(graph, convergence, max_iterations);
+}
+
+// rewrites a node's edge list in the lookup table after edges were renumbered; dropped edges map to num_edges
+static void remap_edge_table_entry(struct hsearch_data * table, char * key, unsigned int node_index, unsigned int * edge_map, unsigned int num_edges){
+	unsigned int i, count;
+	ENTRY e, *ep;
+	struct htable_entry * entry;
+
+	sprintf(key, "%d", node_index);
+	e.key = key;
+	e.data = NULL;
+	hsearch_r(e, FIND, &ep, table);
+	if(ep == NULL || ep->data == NULL){
+		return;
+	}
+	entry = (struct htable_entry *)ep->data;
+	count = 0;
+	for(i = 0; i < entry->count; ++i){
+		if(edge_map[entry->indices[i]] < num_edges){
+			entry->indices[count] = edge_map[entry->indices[i]];
+			count += 1;
+		}
+	}
+	entry->count = count;
+}
+
+// folds the messages from an unobserved node's observed neighbours into its state and renormalizes it
+static void absorb_observed_messages(Graph_t graph, unsigned int node_index){
+	unsigned int j, k, start_index, end_index, edge_index, src_index, num_variables;
+	float sum;
+
+	if(graph->observed_nodes[node_index]){
+		return;
+	}
+	num_variables = graph->node_num_vars[node_index];
+	start_index = graph->dest_nodes_to_edges_node_list[node_index];
+	if(node_index + 1 == graph->current_num_vertices){
+		end_index = graph->current_num_edges;
+	}
+	else{
+		end_index = graph->dest_nodes_to_edges_node_list[node_index + 1];
+	}
+	for(j = start_index; j < end_index; ++j){
+		edge_index = graph->dest_nodes_to_edges_edge_list[j];
+		src_index = graph->edges_src_index[edge_index];
+		if(graph->observed_nodes[src_index]){
+			send_message(graph->node_states, MAX_STATES * src_index, edge_index, graph->edges_joint_probabilities, graph->edges_messages, graph->edges_x_dim, graph->edges_y_dim);
+			combine_message(graph->node_states + MAX_STATES * node_index, graph->edges_messages, num_variables, MAX_STATES * edge_index);
+		}
+	}
+	sum = 0.0f;
+	for(k = 0; k < num_variables; ++k){
+		sum += graph->node_states[MAX_STATES * node_index + k];
+	}
+	if(sum <= 0.0f){
+		sum = 1.0f;
+	}
+	for(k = 0; k < num_variables; ++k){
+		graph->node_states[MAX_STATES * node_index + k] /= sum;
+	}
+}
+
+/**
+ * Folds the message out of every observed node into its unobserved neighbours' states once, then removes every edge touching
+ * an observed node and rebuilds the src/dest lists. Observed nodes keep their evidence as their marginal.
+ * Call after the src/dest lists are set up and before init_previous_edge; the junction tree reads factors, not edges, so build it first.
+ */
+void absorb_evidence(Graph_t graph){
+	unsigned int i, h, t, thread, num_threads, num_vertices, num_edges, new_num_edges;
+	unsigned int * edge_map;
+	char * observed;
+
+	num_vertices = graph->current_num_vertices;
+	num_edges = graph->current_num_edges;
+	observed = graph->observed_nodes;
+
+	if(graph->work_ranges == NULL){
+		init_work_ranges(graph, work_ranges_default());
+	}
+
+#pragma omp parallel default(none) shared(graph) private(i, h, t, thread, num_threads) num_threads(graph->num_work_ranges)
+	{
+		thread = 0;
+		num_threads = 1;
+#ifdef _OPENMP
+		thread = omp_get_thread_num();
+		num_threads = omp_get_num_threads();
+#endif
+		for(t = thread; t < graph->num_work_ranges; t += num_threads){
+			for(i = graph->work_ranges[t]; i < graph->work_ranges[t + 1]; ++i){
+				if(!graph->node_is_work_hub[i]){
+					absorb_observed_messages(graph, i);
+				}
+			}
+		}
+#pragma omp for schedule(dynamic, 1)
+		for(h = 0; h < graph->num_work_hubs; ++h){
+			absorb_observed_messages(graph, graph->work_hubs[h]);
+		}
+	}
+
+	// compact the surviving edges in order
+	edge_map = (unsigned int *)malloc(sizeof(unsigned int) * num_edges);
+	assert(edge_map);
+	new_num_edges = 0;
+	for(i = 0; i < num_edges; ++i){
+		if(observed[graph->edges_src_index[i]] || observed[graph->edges_dest_index[i]]){
+			edge_map[i] = num_edges;
+			continue;
+		}
+		edge_map[i] = new_num_edges;
+		if(new_num_edges != i){
+			graph->edges_src_index[new_num_edges] = graph->edges_src_index[i];
+			graph->edges_dest_index[new_num_edges] = graph->edges_dest_index[i];
+			graph->edges_x_dim[new_num_edges] = graph->edges_x_dim[i];
+			graph->edges_y_dim[new_num_edges] = graph->edges_y_dim[i];
+			memcpy(graph->edges_joint_probabilities + MAX_STATES * MAX_STATES * new_num_edges, graph->edges_joint_probabilities + MAX_STATES * MAX_STATES * i,
+				   sizeof(float) * MAX_STATES * MAX_STATES);
+			memcpy(graph->edges_messages + MAX_STATES * new_num_edges, graph->edges_messages + MAX_STATES * i, sizeof(float) * MAX_STATES);
+			memcpy(graph->last_edges_messages + MAX_STATES * new_num_edges, graph->last_edges_messages + MAX_STATES * i, sizeof(float) * MAX_STATES);
+		}
+		new_num_edges += 1;
+	}
+
+	graph->current_num_edges = new_num_edges;
+	if(graph->edge_tables_created != 0){
+		for(i = 0; i < num_vertices; ++i){
+			remap_edge_table_entry(graph->src_node_to_edge_table, src_key, i, edge_map, num_edges);
+			remap_edge_table_entry(graph->dest_node_to_edge_table, dest_key, i, edge_map, num_edges);
+		}
+		graph->max_degree = 0;
+		set_up_src_nodes_to_edges(graph);
+		set_up_dest_nodes_to_edges(graph);
+	}
+	//the degrees changed, so the ranges used above no longer balance the engines
+	init_work_ranges(graph, graph->num_work_ranges);
+
+	free(edge_map);
+}
+
+// only hard evidence blocks a path; priors and soft evidence are likelihoods that leave it open
+static char node_is_instantiated(Graph_t graph, unsigned int node_index){
+	unsigned int i, num_nonzero;
+
+	if(graph->observed_nodes[node_index] == 0){
+		return 0;
+	}
+	num_nonzero = 0;
+	for(i = 0; i < graph->node_num_vars[node_index]; ++i){
+		if(graph->node_states[MAX_STATES * node_index + i] != 0.0f){
+			num_nonzero += 1;
+		}
+	}
+	return (char)(num_nonzero == 1);
+}
+
+static inline void keep_query_node(char * kept, unsigned int * stack, unsigned int * stack_size, unsigned int node_index){
+	if(kept[node_index] == 0){
+		kept[node_index] = 1;
+		stack[*stack_size] = node_index;
+		*stack_size += 1;
+	}
+}
+
+/**
+ * Builds the subgraph that answers P(targets | observed nodes), using the DAG the parsers keep with the factors.
+ * Barren nodes (not ancestors of a target or of an observed node) are dropped, then every node separated from the targets by
+ * hard evidence in the moralised ancestral graph; the loaders mark root priors as observed, so soft states never block. Nodes keep their relative order; node_map, if not NULL, receives each node's new index,
+ * or current_num_vertices if it was pruned. Nodes without a factor count as roots. The returned graph has its src/dest lists set up.
+ */
+Graph_t prune_graph_for_query(Graph_t graph, unsigned int * targets, unsigned int num_targets, unsigned int * node_map){
+	unsigned int i, j, k, num_vertices, num_edges, num_kept, num_kept_edges, stack_size, node_index, child_index, num_parents;
+	unsigned int * children_list;
+	unsigned int * children;
+	unsigned int * positions;
+	unsigned int * stack;
+	unsigned int * new_indices;
+	unsigned int parents[MAX_DEGREE];
+	char * ancestral;
+	char * kept;
+	char * observed;
+	Graph_t pruned;
+
+	num_vertices = graph->current_num_vertices;
+	num_edges = graph->current_num_edges;
+	observed = graph->observed_nodes;
+
+	// children of each node from the factor scopes
+	children_list = (unsigned int *)calloc(sizeof(unsigned int), (size_t)num_vertices + 1);
+	assert(children_list);
+	positions = (unsigned int *)malloc(sizeof(unsigned int) * num_vertices);
+	assert(positions);
+	for(i = 0; i < num_vertices; ++i){
+		if(graph->node_factors[i] != NULL){
+			for(j = 0; j < graph->node_num_parents[i]; ++j){
+				children_list[graph->node_parents[MAX_DEGREE * i + j] + 1] += 1;
+			}
+		}
+	}
+	for(i = 0; i < num_vertices; ++i){
+		children_list[i + 1] += children_list[i];
+		positions[i] = children_list[i];
+	}
+	children = (unsigned int *)malloc(sizeof(unsigned int) * (children_list[num_vertices] + 1));
+	assert(children);
+	for(i = 0; i < num_vertices; ++i){
+		if(graph->node_factors[i] != NULL){
+			for(j = 0; j < graph->node_num_parents[i]; ++j){
+				node_index = graph->node_parents[MAX_DEGREE * i + j];
+				children[positions[node_index]] = i;
+				positions[node_index] += 1;
+			}
+		}
+	}
+
+	stack = (unsigned int *)malloc(sizeof(unsigned int) * num_vertices);
+	assert(stack);
+	ancestral = (char *)calloc(sizeof(char), (size_t)num_vertices);
+	assert(ancestral);
+	kept = (char *)calloc(sizeof(char), (size_t)num_vertices);
+	assert(kept);
+
+	// ancestors of the targets and the evidence; everything else is barren
+	stack_size = 0;
+	for(i = 0; i < num_targets; ++i){
+		assert(targets[i] < num_vertices);
+		keep_query_node(ancestral, stack, &stack_size, targets[i]);
+	}
+	for(i = 0; i < num_vertices; ++i){
+		if(observed[i]){
+			keep_query_node(ancestral, stack, &stack_size, i);
+		}
+	}
+	while(stack_size > 0){
+		stack_size -= 1;
+		node_index = stack[stack_size];
+		if(graph->node_factors[node_index] != NULL){
+			for(j = 0; j < graph->node_num_parents[node_index]; ++j){
+				keep_query_node(ancestral, stack, &stack_size, graph->node_parents[MAX_DEGREE * node_index + j]);
+			}
+		}
+	}
+
+	// reachable from the targets in the moral ancestral graph without passing through hard evidence
+	for(i = 0; i < num_targets; ++i){
+		keep_query_node(kept, stack, &stack_size, targets[i]);
+	}
+	while(stack_size > 0){
+		stack_size -= 1;
+		node_index = stack[stack_size];
+		if(node_is_instantiated(graph, node_index)){
+			continue;
+		}
+		if(graph->node_factors[node_index] != NULL){
+			for(j = 0; j < graph->node_num_parents[node_index]; ++j){
+				keep_query_node(kept, stack, &stack_size, graph->node_parents[MAX_DEGREE * node_index + j]);
+			}
+		}
+		for(j = children_list[node_index]; j < children_list[node_index + 1]; ++j){
+			child_index = children[j];
+			if(ancestral[child_index] == 0){
+				continue;
+			}
+			keep_query_node(kept, stack, &stack_size, child_index);
+			for(k = 0; k < graph->node_num_parents[child_index]; ++k){
+				keep_query_node(kept, stack, &stack_size, graph->node_parents[MAX_DEGREE * child_index + k]);
+			}
+		}
+	}
+
+	new_indices = positions;
+	num_kept = 0;
+	for(i = 0; i < num_vertices; ++i){
+		if(kept[i]){
+			new_indices[i] = num_kept;
+			num_kept += 1;
+		}
+		else{
+			new_indices[i] = num_vertices;
+		}
+		if(node_map != NULL){
+			node_map[i] = new_indices[i];
+		}
+	}
+	num_kept_edges = 0;
+	for(i = 0; i < num_edges; ++i){
+		if(kept[graph->edges_src_index[i]] && kept[graph->edges_dest_index[i]]){
+			num_kept_edges += 1;
+		}
+	}
+
+	pruned = create_graph(num_kept, num_kept_edges > 0 ? num_kept_edges : 1);
+	memcpy(pruned->graph_name, graph->graph_name, sizeof(char) * CHAR_BUFFER_SIZE);
+	for(i = 0; i < num_vertices; ++i){
+		if(kept[i] == 0){
+			continue;
+		}
+		node_index = new_indices[i];
+		graph_add_node(pruned, graph->node_num_vars[i], &graph->node_names[CHAR_BUFFER_SIZE * i]);
+		node_set_state(pruned, node_index, graph->node_num_vars[i], &graph->node_states[MAX_STATES * i]);
+		pruned->observed_nodes[node_index] = observed[i];
+		memcpy(&pruned->variable_names[CHAR_BUFFER_SIZE * MAX_STATES * node_index], &graph->variable_names[CHAR_BUFFER_SIZE * MAX_STATES * i],
+			   sizeof(char) * CHAR_BUFFER_SIZE * MAX_STATES);
+	}
+	// factors come along only with their whole scope; evidence reached from a child loses its own parents
+	for(i = 0; i < num_vertices; ++i){
+		if(kept[i] == 0 || graph->node_factors[i] == NULL){
+			continue;
+		}
+		num_parents = graph->node_num_parents[i];
+		for(j = 0; j < num_parents; ++j){
+			parents[j] = new_indices[graph->node_parents[MAX_DEGREE * i + j]];
+			if(parents[j] == num_vertices){
+				break;
+			}
+		}
+		if(j == num_parents){
+			graph_set_node_factor(pruned, new_indices[i], parents, num_parents, graph->node_factors[i]);
+		}
+	}
+	for(i = 0; i < num_edges; ++i){
+		if(kept[graph->edges_src_index[i]] && kept[graph->edges_dest_index[i]]){
+			graph_add_edge(pruned, new_indices[graph->edges_src_index[i]], new_indices[graph->edges_dest_index[i]], graph->edges_x_dim[i], graph->edges_y_dim[i],
+						   &graph->edges_joint_probabilities[MAX_STATES * MAX_STATES * i]);
+		}
+	}
+
+	if(pruned->edge_tables_created != 0){
+		set_up_src_nodes_to_edges(pruned);
+		set_up_dest_nodes_to_edges(pruned);
+	}
+	else{
+		memset(pruned->src_nodes_to_edges_node_list, 0, sizeof(unsigned int) * num_kept);
+		memset(pruned->dest_nodes_to_edges_node_list, 0, sizeof(unsigned int) * num_kept);
+	}
+
+	free(children_list);
+	free(children);
+	free(positions);
+	free(stack);
+	free(ancestral);
+	free(kept);
+
+	return pruned;
 }
 
-unsigned int loopy_progagate_until_edge_acc(Graph_t graph, float convergence, unsigned int max_iterations){
-    unsigned int iter;
+/**
+ * Holds batch_size evidence scenarios for one model; every node state and message slot is a vector of batch_size lanes,
+ * laid out [index][state][query] so the query lanes are contiguous. Each lane starts from the graph's own node_states.
+ */
+EvidenceBatch_t create_evidence_batch(Graph_t graph, unsigned int batch_size){
+	unsigned int i, j, q, num_vertices, num_edges;
+	EvidenceBatch_t batch;
 
-    /*printf("===BEFORE====\n");
-    print_nodes(graph);
-    print_edges(graph);
-*/
-    iter = loopy_propagate_iterations_edges_acc(graph->current_num_vertices, graph->current_num_edges,
-    graph->node_states, graph->node_num_vars,
-    graph->previous_edge_messages, graph->current_edge_messages,
-    graph->edges_joint_probabilities,
-    graph->edges_src_index, graph->edges_dest_index,
-    graph->edges_x_dim, graph->edges_y_dim,
-    max_iterations, convergence);
+	assert(batch_size > 0);
 
-    /*printf("===AFTER====\n");
-    print_nodes(graph);
-    print_edges(graph);*/
+	num_vertices = graph->current_num_vertices;
+	num_edges = graph->current_num_edges;
 
-    return iter;
+	batch = (EvidenceBatch_t)malloc(sizeof(struct evidence_batch));
+	assert(batch);
+	batch->batch_size = batch_size;
+	batch->node_states = (float *)malloc(sizeof(float) * MAX_STATES * batch_size * num_vertices);
+	assert(batch->node_states);
+	batch->edges_messages = (float *)malloc(sizeof(float) * MAX_STATES * batch_size * num_edges);
+	assert(batch->edges_messages);
+	batch->last_edges_messages = (float *)malloc(sizeof(float) * MAX_STATES * batch_size * num_edges);
+	assert(batch->last_edges_messages);
+	batch->num_iterations = (unsigned int *)calloc(sizeof(unsigned int), batch_size);
+	assert(batch->num_iterations);
+
+	for(i = 0; i < num_vertices; ++i){
+		for(j = 0; j < graph->node_num_vars[i]; ++j){
+			for(q = 0; q < batch_size; ++q){
+				batch->node_states[(MAX_STATES * i + j) * batch_size + q] = graph->node_states[MAX_STATES * i + j];
+			}
+		}
+	}
+
+	return batch;
 }
 
-void calculate_diameter(Graph_t graph){
-    // calculate diameter using floyd-warshall
-    int ** dist;
-	int ** g;
-    unsigned int i, j, k, start_index, end_index;
-	int curr_dist;
+void evidence_batch_set_node_state(Graph_t graph, EvidenceBatch_t batch, unsigned int query, unsigned int node_index, float * state){
+	unsigned int i;
 
-	dist = (int **)malloc(sizeof(int *) * graph->current_num_vertices);
-	assert(dist);
-	g = (int **)malloc(sizeof(int *) * graph->current_num_vertices);
-	assert(g);
-	for(i = 0; i < graph->current_num_vertices; ++i){
-		dist[i] = (int *)malloc(sizeof(int) * graph->current_num_vertices);
-		assert(dist[i]);
-		g[i] = (int *)malloc(sizeof(int) * graph->current_num_vertices);
-		assert(g[i]);
+	assert(query < batch->batch_size);
+	assert(node_index < graph->current_num_vertices);
+
+	for(i = 0; i < graph->node_num_vars[node_index]; ++i){
+		batch->node_states[(MAX_STATES * node_index + i) * batch->batch_size + query] = state[i];
 	}
+}
 
-	// fill in g based on edges
-	for(i = 0; i < graph->current_num_vertices; ++i){
-		for(j = 0; j < graph->current_num_vertices; ++j){
-			g[i][j] = WEIGHT_INFINITY;
+// next "query,node name,state index" line; skips blank lines and a header on the first line. 1 = read, 0 = end of file, -1 = malformed
+static int read_evidence_line(FILE * in, unsigned int * line_number, unsigned int * query, char * node_name, unsigned int * state_index){
+	char line[4 * CHAR_BUFFER_SIZE];
+	char blank;
+
+	while(fgets(line, sizeof(line), in) != NULL){
+		*line_number += 1;
+		if(sscanf(line, " %c", &blank) != 1){
+			continue;
 		}
+		if(sscanf(line, " %u ,%49[^,] ,%u", query, node_name, state_index) == 3){
+			return 1;
+		}
+		if(*line_number == 1){
+			continue;
+		}
+		return -1;
 	}
-	for(i = 0; i < graph->current_num_vertices; ++i){
-		 start_index = graph->src_nodes_to_edges_node_list[i];
-		if(i + 1 == graph->current_num_vertices){
-			end_index = graph->current_num_edges;
+	return 0;
+}
+
+/**
+ * Reads hard evidence from a CSV file with one "query,node name,state index" line per observation; the batch holds as many
+ * queries as the largest query index plus one. Nodes a query does not mention keep the graph's states. A first line that is
+ * not an observation is taken as a header. Returns NULL, after printing the line number, on a malformed line or an
+ * out-of-range state index, and when the file holds no observations.
+ */
+EvidenceBatch_t load_evidence_batch(Graph_t graph, const char * file_name){
+	unsigned int query, state_index, node_index, batch_size, line_number;
+	int status;
+	char node_name[CHAR_BUFFER_SIZE];
+	float state[MAX_STATES];
+	FILE * in;
+	EvidenceBatch_t batch;
+
+	in = fopen(file_name, "r");
+	assert(in);
+
+	batch_size = 0;
+	line_number = 0;
+	while((status = read_evidence_line(in, &line_number, &query, node_name, &state_index)) == 1){
+		node_index = find_node_by_name(node_name, graph);
+		if(state_index >= graph->node_num_vars[node_index]){
+			printf("%s:%u: state index %u out of range for node %s\n", file_name, line_number, state_index, node_name);
+			fclose(in);
+			return NULL;
 		}
-		else{
-			end_index = graph->src_nodes_to_edges_node_list[i+1];
+		if(query + 1 > batch_size){
+			batch_size = query + 1;
 		}
-		for(j = start_index; j < end_index; ++j){
-			k = graph->src_nodes_to_edges_edge_list[j];
-			g[i][graph->edges_dest_index[k]] = 1;
+	}
+	if(status < 0){
+		printf("%s:%u: expected \"query,node name,state index\"\n", file_name, line_number);
+		fclose(in);
+		return NULL;
+	}
+	if(batch_size == 0){
+		printf("%s: no observations\n", file_name);
+		fclose(in);
+		return NULL;
+	}
+
+	batch = create_evidence_batch(graph, batch_size);
+
+	rewind(in);
+	line_number = 0;
+	while(read_evidence_line(in, &line_number, &query, node_name, &state_index) == 1){
+		node_index = find_node_by_name(node_name, graph);
+
+		memset(state, 0, sizeof(float) * MAX_STATES);
+		state[state_index] = 1.0f;
+		evidence_batch_set_node_state(graph, batch, query, node_index, state);
+	}
+
+	fclose(in);
+
+	return batch;
+}
+
+void evidence_batch_destroy(EvidenceBatch_t batch){
+	free(batch->node_states);
+	free(batch->edges_messages);
+	free(batch->last_edges_messages);
+	free(batch->num_iterations);
+	free(batch);
+}
+
+// message lanes = joint^T * belief lanes; each table entry is read once for the whole batch
+static void send_batched_message(float * joint, float * belief, unsigned int num_src, unsigned int num_dest, unsigned int batch_size,
+								 float * message, float * sum){
+	unsigned int i, j, q;
+	float entry;
+
+	for(q = 0; q < batch_size; ++q){
+		sum[q] = 0.0f;
+	}
+	for(i = 0; i < num_dest; ++i){
+		for(q = 0; q < batch_size; ++q){
+			message[i * batch_size + q] = 0.0f;
 		}
+		for(j = 0; j < num_src; ++j){
+			entry = joint[MAX_STATES * j + i];
+#pragma omp simd
+			for(q = 0; q < batch_size; ++q){
+				message[i * batch_size + q] += entry * belief[j * batch_size + q];
+			}
+		}
+#pragma omp simd
+		for(q = 0; q < batch_size; ++q){
+			sum[q] += message[i * batch_size + q];
+		}
+	}
+	for(q = 0; q < batch_size; ++q){
+		if(sum[q] <= 0.0f){
+			sum[q] = 1.0f;
+		}
+	}
+	for(i = 0; i < num_dest; ++i){
+#pragma omp simd
+		for(q = 0; q < batch_size; ++q){
+			message[i * batch_size + q] /= sum[q];
+		}
+	}
+}
+
+static inline void combine_batched_message(float * belief, float * message, unsigned int num_variables, unsigned int batch_size){
+	unsigned int i;
+
+#pragma omp simd
+	for(i = 0; i < num_variables * batch_size; ++i){
+		belief[i] *= message[i];
 	}
+}
 
-	for(i = 0; i < graph->current_num_vertices; ++i){
-		for(j = 0; j < graph->current_num_vertices; ++j){
-			dist[i][j] = g[i][j];
+// belief lanes of a node: its states times every incoming message
+static void read_incoming_batched_messages(Graph_t graph, EvidenceBatch_t batch, float * messages, unsigned int node_index, float * belief){
+	unsigned int i, start_index, end_index, num_variables, batch_size;
+
+	batch_size = batch->batch_size;
+	num_variables = graph->node_num_vars[node_index];
+
+	memcpy(belief, &batch->node_states[MAX_STATES * batch_size * node_index], sizeof(float) * num_variables * batch_size);
+
+	start_index = graph->dest_nodes_to_edges_node_list[node_index];
+	if(node_index + 1 == graph->current_num_vertices){
+		end_index = graph->current_num_edges;
+	}
+	else{
+		end_index = graph->dest_nodes_to_edges_node_list[node_index + 1];
+	}
+	for(i = start_index; i < end_index; ++i){
+		combine_batched_message(belief, &messages[MAX_STATES * batch_size * graph->dest_nodes_to_edges_edge_list[i]], num_variables, batch_size);
+	}
+}
+
+/**
+ * Batched counterpart of init_previous_edge: seeds every lane's messages from that query's node states.
+ */
+void init_previous_edge_batched(Graph_t graph, EvidenceBatch_t batch){
+	unsigned int i, batch_size, src_index;
+	float * sum;
+
+	batch_size = batch->batch_size;
+
+#pragma omp parallel default(none) shared(graph, batch, batch_size) private(i, src_index, sum)
+	{
+		sum = (float *)malloc(sizeof(float) * batch_size);
+		assert(sum);
+
+#pragma omp for
+		for(i = 0; i < graph->current_num_edges; ++i){
+			src_index = graph->edges_src_index[i];
+			send_batched_message(&graph->edges_joint_probabilities[MAX_STATES * MAX_STATES * i], &batch->node_states[MAX_STATES * batch_size * src_index],
+								 graph->edges_x_dim[i], graph->edges_y_dim[i], batch_size, &batch->last_edges_messages[MAX_STATES * batch_size * i], sum);
 		}
+
+		free(sum);
 	}
+	memcpy(batch->edges_messages, batch->last_edges_messages, sizeof(float) * MAX_STATES * batch_size * graph->current_num_edges);
+}
 
-	for(k = 0; k < graph->current_num_vertices; ++k){
-		#pragma omp parallel for shared(dist, graph) private(curr_dist, i, j)
-		for(i = 0; i < graph->current_num_vertices; ++i){
-			for(j = 0; j < graph->current_num_vertices; ++j){
-				curr_dist = dist[i][k] + dist[k][j];
-				if(curr_dist < dist[i][j]){
-					dist[i][j] = curr_dist;
+// one node's sends for every lane; frozen queries copy their previous lanes, the others add how far they moved to thread_delta
+static void send_batched_messages_for_node(Graph_t graph, EvidenceBatch_t batch, float * previous_messages, float * current_messages, char * active,
+										   unsigned int node_index, float * belief, float * sum, float * thread_delta){
+	unsigned int j, k, m, q, edge_index, start_index, end_index, batch_size;
+	float diff;
+
+	batch_size = batch->batch_size;
+	read_incoming_batched_messages(graph, batch, previous_messages, node_index, belief);
+
+	start_index = graph->src_nodes_to_edges_node_list[node_index];
+	if(node_index + 1 == graph->current_num_vertices){
+		end_index = graph->current_num_edges;
+	}
+	else{
+		end_index = graph->src_nodes_to_edges_node_list[node_index + 1];
+	}
+	for(j = start_index; j < end_index; ++j){
+		edge_index = graph->src_nodes_to_edges_edge_list[j];
+		m = MAX_STATES * batch_size * edge_index;
+		send_batched_message(&graph->edges_joint_probabilities[MAX_STATES * MAX_STATES * edge_index], belief,
+							 graph->edges_x_dim[edge_index], graph->edges_y_dim[edge_index], batch_size, &current_messages[m], sum);
+
+		for(k = 0; k < graph->edges_y_dim[edge_index]; ++k){
+			for(q = 0; q < batch_size; ++q){
+				if(!active[q]){
+					current_messages[m + k * batch_size + q] = previous_messages[m + k * batch_size + q];
+					continue;
+				}
+				diff = current_messages[m + k * batch_size + q] - previous_messages[m + k * batch_size + q];
+				if(diff != diff){
+					diff = 0.0f;
 				}
+				thread_delta[q] += fabs(diff);
 			}
 		}
 	}
+}
 
-	graph->diameter = -1;
+/**
+ * Synchronous loopy BP over every query of the batch at once, following loopy_propagate_until; a query whose delta meets the
+ * same test is frozen and its lanes keep their messages from then on. batch->num_iterations gets each query's count;
+ * returns the largest. The converged messages end up in batch->last_edges_messages.
+ * Nodes are split by the ranges of init_work_ranges; hubs are handed out whole, one at a time, since a per-thread partial
+ * product would need batch_size lanes per hub.
+ */
+unsigned int loopy_propagate_until_batched(Graph_t graph, EvidenceBatch_t batch, float convergence, unsigned int max_iterations){
+	unsigned int i, h, t, q, node_index, thread, num_threads, batch_size, num_active, max_query_iterations;
+	float * previous_messages;
+	float * current_messages;
+	float * temp;
+	float * belief;
+	float * sum;
+	float * thread_delta;
+	float * delta;
+	float * previous_delta;
+	char * active;
+
+	if(graph->work_ranges == NULL){
+		init_work_ranges(graph, work_ranges_default());
+	}
 
-	for(i = 0; i < graph->current_num_vertices; ++i){
-		for(j = 0; j < graph->current_num_vertices; ++j){
-			if(dist[i][j] != WEIGHT_INFINITY && dist[i][j] > graph->diameter){
-				graph->diameter = dist[i][j];
+	batch_size = batch->batch_size;
+	previous_messages = batch->last_edges_messages;
+	current_messages = batch->edges_messages;
+
+	delta = (float *)malloc(sizeof(float) * batch_size);
+	assert(delta);
+	previous_delta = (float *)malloc(sizeof(float) * batch_size);
+	assert(previous_delta);
+	active = (char *)malloc(sizeof(char) * batch_size);
+	assert(active);
+
+	for(q = 0; q < batch_size; ++q){
+		previous_delta[q] = -1.0f;
+		active[q] = 1;
+		batch->num_iterations[q] = max_iterations;
+	}
+	num_active = batch_size;
+
+	for(i = 0; i < max_iterations && num_active > 0; ++i){
+		memset(delta, 0, sizeof(float) * batch_size);
+
+#pragma omp parallel default(none) shared(graph, batch, batch_size, previous_messages, current_messages, active, delta) private(h, t, q, node_index, thread, num_threads, belief, sum, thread_delta) num_threads(graph->num_work_ranges)
+		{
+			thread = 0;
+			num_threads = 1;
+#ifdef _OPENMP
+			thread = omp_get_thread_num();
+			num_threads = omp_get_num_threads();
+#endif
+			belief = (float *)malloc(sizeof(float) * MAX_STATES * batch_size);
+			assert(belief);
+			sum = (float *)malloc(sizeof(float) * batch_size);
+			assert(sum);
+			thread_delta = (float *)calloc(sizeof(float), batch_size);
+			assert(thread_delta);
+
+			for(t = thread; t < graph->num_work_ranges; t += num_threads){
+				for(node_index = graph->work_ranges[t]; node_index < graph->work_ranges[t + 1]; ++node_index){
+					if(graph->node_is_work_hub[node_index]){
+						continue;
+					}
+					send_batched_messages_for_node(graph, batch, previous_messages, current_messages, active, node_index, belief, sum, thread_delta);
+				}
+			}
+#pragma omp for schedule(dynamic, 1)
+			for(h = 0; h < graph->num_work_hubs; ++h){
+				send_batched_messages_for_node(graph, batch, previous_messages, current_messages, active, graph->work_hubs[h], belief, sum, thread_delta);
+			}
+
+#pragma omp critical
+			for(q = 0; q < batch_size; ++q){
+				delta[q] += thread_delta[q];
 			}
+
+			free(belief);
+			free(sum);
+			free(thread_delta);
 		}
-		free(g[i]);
-		free(dist[i]);
+
+		for(q = 0; q < batch_size; ++q){
+			if(active[q] && (delta[q] < convergence || fabs(delta[q] - previous_delta[q]) < convergence)){
+				active[q] = 0;
+				batch->num_iterations[q] = i;
+				num_active -= 1;
+			}
+			previous_delta[q] = delta[q];
+		}
+
+		temp = previous_messages;
+		previous_messages = current_messages;
+		current_messages = temp;
 	}
-	free(g);
-	free(dist);
+	if(num_active > 0){
+		printf("No Convergence: %d queries still active\n", num_active);
+	}
+
+	batch->last_edges_messages = previous_messages;
+	batch->edges_messages = current_messages;
+
+	max_query_iterations = 0;
+	for(q = 0; q < batch_size; ++q){
+		if(batch->num_iterations[q] > max_query_iterations){
+			max_query_iterations = batch->num_iterations[q];
+		}
+	}
+
+	free(delta);
+	free(previous_delta);
+	free(active);
+
+	return max_query_iterations;
+}
+
+/**
+ * marginalize_loopy_nodes for one query of a batch: beliefs[MAX_STATES * k] receives the normalized belief of nodes[k].
+ */
+void marginalize_batched_nodes(Graph_t graph, EvidenceBatch_t batch, unsigned int query, unsigned int * nodes, unsigned int num_nodes, float * beliefs){
+	unsigned int i, j, num_variables;
+	float total;
+	float * belief;
+
+	assert(query < batch->batch_size);
+
+	belief = (float *)malloc(sizeof(float) * MAX_STATES * batch->batch_size);
+	assert(belief);
+
+	for(j = 0; j < num_nodes; ++j){
+		num_variables = graph->node_num_vars[nodes[j]];
+		read_incoming_batched_messages(graph, batch, batch->last_edges_messages, nodes[j], belief);
+
+		total = 0.0f;
+		for(i = 0; i < num_variables; ++i){
+			total += belief[i * batch->batch_size + query];
+		}
+		if(total <= 0.0f){
+			total = 1.0f;
+		}
+		for(i = 0; i < num_variables; ++i){
+			beliefs[MAX_STATES * j + i] = belief[i * batch->batch_size + query] / total;
+		}
+	}
+
+	free(belief);
+}
+
+/**
+ * Copy-on-write view of a converged graph for one what-if scenario. Messages and node states are split into pages of
+ * OVERLAY_PAGE_SIZE edges or nodes; a page is copied from the base on its first write and reads of untouched pages fall
+ * through to the base, so a scenario costs memory in proportion to what it changes. The base must not be propagated again
+ * while overlays on it are alive.
+ */
+EvidenceOverlay_t create_evidence_overlay(Graph_t base){
+	EvidenceOverlay_t overlay;
+
+	overlay = (EvidenceOverlay_t)malloc(sizeof(struct evidence_overlay));
+	assert(overlay);
+
+	overlay->base = base;
+	overlay->base_messages = *base->previous_edge_messages;
+	overlay->num_message_pages = (base->current_num_edges + OVERLAY_PAGE_SIZE - 1) / OVERLAY_PAGE_SIZE;
+	overlay->message_pages = (float **)calloc(sizeof(float *), (size_t)overlay->num_message_pages + 1);
+	assert(overlay->message_pages);
+	overlay->num_state_pages = (base->current_num_vertices + OVERLAY_PAGE_SIZE - 1) / OVERLAY_PAGE_SIZE;
+	overlay->state_pages = (float **)calloc(sizeof(float *), (size_t)overlay->num_state_pages + 1);
+	assert(overlay->state_pages);
+	overlay->num_pages_used = 0;
+
+	return overlay;
+}
+
+static inline float * overlay_read(float ** pages, float * base, unsigned int index){
+	float * page;
+
+	page = pages[index / OVERLAY_PAGE_SIZE];
+	if(page == NULL){
+		return base + MAX_STATES * index;
+	}
+	return page + MAX_STATES * (index % OVERLAY_PAGE_SIZE);
+}
+
+// copies the page holding index out of the base on first write
+static float * overlay_write(EvidenceOverlay_t overlay, float ** pages, float * base, unsigned int count, unsigned int index){
+	unsigned int page_index, page_start, page_count;
+
+	page_index = index / OVERLAY_PAGE_SIZE;
+	if(pages[page_index] == NULL){
+		page_start = page_index * OVERLAY_PAGE_SIZE;
+		page_count = count - page_start;
+		if(page_count > OVERLAY_PAGE_SIZE){
+			page_count = OVERLAY_PAGE_SIZE;
+		}
+		pages[page_index] = (float *)malloc(sizeof(float) * MAX_STATES * OVERLAY_PAGE_SIZE);
+		assert(pages[page_index]);
+		memcpy(pages[page_index], base + MAX_STATES * page_start, sizeof(float) * MAX_STATES * page_count);
+		overlay->num_pages_used += 1;
+	}
+	return pages[page_index] + MAX_STATES * (index % OVERLAY_PAGE_SIZE);
+}
+
+void evidence_overlay_set_node_state(EvidenceOverlay_t overlay, unsigned int node_index, float * state){
+	Graph_t base;
+
+	base = overlay->base;
+	assert(node_index < base->current_num_vertices);
+
+	memcpy(overlay_write(overlay, overlay->state_pages, base->node_states, base->current_num_vertices, node_index), state,
+		   sizeof(float) * base->node_num_vars[node_index]);
+}
+
+// belief of a node as seen through the overlay: its state times every incoming message
+static void overlay_node_belief(EvidenceOverlay_t overlay, unsigned int node_index, float * belief){
+	unsigned int i, start_index, end_index, num_variables;
+	Graph_t base;
+
+	base = overlay->base;
+	num_variables = base->node_num_vars[node_index];
+
+	memcpy(belief, overlay_read(overlay->state_pages, base->node_states, node_index), sizeof(float) * num_variables);
+
+	start_index = base->dest_nodes_to_edges_node_list[node_index];
+	if(node_index + 1 == base->current_num_vertices){
+		end_index = base->current_num_edges;
+	}
+	else{
+		end_index = base->dest_nodes_to_edges_node_list[node_index + 1];
+	}
+	for(i = start_index; i < end_index; ++i){
+		combine_message(belief, overlay_read(overlay->message_pages, overlay->base_messages, base->dest_nodes_to_edges_edge_list[i]), num_variables, 0);
+	}
+}
+
+/**
+ * Incremental propagation inside the overlay, after evidence_overlay_set_node_state on changed_nodes. Works like
+ * loopy_propagate_evidence_change, but updates in place and only a message that moved by more than threshold is written,
+ * so the base stays untouched and unchanged pages are never copied. Returns the number of frontier rounds.
+ */
+unsigned int evidence_overlay_propagate(EvidenceOverlay_t overlay, unsigned int * changed_nodes, unsigned int num_changed, float threshold, unsigned int max_iterations){
+	unsigned int i, j, k, m, node_index, edge_index, dest_index, num_vertices, num_edges, start_index, end_index, num_active, num_next;
+	float diff, edge_delta;
+	float belief[MAX_STATES];
+	float message[MAX_STATES];
+	float * current;
+	unsigned int * active;
+	unsigned int * next_active;
+	unsigned int * temp;
+	char * queued;
+	Graph_t base;
+
+	base = overlay->base;
+	num_vertices = base->current_num_vertices;
+	num_edges = base->current_num_edges;
+
+	active = (unsigned int *)malloc(sizeof(unsigned int) * num_vertices);
+	assert(active);
+	next_active = (unsigned int *)malloc(sizeof(unsigned int) * num_vertices);
+	assert(next_active);
+	queued = (char *)calloc(sizeof(char), num_vertices);
+	assert(queued);
+
+	num_active = 0;
+	for(i = 0; i < num_changed; ++i){
+		assert(changed_nodes[i] < num_vertices);
+		if(!queued[changed_nodes[i]]){
+			queued[changed_nodes[i]] = 1;
+			active[num_active] = changed_nodes[i];
+			num_active += 1;
+		}
+	}
+	for(i = 0; i < num_active; ++i){
+		queued[active[i]] = 0;
+	}
+
+	for(i = 0; i < max_iterations && num_active > 0; ++i){
+		num_next = 0;
+		for(j = 0; j < num_active; ++j){
+			node_index = active[j];
+			overlay_node_belief(overlay, node_index, belief);
+
+			start_index = base->src_nodes_to_edges_node_list[node_index];
+			if(node_index + 1 == num_vertices){
+				end_index = num_edges;
+			}
+			else{
+				end_index = base->src_nodes_to_edges_node_list[node_index + 1];
+			}
+			for(k = start_index; k < end_index; ++k){
+				edge_index = base->src_nodes_to_edges_edge_list[k];
+				transfer_belief(base->edges_joint_probabilities + MAX_STATES * MAX_STATES * edge_index, belief, base->edges_x_dim[edge_index],
+								base->edges_y_dim[edge_index], message);
+
+				current = overlay_read(overlay->message_pages, overlay->base_messages, edge_index);
+				edge_delta = 0.0f;
+				for(m = 0; m < base->edges_y_dim[edge_index]; ++m){
+					diff = message[m] - current[m];
+					if(diff != diff){
+						diff = 0.0f;
+					}
+					edge_delta += fabs(diff);
+				}
+				if(edge_delta <= threshold){
+					continue;
+				}
+
+				memcpy(overlay_write(overlay, overlay->message_pages, overlay->base_messages, num_edges, edge_index), message,
+					   sizeof(float) * base->edges_y_dim[edge_index]);
+
+				dest_index = base->edges_dest_index[edge_index];
+				if(!queued[dest_index]){
+					queued[dest_index] = 1;
+					next_active[num_next] = dest_index;
+					num_next += 1;
+				}
+			}
+		}
+
+		for(j = 0; j < num_next; ++j){
+			queued[next_active[j]] = 0;
+		}
+
+		temp = active;
+		active = next_active;
+		next_active = temp;
+		num_active = num_next;
+	}
+	if(num_active > 0){
+		printf("No Convergence: %d nodes still active\n", num_active);
+	}
+
+	free(active);
+	free(next_active);
+	free(queued);
+
+	return i;
+}
+
+/**
+ * marginalize_loopy_nodes as seen through the overlay.
+ */
+void marginalize_overlay_nodes(EvidenceOverlay_t overlay, unsigned int * nodes, unsigned int num_nodes, float * beliefs){
+	unsigned int i, j, num_variables;
+	float sum;
+	float * belief;
+
+	for(j = 0; j < num_nodes; ++j){
+		num_variables = overlay->base->node_num_vars[nodes[j]];
+		belief = beliefs + MAX_STATES * j;
+
+		overlay_node_belief(overlay, nodes[j], belief);
+
+		sum = 0.0f;
+		for(i = 0; i < num_variables; ++i){
+			sum += belief[i];
+		}
+		if(sum <= 0.0f){
+			sum = 1.0f;
+		}
+		for(i = 0; i < num_variables; ++i){
+			belief[i] = belief[i] / sum;
+		}
+	}
+}
+
+void evidence_overlay_destroy(EvidenceOverlay_t overlay){
+	unsigned int i;
+
+	for(i = 0; i < overlay->num_message_pages; ++i){
+		free(overlay->message_pages[i]);
+	}
+	for(i = 0; i < overlay->num_state_pages; ++i){
+		free(overlay->state_pages[i]);
+	}
+	free(overlay->message_pages);
+	free(overlay->state_pages);
+	free(overlay);
 }
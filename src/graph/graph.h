@@ -43,6 +43,10 @@ struct graph {
 	float * node_states;
 	unsigned int * node_num_vars;
 
+	float ** node_factors;
+	unsigned int * node_parents;
+	unsigned int * node_num_parents;
+
 	unsigned int * src_nodes_to_edges_node_list;
 	unsigned int * src_nodes_to_edges_edge_list;
 
@@ -50,8 +54,31 @@ struct graph {
 	unsigned int * dest_nodes_to_edges_edge_list;
 
 	unsigned int * levels_to_nodes;
+	unsigned int * node_levels;
 	unsigned int num_levels;
 
+	unsigned int * node_colors;
+	unsigned int * colors_to_nodes_color_list;
+	unsigned int * colors_to_nodes_node_list;
+	unsigned int num_colors;
+
+	unsigned int * node_components;
+	unsigned int * components_to_nodes_component_list;
+	unsigned int * components_to_nodes_node_list;
+	unsigned int num_components;
+
+	unsigned int * node_partitions;
+	unsigned int * partitions_to_nodes_partition_list;
+	unsigned int * partitions_to_nodes_node_list;
+	unsigned int num_partitions;
+
+	unsigned int * work_ranges;
+	unsigned int num_work_ranges;
+	char * node_is_work_hub;
+	unsigned int * work_hubs;
+	unsigned int num_work_hubs;
+	float * work_hub_partials;
+
     int diameter;
 
 	char * visited;
@@ -73,6 +100,65 @@ struct graph {
 };
 typedef struct graph* Graph_t;
 
+struct junction_tree {
+	unsigned int num_cliques;
+	unsigned int max_potential_size;
+
+	unsigned int * cliques_to_nodes_clique_list;
+	unsigned int * cliques_to_nodes_node_list;
+
+	unsigned int * clique_parents;
+	unsigned int * clique_children_list;
+	unsigned int * clique_children;
+
+	unsigned int * node_cliques;
+	unsigned int * factor_cliques;
+
+	unsigned int * potential_offsets;
+	float * potentials;
+
+	unsigned int * separator_offsets;
+	float * separators;
+	float * separator_ratios;
+	unsigned int * separator_maps;
+	unsigned int * parent_map_offsets;
+	unsigned int * parent_separator_maps;
+
+	unsigned int * heights_to_cliques_height_list;
+	unsigned int * heights_to_cliques_clique_list;
+	unsigned int num_heights;
+
+	unsigned int * depths_to_cliques_depth_list;
+	unsigned int * depths_to_cliques_clique_list;
+	unsigned int num_depths;
+};
+typedef struct junction_tree* JunctionTree_t;
+
+struct evidence_batch {
+	unsigned int batch_size;
+
+	float * node_states;
+	float * edges_messages;
+	float * last_edges_messages;
+
+	unsigned int * num_iterations;
+};
+typedef struct evidence_batch* EvidenceBatch_t;
+
+struct evidence_overlay {
+	Graph_t base;
+	float * base_messages;
+
+	unsigned int num_message_pages;
+	float ** message_pages;
+
+	unsigned int num_state_pages;
+	float ** state_pages;
+
+	unsigned int num_pages_used;
+};
+typedef struct evidence_overlay* EvidenceOverlay_t;
+
 struct htable_entry {
     unsigned int indices[MAX_DEGREE];
     unsigned int count;
@@ -84,13 +170,42 @@ Graph_t create_graph(unsigned int, unsigned int);
 void graph_add_node(Graph_t, unsigned int, const char *);
 void graph_add_and_set_node_state(Graph_t, unsigned int, const char *, float *);
 void graph_set_node_state(Graph_t, unsigned int, unsigned int, float *);
+void graph_set_node_factor(Graph_t, unsigned int, unsigned int *, unsigned int, float *);
 
 void graph_add_edge(Graph_t, unsigned int, unsigned int, unsigned int, unsigned int, float *);
 
 void set_up_src_nodes_to_edges(Graph_t);
 void set_up_dest_nodes_to_edges(Graph_t);
+void absorb_evidence(Graph_t);
+Graph_t prune_graph_for_query(Graph_t, unsigned int * targets, unsigned int num_targets, unsigned int * node_map);
 void init_levels_to_nodes(Graph_t);
+void init_colors_to_nodes(Graph_t);
+void init_components_to_nodes(Graph_t);
+void init_partitions_to_nodes(Graph_t, unsigned int num_partitions);
+void init_cache_blocks_to_nodes(Graph_t, unsigned int cache_size);
+void init_work_ranges(Graph_t, unsigned int num_threads);
+void init_core_levels_to_nodes(Graph_t);
 void calculate_diameter(Graph_t);
+char graph_is_forest(Graph_t);
+
+JunctionTree_t create_junction_tree(Graph_t);
+void junction_tree_propagate(JunctionTree_t, Graph_t);
+void junction_tree_marginalize_nodes(JunctionTree_t, Graph_t, unsigned int * nodes, unsigned int num_nodes, float * beliefs);
+void junction_tree_destroy(JunctionTree_t);
+
+EvidenceBatch_t create_evidence_batch(Graph_t, unsigned int batch_size);
+EvidenceBatch_t load_evidence_batch(Graph_t, const char * file_name);
+void evidence_batch_set_node_state(Graph_t, EvidenceBatch_t, unsigned int query, unsigned int node_index, float * state);
+void evidence_batch_destroy(EvidenceBatch_t);
+void init_previous_edge_batched(Graph_t, EvidenceBatch_t);
+unsigned int loopy_propagate_until_batched(Graph_t, EvidenceBatch_t, float convergence, unsigned int max_iterations);
+void marginalize_batched_nodes(Graph_t, EvidenceBatch_t, unsigned int query, unsigned int * nodes, unsigned int num_nodes, float * beliefs);
+
+EvidenceOverlay_t create_evidence_overlay(Graph_t);
+void evidence_overlay_set_node_state(EvidenceOverlay_t, unsigned int node_index, float * state);
+unsigned int evidence_overlay_propagate(EvidenceOverlay_t, unsigned int * changed_nodes, unsigned int num_changed, float threshold, unsigned int max_iterations);
+void marginalize_overlay_nodes(EvidenceOverlay_t, unsigned int * nodes, unsigned int num_nodes, float * beliefs);
+void evidence_overlay_destroy(EvidenceOverlay_t);
 
 void initialize_node(Graph_t, unsigned int, unsigned int);
 void node_set_state(Graph_t, unsigned int, unsigned int, float *);
@@ -111,18 +226,32 @@ void graph_destroy(Graph_t);
 
 void propagate_using_levels_start(Graph_t);
 void propagate_using_levels(Graph_t, unsigned int);
+void propagate_using_tasks(Graph_t);
 
 void reset_visited(Graph_t);
 
 void init_previous_edge(Graph_t);
+void init_previous_edge_from_messages(Graph_t, float * messages);
+void save_edge_messages(Graph_t, float * messages);
 void loopy_propagate_one_iteration(Graph_t);
 
+unsigned int propagate_until(Graph_t, float convergence, unsigned int max_iterations, const char ** engine);
 unsigned int loopy_propagate_until(Graph_t, float convergence, unsigned int max_iterations);
 unsigned int loopy_propagate_until_edge(Graph_t, float, unsigned int);
+unsigned int loopy_propagate_until_damped(Graph_t, float convergence, unsigned int max_iterations, unsigned int * num_damped_iterations);
+unsigned int loopy_propagate_until_active(Graph_t, float threshold, unsigned int max_iterations);
+unsigned int loopy_propagate_evidence_change(Graph_t, unsigned int * changed_nodes, unsigned int num_changed, float threshold, unsigned int max_iterations);
+unsigned int loopy_propagate_until_colored(Graph_t, float convergence, unsigned int max_iterations);
+unsigned int loopy_propagate_until_components(Graph_t, float convergence, unsigned int max_iterations);
+unsigned int loopy_propagate_until_core(Graph_t, float convergence, unsigned int max_iterations);
+unsigned int loopy_propagate_until_partitioned(Graph_t, float convergence, unsigned int max_iterations);
+unsigned int loopy_propagate_until_blocked(Graph_t, float convergence, unsigned int max_iterations);
+unsigned int splash_propagate_until(Graph_t, float convergence, unsigned int max_iterations, unsigned int splash_size);
 unsigned int loopy_progagate_until_acc(Graph_t, float convergence, unsigned int max_iterations);
 unsigned int loopy_progagate_until_edge_acc(Graph_t, float, unsigned int);
 
 void marginalize(Graph_t);
+void marginalize_loopy_nodes(Graph_t, unsigned int * nodes, unsigned int num_nodes, float * beliefs);
 
 void print_node(Graph_t, unsigned int);
 void print_edge(Graph_t, unsigned int);
@@ -131,6 +260,9 @@ void print_edges(Graph_t);
 void print_src_nodes_to_edges(Graph_t);
 void print_dest_nodes_to_edges(Graph_t);
 void print_levels_to_nodes(Graph_t);
+void print_colors_to_nodes(Graph_t);
+void print_components_to_nodes(Graph_t);
+void print_partitions_to_nodes(Graph_t);
 
 
 #endif /* GRAPH_H_ */
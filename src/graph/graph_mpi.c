@@ -0,0 +1,725 @@
+#include <stdlib.h>
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "graph_mpi.h"
+
+static int node_owner(DistributedGraph_t graph, unsigned int node_index){
+	int low, high, mid;
+
+	low = 0;
+	high = graph->num_ranks - 1;
+	while(low < high){
+		mid = (low + high + 1) / 2;
+		if(graph->node_offsets[mid] <= node_index){
+			low = mid;
+		}
+		else{
+			high = mid - 1;
+		}
+	}
+	return low;
+}
+
+/**
+ * Builds this rank's share of a distributed graph. The rank owns num_nodes nodes, numbered globally after the nodes of
+ * lower ranks, and the edges they send on: edges_src holds local node indices, edges_dest global ones. Receivers learn
+ * which boundary messages they get with one all-to-all, and keep one ghost slot per incoming boundary edge.
+ */
+DistributedGraph_t create_distributed_graph(MPI_Comm comm, unsigned int num_nodes, unsigned int * num_vars, float * node_states,
+											unsigned int num_edges, unsigned int * edges_src, unsigned int * edges_dest,
+											unsigned int * x_dim, unsigned int * y_dim, float * joint_probabilities){
+	unsigned int i, j, edge_index, dest_index, num_send, num_in;
+	int r, dest_rank;
+	char is_boundary;
+	int * send_counts;
+	int * recv_counts;
+	int * send_displacements;
+	int * recv_displacements;
+	unsigned int * counts;
+	unsigned int * send_dest;
+	unsigned int * recv_dest;
+	DistributedGraph_t graph;
+
+	graph = (DistributedGraph_t)malloc(sizeof(struct distributed_graph));
+	assert(graph);
+	graph->comm = comm;
+	MPI_Comm_rank(comm, &graph->rank);
+	MPI_Comm_size(comm, &graph->num_ranks);
+
+	graph->node_offsets = (unsigned int *)malloc(sizeof(unsigned int) * (graph->num_ranks + 1));
+	assert(graph->node_offsets);
+	MPI_Allgather(&num_nodes, 1, MPI_UNSIGNED, graph->node_offsets, 1, MPI_UNSIGNED, comm);
+	j = 0;
+	for(r = 0; r <= graph->num_ranks; ++r){
+		i = (r < graph->num_ranks) ? graph->node_offsets[r] : 0;
+		graph->node_offsets[r] = j;
+		j += i;
+	}
+	graph->first_node = graph->node_offsets[graph->rank];
+	graph->num_nodes = num_nodes;
+	graph->num_edges = num_edges;
+	graph->nodes = NULL;
+	MPI_Allreduce(&num_edges, &graph->total_num_edges, 1, MPI_UNSIGNED, MPI_SUM, comm);
+
+	graph->node_num_vars = (unsigned int *)malloc(sizeof(unsigned int) * (num_nodes + 1));
+	assert(graph->node_num_vars);
+	graph->node_states = (float *)malloc(sizeof(float) * MAX_STATES * (num_nodes + 1));
+	assert(graph->node_states);
+	memcpy(graph->node_num_vars, num_vars, sizeof(unsigned int) * num_nodes);
+	memcpy(graph->node_states, node_states, sizeof(float) * MAX_STATES * num_nodes);
+
+	// edges grouped by sender
+	graph->out_offsets = (unsigned int *)calloc(sizeof(unsigned int), num_nodes + 1);
+	assert(graph->out_offsets);
+	graph->edges_dest_index = (unsigned int *)malloc(sizeof(unsigned int) * (num_edges + 1));
+	assert(graph->edges_dest_index);
+	graph->edges_x_dim = (unsigned int *)malloc(sizeof(unsigned int) * (num_edges + 1));
+	assert(graph->edges_x_dim);
+	graph->edges_y_dim = (unsigned int *)malloc(sizeof(unsigned int) * (num_edges + 1));
+	assert(graph->edges_y_dim);
+	graph->edges_joint_probabilities = (float *)malloc(sizeof(float) * MAX_STATES * MAX_STATES * (num_edges + 1));
+	assert(graph->edges_joint_probabilities);
+	counts = (unsigned int *)malloc(sizeof(unsigned int) * (num_nodes + 1));
+	assert(counts);
+
+	for(i = 0; i < num_edges; ++i){
+		assert(edges_src[i] < num_nodes);
+		graph->out_offsets[edges_src[i] + 1] += 1;
+	}
+	for(i = 0; i < num_nodes; ++i){
+		graph->out_offsets[i + 1] += graph->out_offsets[i];
+		counts[i] = graph->out_offsets[i];
+	}
+	for(i = 0; i < num_edges; ++i){
+		edge_index = counts[edges_src[i]];
+		counts[edges_src[i]] += 1;
+		graph->edges_dest_index[edge_index] = edges_dest[i];
+		graph->edges_x_dim[edge_index] = x_dim[i];
+		graph->edges_y_dim[edge_index] = y_dim[i];
+		memcpy(graph->edges_joint_probabilities + MAX_STATES * MAX_STATES * edge_index, joint_probabilities + MAX_STATES * MAX_STATES * i,
+			   sizeof(float) * MAX_STATES * MAX_STATES);
+	}
+
+	// boundary edges, grouped by the rank that reads them
+	send_counts = (int *)calloc(sizeof(int), graph->num_ranks);
+	assert(send_counts);
+	recv_counts = (int *)malloc(sizeof(int) * graph->num_ranks);
+	assert(recv_counts);
+	send_displacements = (int *)malloc(sizeof(int) * graph->num_ranks);
+	assert(send_displacements);
+	recv_displacements = (int *)malloc(sizeof(int) * graph->num_ranks);
+	assert(recv_displacements);
+	graph->send_offsets = (unsigned int *)malloc(sizeof(unsigned int) * (graph->num_ranks + 1));
+	assert(graph->send_offsets);
+	graph->recv_offsets = (unsigned int *)malloc(sizeof(unsigned int) * (graph->num_ranks + 1));
+	assert(graph->recv_offsets);
+
+	num_send = 0;
+	for(i = 0; i < num_edges; ++i){
+		dest_rank = node_owner(graph, graph->edges_dest_index[i]);
+		if(dest_rank != graph->rank){
+			send_counts[dest_rank] += 1;
+			num_send += 1;
+		}
+	}
+	MPI_Alltoall(send_counts, 1, MPI_INT, recv_counts, 1, MPI_INT, comm);
+
+	graph->send_offsets[0] = 0;
+	graph->recv_offsets[0] = 0;
+	for(r = 0; r < graph->num_ranks; ++r){
+		graph->send_offsets[r + 1] = graph->send_offsets[r] + send_counts[r];
+		graph->recv_offsets[r + 1] = graph->recv_offsets[r] + recv_counts[r];
+		send_displacements[r] = graph->send_offsets[r];
+		recv_displacements[r] = graph->recv_offsets[r];
+	}
+	graph->num_ghosts = graph->recv_offsets[graph->num_ranks];
+
+	graph->send_edges = (unsigned int *)malloc(sizeof(unsigned int) * (num_send + 1));
+	assert(graph->send_edges);
+	send_dest = (unsigned int *)malloc(sizeof(unsigned int) * (num_send + 1));
+	assert(send_dest);
+	recv_dest = (unsigned int *)malloc(sizeof(unsigned int) * (graph->num_ghosts + 1));
+	assert(recv_dest);
+
+	for(r = 0; r < graph->num_ranks; ++r){
+		send_counts[r] = 0;
+	}
+	for(i = 0; i < num_edges; ++i){
+		dest_rank = node_owner(graph, graph->edges_dest_index[i]);
+		if(dest_rank != graph->rank){
+			j = graph->send_offsets[dest_rank] + send_counts[dest_rank];
+			send_counts[dest_rank] += 1;
+			graph->send_edges[j] = i;
+			send_dest[j] = graph->edges_dest_index[i];
+		}
+	}
+	MPI_Alltoallv(send_dest, send_counts, send_displacements, MPI_UNSIGNED, recv_dest, recv_counts, recv_displacements, MPI_UNSIGNED, comm);
+
+	// incoming slots per owned node: local edges first, then ghosts at num_edges + ghost index
+	graph->in_offsets = (unsigned int *)calloc(sizeof(unsigned int), num_nodes + 1);
+	assert(graph->in_offsets);
+	for(i = 0; i < num_edges; ++i){
+		if(node_owner(graph, graph->edges_dest_index[i]) == graph->rank){
+			graph->in_offsets[graph->edges_dest_index[i] - graph->first_node + 1] += 1;
+		}
+	}
+	for(i = 0; i < graph->num_ghosts; ++i){
+		graph->in_offsets[recv_dest[i] - graph->first_node + 1] += 1;
+	}
+	for(i = 0; i < num_nodes; ++i){
+		graph->in_offsets[i + 1] += graph->in_offsets[i];
+		counts[i] = graph->in_offsets[i];
+	}
+	num_in = graph->in_offsets[num_nodes];
+	graph->in_slots = (unsigned int *)malloc(sizeof(unsigned int) * (num_in + 1));
+	assert(graph->in_slots);
+	for(i = 0; i < num_edges; ++i){
+		if(node_owner(graph, graph->edges_dest_index[i]) == graph->rank){
+			dest_index = graph->edges_dest_index[i] - graph->first_node;
+			graph->in_slots[counts[dest_index]] = i;
+			counts[dest_index] += 1;
+		}
+	}
+	for(i = 0; i < graph->num_ghosts; ++i){
+		dest_index = recv_dest[i] - graph->first_node;
+		assert(dest_index < num_nodes);
+		graph->in_slots[counts[dest_index]] = num_edges + i;
+		counts[dest_index] += 1;
+	}
+
+	// nodes sending on a boundary edge go first in the sweep order, interior nodes fill from the back
+	graph->node_order = (unsigned int *)malloc(sizeof(unsigned int) * (num_nodes + 1));
+	assert(graph->node_order);
+	graph->num_boundary_nodes = 0;
+	for(i = 0; i < num_nodes; ++i){
+		is_boundary = 0;
+		for(edge_index = graph->out_offsets[i]; edge_index < graph->out_offsets[i + 1]; ++edge_index){
+			if(node_owner(graph, graph->edges_dest_index[edge_index]) != graph->rank){
+				is_boundary = 1;
+			}
+		}
+		if(is_boundary){
+			graph->node_order[graph->num_boundary_nodes] = i;
+			graph->num_boundary_nodes += 1;
+		}
+		else{
+			graph->node_order[num_nodes - 1 - (i - graph->num_boundary_nodes)] = i;
+		}
+	}
+
+	graph->send_buffer = (float *)malloc(sizeof(float) * MAX_STATES * (num_send + 1));
+	assert(graph->send_buffer);
+	graph->requests = (MPI_Request *)malloc(sizeof(MPI_Request) * 2 * graph->num_ranks);
+	assert(graph->requests);
+	graph->messages[0] = (float *)malloc(sizeof(float) * MAX_STATES * (num_edges + graph->num_ghosts + 1));
+	assert(graph->messages[0]);
+	graph->messages[1] = (float *)malloc(sizeof(float) * MAX_STATES * (num_edges + graph->num_ghosts + 1));
+	assert(graph->messages[1]);
+	graph->num_requests = 0;
+	graph->current = 0;
+
+	free(send_counts);
+	free(recv_counts);
+	free(send_displacements);
+	free(recv_displacements);
+	free(send_dest);
+	free(recv_dest);
+	free(counts);
+
+	return graph;
+}
+
+/**
+ * Splits a graph every rank has loaded into one part per rank with init_partitions_to_nodes; global ids follow
+ * partitions_to_nodes_node_list and nodes keeps each owned node's index in the loaded graph.
+ */
+DistributedGraph_t distribute_graph(Graph_t graph, MPI_Comm comm){
+	unsigned int i, j, k, node_index, edge_index, start_index, end_index, num_vertices, num_edges, first, num_nodes, num_local_edges;
+	int rank, num_ranks;
+	unsigned int * new_indices;
+	unsigned int * num_vars;
+	unsigned int * edges_src;
+	unsigned int * edges_dest;
+	unsigned int * x_dim;
+	unsigned int * y_dim;
+	float * states;
+	float * joint_probabilities;
+	DistributedGraph_t distributed;
+
+	MPI_Comm_rank(comm, &rank);
+	MPI_Comm_size(comm, &num_ranks);
+
+	num_vertices = graph->current_num_vertices;
+	num_edges = graph->current_num_edges;
+
+	init_partitions_to_nodes(graph, (unsigned int)num_ranks);
+
+	new_indices = (unsigned int *)malloc(sizeof(unsigned int) * num_vertices);
+	assert(new_indices);
+	for(i = 0; i < num_vertices; ++i){
+		new_indices[graph->partitions_to_nodes_node_list[i]] = i;
+	}
+
+	first = graph->partitions_to_nodes_partition_list[rank];
+	num_nodes = graph->partitions_to_nodes_partition_list[rank + 1] - first;
+
+	num_local_edges = 0;
+	for(i = 0; i < num_nodes; ++i){
+		node_index = graph->partitions_to_nodes_node_list[first + i];
+		start_index = graph->src_nodes_to_edges_node_list[node_index];
+		end_index = (node_index + 1 == num_vertices) ? num_edges : graph->src_nodes_to_edges_node_list[node_index + 1];
+		num_local_edges += end_index - start_index;
+	}
+
+	num_vars = (unsigned int *)malloc(sizeof(unsigned int) * (num_nodes + 1));
+	assert(num_vars);
+	states = (float *)malloc(sizeof(float) * MAX_STATES * (num_nodes + 1));
+	assert(states);
+	edges_src = (unsigned int *)malloc(sizeof(unsigned int) * (num_local_edges + 1));
+	assert(edges_src);
+	edges_dest = (unsigned int *)malloc(sizeof(unsigned int) * (num_local_edges + 1));
+	assert(edges_dest);
+	x_dim = (unsigned int *)malloc(sizeof(unsigned int) * (num_local_edges + 1));
+	assert(x_dim);
+	y_dim = (unsigned int *)malloc(sizeof(unsigned int) * (num_local_edges + 1));
+	assert(y_dim);
+	joint_probabilities = (float *)malloc(sizeof(float) * MAX_STATES * MAX_STATES * (num_local_edges + 1));
+	assert(joint_probabilities);
+
+	k = 0;
+	for(i = 0; i < num_nodes; ++i){
+		node_index = graph->partitions_to_nodes_node_list[first + i];
+		num_vars[i] = graph->node_num_vars[node_index];
+		memcpy(states + MAX_STATES * i, graph->node_states + MAX_STATES * node_index, sizeof(float) * MAX_STATES);
+
+		start_index = graph->src_nodes_to_edges_node_list[node_index];
+		end_index = (node_index + 1 == num_vertices) ? num_edges : graph->src_nodes_to_edges_node_list[node_index + 1];
+		for(j = start_index; j < end_index; ++j){
+			edge_index = graph->src_nodes_to_edges_edge_list[j];
+			edges_src[k] = i;
+			edges_dest[k] = new_indices[graph->edges_dest_index[edge_index]];
+			x_dim[k] = graph->edges_x_dim[edge_index];
+			y_dim[k] = graph->edges_y_dim[edge_index];
+			memcpy(joint_probabilities + MAX_STATES * MAX_STATES * k, graph->edges_joint_probabilities + MAX_STATES * MAX_STATES * edge_index,
+				   sizeof(float) * MAX_STATES * MAX_STATES);
+			k += 1;
+		}
+	}
+
+	distributed = create_distributed_graph(comm, num_nodes, num_vars, states, num_local_edges, edges_src, edges_dest, x_dim, y_dim, joint_probabilities);
+
+	distributed->nodes = (unsigned int *)malloc(sizeof(unsigned int) * (num_nodes + 1));
+	assert(distributed->nodes);
+	memcpy(distributed->nodes, graph->partitions_to_nodes_node_list + first, sizeof(unsigned int) * num_nodes);
+
+	free(new_indices);
+	free(num_vars);
+	free(states);
+	free(edges_src);
+	free(edges_dest);
+	free(x_dim);
+	free(y_dim);
+	free(joint_probabilities);
+
+	return distributed;
+}
+
+static void random_edge_table(unsigned int src_index, unsigned int dest_index, unsigned int seed, float * joint_probabilities){
+	unsigned int state, j;
+	float p;
+
+	state = seed ^ (src_index * 2654435761u) ^ (dest_index * 40503u);
+	for(j = 0; j < 2; ++j){
+		p = 0.3f + 0.4f * ((float)rand_r(&state) / RAND_MAX);
+		joint_probabilities[MAX_STATES * j + 0] = p;
+		joint_probabilities[MAX_STATES * j + 1] = 1.0f - p;
+	}
+}
+
+/**
+ * Synthetic binary network generated in place on every rank, so no rank ever holds more than its own share; this is how
+ * models too large for one machine are run. Each owned node picks edges_per_node neighbours, a local_fraction of them on
+ * the same rank, and both directions of every pair are added; the owner of the far end receives its direction through an
+ * all-to-all. One node in ten carries a random prior. Tables depend only on the node pair and seed.
+ */
+DistributedGraph_t generate_distributed_graph(MPI_Comm comm, unsigned int nodes_per_rank, unsigned int edges_per_node, float local_fraction, unsigned int seed){
+	unsigned int i, j, k, num_edges, num_total, first, src_index, dest_index, num_send, num_recv, state;
+	int r, rank, num_ranks, dest_rank;
+	int * send_counts;
+	int * recv_counts;
+	int * send_displacements;
+	int * recv_displacements;
+	unsigned int * num_vars;
+	unsigned int * edges_src;
+	unsigned int * edges_dest;
+	unsigned int * x_dim;
+	unsigned int * y_dim;
+	unsigned int * send_pairs;
+	unsigned int * recv_pairs;
+	float * states;
+	float * joint_probabilities;
+	float table[MAX_STATES * MAX_STATES];
+	DistributedGraph_t graph;
+
+	MPI_Comm_rank(comm, &rank);
+	MPI_Comm_size(comm, &num_ranks);
+
+	assert(nodes_per_rank > 1);
+	first = nodes_per_rank * rank;
+	num_total = nodes_per_rank * num_ranks;
+	state = seed ^ (unsigned int)(rank * 7919);
+
+	num_vars = (unsigned int *)malloc(sizeof(unsigned int) * nodes_per_rank);
+	assert(num_vars);
+	states = (float *)malloc(sizeof(float) * MAX_STATES * nodes_per_rank);
+	assert(states);
+	for(i = 0; i < nodes_per_rank; ++i){
+		num_vars[i] = 2;
+		states[MAX_STATES * i] = 1.0f;
+		states[MAX_STATES * i + 1] = 1.0f;
+		if(rand_r(&state) % 10 == 0){
+			states[MAX_STATES * i] = (float)rand_r(&state) / RAND_MAX;
+			states[MAX_STATES * i + 1] = 1.0f - states[MAX_STATES * i];
+		}
+	}
+
+	// forward directions: this rank sends on all of them
+	send_pairs = (unsigned int *)malloc(sizeof(unsigned int) * 2 * nodes_per_rank * edges_per_node + 1);
+	assert(send_pairs);
+	edges_src = (unsigned int *)malloc(sizeof(unsigned int) * 2 * nodes_per_rank * edges_per_node + 1);
+	assert(edges_src);
+	edges_dest = (unsigned int *)malloc(sizeof(unsigned int) * 2 * nodes_per_rank * edges_per_node + 1);
+	assert(edges_dest);
+	send_counts = (int *)calloc(sizeof(int), num_ranks);
+	assert(send_counts);
+
+	num_edges = 0;
+	for(i = 0; i < nodes_per_rank; ++i){
+		for(j = 0; j < edges_per_node; ++j){
+			if((float)rand_r(&state) / RAND_MAX < local_fraction){
+				dest_index = first + rand_r(&state) % nodes_per_rank;
+			}
+			else{
+				dest_index = rand_r(&state) % num_total;
+			}
+			if(dest_index == first + i){
+				continue;
+			}
+			edges_src[num_edges] = i;
+			edges_dest[num_edges] = dest_index;
+			num_edges += 1;
+		}
+	}
+
+	// reverse directions: local ones directly, remote ones to the owner of the far end
+	num_send = 0;
+	for(k = 0; k < num_edges; ++k){
+		dest_rank = (int)(edges_dest[k] / nodes_per_rank);
+		if(dest_rank != rank){
+			send_counts[dest_rank] += 2;
+			num_send += 1;
+		}
+	}
+	recv_counts = (int *)malloc(sizeof(int) * num_ranks);
+	assert(recv_counts);
+	send_displacements = (int *)malloc(sizeof(int) * num_ranks);
+	assert(send_displacements);
+	recv_displacements = (int *)malloc(sizeof(int) * num_ranks);
+	assert(recv_displacements);
+	MPI_Alltoall(send_counts, 1, MPI_INT, recv_counts, 1, MPI_INT, comm);
+	send_displacements[0] = 0;
+	recv_displacements[0] = 0;
+	for(r = 1; r < num_ranks; ++r){
+		send_displacements[r] = send_displacements[r - 1] + send_counts[r - 1];
+		recv_displacements[r] = recv_displacements[r - 1] + recv_counts[r - 1];
+	}
+	num_recv = (recv_displacements[num_ranks - 1] + recv_counts[num_ranks - 1]) / 2;
+	for(r = 0; r < num_ranks; ++r){
+		send_counts[r] = 0;
+	}
+	for(k = 0; k < num_edges; ++k){
+		dest_rank = (int)(edges_dest[k] / nodes_per_rank);
+		if(dest_rank != rank){
+			send_pairs[send_displacements[dest_rank] + send_counts[dest_rank]] = first + edges_src[k];
+			send_pairs[send_displacements[dest_rank] + send_counts[dest_rank] + 1] = edges_dest[k];
+			send_counts[dest_rank] += 2;
+		}
+	}
+	recv_pairs = (unsigned int *)malloc(sizeof(unsigned int) * 2 * num_recv + 1);
+	assert(recv_pairs);
+	MPI_Alltoallv(send_pairs, send_counts, send_displacements, MPI_UNSIGNED, recv_pairs, recv_counts, recv_displacements, MPI_UNSIGNED, comm);
+
+	edges_src = (unsigned int *)realloc(edges_src, sizeof(unsigned int) * (2 * num_edges + num_recv + 1));
+	assert(edges_src);
+	edges_dest = (unsigned int *)realloc(edges_dest, sizeof(unsigned int) * (2 * num_edges + num_recv + 1));
+	assert(edges_dest);
+	joint_probabilities = (float *)malloc(sizeof(float) * MAX_STATES * MAX_STATES * (2 * num_edges + num_recv + 1));
+	assert(joint_probabilities);
+
+	// forward tables, then reversed copies for the local pairs and the received ones
+	j = num_edges;
+	for(k = 0; k < num_edges; ++k){
+		random_edge_table(first + edges_src[k], edges_dest[k], seed, joint_probabilities + MAX_STATES * MAX_STATES * k);
+		if(edges_dest[k] / nodes_per_rank == (unsigned int)rank){
+			edges_src[j] = edges_dest[k] - first;
+			edges_dest[j] = first + edges_src[k];
+			j += 1;
+		}
+	}
+	for(k = 0; k < num_recv; ++k){
+		edges_src[j] = recv_pairs[2 * k + 1] - first;
+		edges_dest[j] = recv_pairs[2 * k];
+		j += 1;
+	}
+	for(k = num_edges; k < j; ++k){
+		src_index = edges_dest[k];
+		dest_index = first + edges_src[k];
+		random_edge_table(src_index, dest_index, seed, table);
+		for(i = 0; i < 2; ++i){
+			joint_probabilities[MAX_STATES * MAX_STATES * k + MAX_STATES * i + 0] = table[MAX_STATES * 0 + i];
+			joint_probabilities[MAX_STATES * MAX_STATES * k + MAX_STATES * i + 1] = table[MAX_STATES * 1 + i];
+		}
+	}
+	num_edges = j;
+
+	x_dim = (unsigned int *)malloc(sizeof(unsigned int) * (num_edges + 1));
+	assert(x_dim);
+	y_dim = (unsigned int *)malloc(sizeof(unsigned int) * (num_edges + 1));
+	assert(y_dim);
+	for(k = 0; k < num_edges; ++k){
+		x_dim[k] = 2;
+		y_dim[k] = 2;
+	}
+
+	graph = create_distributed_graph(comm, nodes_per_rank, num_vars, states, num_edges, edges_src, edges_dest, x_dim, y_dim, joint_probabilities);
+
+	free(send_counts);
+	free(recv_counts);
+	free(send_displacements);
+	free(recv_displacements);
+	free(send_pairs);
+	free(recv_pairs);
+	free(num_vars);
+	free(states);
+	free(edges_src);
+	free(edges_dest);
+	free(x_dim);
+	free(y_dim);
+	free(joint_probabilities);
+
+	return graph;
+}
+
+void distributed_graph_destroy(DistributedGraph_t graph){
+	free(graph->node_offsets);
+	free(graph->nodes);
+	free(graph->node_num_vars);
+	free(graph->node_states);
+	free(graph->out_offsets);
+	free(graph->edges_dest_index);
+	free(graph->edges_x_dim);
+	free(graph->edges_y_dim);
+	free(graph->edges_joint_probabilities);
+	free(graph->in_offsets);
+	free(graph->in_slots);
+	free(graph->node_order);
+	free(graph->send_offsets);
+	free(graph->send_edges);
+	free(graph->recv_offsets);
+	free(graph->send_buffer);
+	free(graph->requests);
+	free(graph->messages[0]);
+	free(graph->messages[1]);
+	free(graph);
+}
+
+// posts the receives of this rank's ghosts straight into the ghost region of messages[current]
+static void post_distributed_receives(DistributedGraph_t graph, unsigned int current){
+	unsigned int count;
+	int r;
+	float * messages;
+
+	messages = graph->messages[current];
+	graph->num_requests = 0;
+
+	for(r = 0; r < graph->num_ranks; ++r){
+		count = graph->recv_offsets[r + 1] - graph->recv_offsets[r];
+		if(count > 0){
+			MPI_Irecv(messages + MAX_STATES * (graph->num_edges + graph->recv_offsets[r]), (int)(MAX_STATES * count), MPI_FLOAT, r, 0, graph->comm,
+					  &graph->requests[graph->num_requests]);
+			graph->num_requests += 1;
+		}
+	}
+}
+
+// packs this rank's boundary messages from messages[current] and posts one send per reading rank
+static void post_distributed_sends(DistributedGraph_t graph, unsigned int current){
+	unsigned int i, count;
+	int r;
+	float * messages;
+
+	messages = graph->messages[current];
+
+	for(i = 0; i < graph->send_offsets[graph->num_ranks]; ++i){
+		memcpy(graph->send_buffer + MAX_STATES * i, messages + MAX_STATES * graph->send_edges[i], sizeof(float) * MAX_STATES);
+	}
+	for(r = 0; r < graph->num_ranks; ++r){
+		count = graph->send_offsets[r + 1] - graph->send_offsets[r];
+		if(count > 0){
+			MPI_Isend(graph->send_buffer + MAX_STATES * graph->send_offsets[r], (int)(MAX_STATES * count), MPI_FLOAT, r, 0, graph->comm,
+					  &graph->requests[graph->num_requests]);
+			graph->num_requests += 1;
+		}
+	}
+}
+
+static void wait_distributed_ghosts(DistributedGraph_t graph){
+	MPI_Waitall(graph->num_requests, graph->requests, MPI_STATUSES_IGNORE);
+	graph->num_requests = 0;
+}
+
+// combines incoming messages into the node's belief and sends it on every owned edge, returning how far they moved
+static float propagate_distributed_node(DistributedGraph_t graph, unsigned int node_index, float * previous_messages, float * current_messages){
+	unsigned int j, k, num_variables, edge_index, slot;
+	float delta, diff;
+	float message_buffer[MAX_STATES];
+
+	num_variables = graph->node_num_vars[node_index];
+	for(k = 0; k < num_variables; ++k){
+		message_buffer[k] = graph->node_states[MAX_STATES * node_index + k];
+	}
+	for(j = graph->in_offsets[node_index]; j < graph->in_offsets[node_index + 1]; ++j){
+		slot = graph->in_slots[j];
+		for(k = 0; k < num_variables; ++k){
+			message_buffer[k] *= previous_messages[MAX_STATES * slot + k];
+		}
+	}
+
+	delta = 0.0f;
+	for(edge_index = graph->out_offsets[node_index]; edge_index < graph->out_offsets[node_index + 1]; ++edge_index){
+		send_message(message_buffer, 0, edge_index, graph->edges_joint_probabilities, current_messages, graph->edges_x_dim, graph->edges_y_dim);
+		for(k = 0; k < graph->edges_y_dim[edge_index]; ++k){
+			diff = current_messages[MAX_STATES * edge_index + k] - previous_messages[MAX_STATES * edge_index + k];
+			if(diff != diff){
+				diff = 0.0f;
+			}
+			delta += fabs(diff);
+		}
+	}
+	return delta;
+}
+
+/**
+ * Seeds the messages from the node states, like init_previous_edge, and fills the ghosts once.
+ */
+void init_previous_edge_distributed(DistributedGraph_t graph){
+	unsigned int i, edge_index;
+
+	for(i = 0; i < graph->num_nodes; ++i){
+		for(edge_index = graph->out_offsets[i]; edge_index < graph->out_offsets[i + 1]; ++edge_index){
+			send_message(graph->node_states, MAX_STATES * i, edge_index, graph->edges_joint_probabilities, graph->messages[0], graph->edges_x_dim, graph->edges_y_dim);
+		}
+	}
+	post_distributed_receives(graph, 0);
+	post_distributed_sends(graph, 0);
+	wait_distributed_ghosts(graph);
+	memcpy(graph->messages[1], graph->messages[0], sizeof(float) * MAX_STATES * (graph->num_edges + graph->num_ghosts));
+	graph->current = 0;
+}
+
+/**
+ * Synchronous loopy BP across ranks. Each iteration a rank posts the receives for its ghosts, updates the nodes that send
+ * on boundary edges, posts their messages to the ranks that read them, and only then updates its interior nodes, so the
+ * transfer runs behind the interior work; it waits for the exchange right before the delta of loopy_propagate_until is
+ * summed with MPI_Allreduce, so every rank stops on the same iteration. Must be called on every rank of the communicator.
+ */
+unsigned int loopy_propagate_until_distributed(DistributedGraph_t graph, float convergence, unsigned int max_iterations){
+	unsigned int i, j, current, num_nodes, num_boundary_nodes;
+	unsigned int * node_order;
+	float delta, local_delta, previous_delta;
+	float * previous_messages;
+	float * current_messages;
+
+	num_nodes = graph->num_nodes;
+	num_boundary_nodes = graph->num_boundary_nodes;
+	node_order = graph->node_order;
+	previous_delta = -1.0f;
+	delta = 0.0f;
+	current = 1 - graph->current;
+
+	for(i = 0; i < max_iterations; ++i){
+		previous_messages = graph->messages[1 - current];
+		current_messages = graph->messages[current];
+
+		post_distributed_receives(graph, current);
+
+		local_delta = 0.0f;
+#pragma omp parallel for default(none) shared(graph, num_boundary_nodes, node_order, previous_messages, current_messages) private(j) reduction(+:local_delta)
+		for(j = 0; j < num_boundary_nodes; ++j){
+			local_delta += propagate_distributed_node(graph, node_order[j], previous_messages, current_messages);
+		}
+
+		post_distributed_sends(graph, current);
+
+#pragma omp parallel for default(none) shared(graph, num_nodes, num_boundary_nodes, node_order, previous_messages, current_messages) private(j) reduction(+:local_delta)
+		for(j = num_boundary_nodes; j < num_nodes; ++j){
+			local_delta += propagate_distributed_node(graph, node_order[j], previous_messages, current_messages);
+		}
+
+		wait_distributed_ghosts(graph);
+		MPI_Allreduce(&local_delta, &delta, 1, MPI_FLOAT, MPI_SUM, graph->comm);
+
+		graph->current = current;
+		current = 1 - current;
+
+		if(delta < convergence || fabs(delta - previous_delta) < convergence){
+			break;
+		}
+		if(i < max_iterations - 1) {
+			previous_delta = delta;
+		}
+	}
+	if(i == max_iterations && graph->rank == 0){
+		printf("No Convergence: previous: %f vs current: %f\n", previous_delta, delta);
+	}
+
+	return i;
+}
+
+/**
+ * Normalized beliefs of this rank's nodes, in local order, from the newest messages.
+ */
+void marginalize_distributed_nodes(DistributedGraph_t graph, float * beliefs){
+	unsigned int i, j, k, num_variables;
+	float sum;
+	float * messages;
+	float * belief;
+
+	messages = graph->messages[graph->current];
+
+	for(i = 0; i < graph->num_nodes; ++i){
+		num_variables = graph->node_num_vars[i];
+		belief = beliefs + MAX_STATES * i;
+		for(k = 0; k < num_variables; ++k){
+			belief[k] = graph->node_states[MAX_STATES * i + k];
+		}
+		for(j = graph->in_offsets[i]; j < graph->in_offsets[i + 1]; ++j){
+			for(k = 0; k < num_variables; ++k){
+				belief[k] *= messages[MAX_STATES * graph->in_slots[j] + k];
+			}
+		}
+		sum = 0.0f;
+		for(k = 0; k < num_variables; ++k){
+			sum += belief[k];
+		}
+		if(sum <= 0.0f){
+			sum = 1.0f;
+		}
+		for(k = 0; k < num_variables; ++k){
+			belief[k] = belief[k] / sum;
+		}
+	}
+}
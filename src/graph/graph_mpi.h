@@ -0,0 +1,65 @@
+/*
+ * graph_mpi.h
+ *
+ * Distributed-memory loopy BP: every rank owns a contiguous block of global node ids and the edges those nodes send on.
+ */
+
+#ifndef GRAPH_MPI_H_
+#define GRAPH_MPI_H_
+
+#include <mpi.h>
+
+#include "graph.h"
+
+struct distributed_graph {
+	MPI_Comm comm;
+	int rank;
+	int num_ranks;
+
+	unsigned int * node_offsets;
+	unsigned int first_node;
+	unsigned int num_nodes;
+	unsigned int total_num_edges;
+	unsigned int * nodes;
+
+	unsigned int * node_num_vars;
+	float * node_states;
+
+	unsigned int num_edges;
+	unsigned int * out_offsets;
+	unsigned int * edges_dest_index;
+	unsigned int * edges_x_dim;
+	unsigned int * edges_y_dim;
+	float * edges_joint_probabilities;
+
+	unsigned int * in_offsets;
+	unsigned int * in_slots;
+
+	unsigned int num_boundary_nodes;
+	unsigned int * node_order;
+
+	unsigned int num_ghosts;
+	unsigned int * send_offsets;
+	unsigned int * send_edges;
+	unsigned int * recv_offsets;
+	float * send_buffer;
+	MPI_Request * requests;
+	int num_requests;
+
+	float * messages[2];
+	unsigned int current;
+};
+typedef struct distributed_graph* DistributedGraph_t;
+
+DistributedGraph_t create_distributed_graph(MPI_Comm, unsigned int num_nodes, unsigned int * num_vars, float * node_states,
+											unsigned int num_edges, unsigned int * edges_src, unsigned int * edges_dest,
+											unsigned int * x_dim, unsigned int * y_dim, float * joint_probabilities);
+DistributedGraph_t distribute_graph(Graph_t, MPI_Comm);
+DistributedGraph_t generate_distributed_graph(MPI_Comm, unsigned int nodes_per_rank, unsigned int edges_per_node, float local_fraction, unsigned int seed);
+void distributed_graph_destroy(DistributedGraph_t);
+
+void init_previous_edge_distributed(DistributedGraph_t);
+unsigned int loopy_propagate_until_distributed(DistributedGraph_t, float convergence, unsigned int max_iterations);
+void marginalize_distributed_nodes(DistributedGraph_t, float * beliefs);
+
+#endif /* GRAPH_MPI_H_ */
@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <mpi.h>
+
+#include "../bnf-xml-parser/xml-expression.h"
+#include "../graph/graph_mpi.h"
+
+#define EDGES_PER_NODE 2
+#define LOCAL_EDGE_FRACTION 0.9f
+
+void run_test_loopy_belief_propagation_distributed_generated(unsigned int nodes_per_rank, FILE * out){
+	DistributedGraph_t graph;
+	double start, end;
+	unsigned int num_iterations, total_num_nodes;
+
+	graph = generate_distributed_graph(MPI_COMM_WORLD, nodes_per_rank, EDGES_PER_NODE, LOCAL_EDGE_FRACTION, 42);
+	assert(graph != NULL);
+	total_num_nodes = graph->node_offsets[graph->num_ranks];
+
+	MPI_Barrier(MPI_COMM_WORLD);
+	start = MPI_Wtime();
+	init_previous_edge_distributed(graph);
+
+	num_iterations = loopy_propagate_until_distributed(graph, PRECISION, NUM_ITERATIONS);
+	end = MPI_Wtime();
+
+	if(graph->rank == 0){
+		fprintf(out, "generated_%d_per_rank,loopy-mpi-%d,%d,%d,%d,%d,%lf\n", nodes_per_rank, graph->num_ranks, total_num_nodes, graph->total_num_edges, -1, num_iterations, end - start);
+		fflush(out);
+	}
+
+	distributed_graph_destroy(graph);
+}
+
+void run_test_loopy_belief_propagation_distributed_xml_file(const char * file_name, FILE * out){
+	Graph_t graph;
+	DistributedGraph_t distributed;
+	double start, end;
+	unsigned int num_iterations;
+
+	//every rank parses the file and keeps only its own part
+	graph = parse_xml_file(file_name);
+	assert(graph != NULL);
+
+	set_up_src_nodes_to_edges(graph);
+	set_up_dest_nodes_to_edges(graph);
+
+	distributed = distribute_graph(graph, MPI_COMM_WORLD);
+
+	MPI_Barrier(MPI_COMM_WORLD);
+	start = MPI_Wtime();
+	init_previous_edge_distributed(distributed);
+
+	num_iterations = loopy_propagate_until_distributed(distributed, PRECISION, NUM_ITERATIONS);
+	end = MPI_Wtime();
+
+	if(distributed->rank == 0){
+		fprintf(out, "%s,loopy-mpi-%d,%d,%d,%d,%d,%lf\n", file_name, distributed->num_ranks, graph->current_num_vertices, graph->current_num_edges, graph->diameter, num_iterations, end - start);
+		fflush(out);
+	}
+
+	distributed_graph_destroy(distributed);
+	graph_destroy(graph);
+}
+
+/**
+ * Weak scaling: every rank gets the same number of generated nodes, so the run time should stay flat as ranks are added.
+ * Run with mpirun -np N mpi_benchmark [file.xml ...]; xml files given on the command line are split across the ranks too.
+ */
+int main(int argc, char ** argv)
+{
+	int i, rank;
+	FILE * out;
+
+	MPI_Init(&argc, &argv);
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+	out = NULL;
+	if(rank == 0){
+		out = fopen("mpi_benchmark.csv", "w");
+		assert(out);
+		fprintf(out, "File Name,Propagation Type,Number of Nodes,Number of Edges,Diameter,Number of Iterations,BP Run Time(s)\n");
+		fflush(out);
+	}
+
+	run_test_loopy_belief_propagation_distributed_generated(10000, out);
+	run_test_loopy_belief_propagation_distributed_generated(50000, out);
+	run_test_loopy_belief_propagation_distributed_generated(200000, out);
+
+	for(i = 1; i < argc; ++i){
+		run_test_loopy_belief_propagation_distributed_xml_file(argv[i], out);
+	}
+
+	if(rank == 0){
+		fclose(out);
+	}
+
+	MPI_Finalize();
+
+	return 0;
+}
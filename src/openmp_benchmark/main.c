@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <assert.h>
 #include <time.h>
+#include <omp.h>
 
 #include "../bnf-parser/expression.h"
 #include "../bnf-parser/Parser.h"
@@ -260,37 +261,487 @@ void run_test_belief_propagation_xml_file(const char * file_name, FILE * out){
 }
 
 
+void run_test_belief_propagation_tasks(struct expression * expression, const char * file_name, FILE * out){
+	Graph_t graph;
+	clock_t start, end;
+	double time_elapsed;
+
+	graph = build_graph(expression);
+	assert(graph != NULL);
+
+	set_up_src_nodes_to_edges(graph);
+	set_up_dest_nodes_to_edges(graph);
+
+	start = clock();
+	propagate_using_tasks(graph);
+	end = clock();
+
+	time_elapsed = (double)(end - start) / CLOCKS_PER_SEC;
+	fprintf(out, "%s,regular-tasks,%d,%d,%d,2,%lf\n", file_name, graph->current_num_vertices, graph->current_num_edges, graph->diameter, time_elapsed);
+	fflush(out);
+
+	graph_destroy(graph);
+}
+
+void run_test_belief_propagation_tasks_xml_file(const char * file_name, FILE * out){
+	Graph_t graph;
+	clock_t start, end;
+	double time_elapsed;
+
+	graph = parse_xml_file(file_name);
+	assert(graph != NULL);
+
+	set_up_src_nodes_to_edges(graph);
+	set_up_dest_nodes_to_edges(graph);
+
+	start = clock();
+	propagate_using_tasks(graph);
+	end = clock();
+
+	time_elapsed = (double)(end - start) / CLOCKS_PER_SEC;
+	fprintf(out, "%s,regular-tasks,%d,%d,%d,2,%lf\n", file_name, graph->current_num_vertices, graph->current_num_edges, graph->diameter, time_elapsed);
+	fflush(out);
+
+	graph_destroy(graph);
+}
+
 void run_test_loopy_belief_propagation(struct expression * expression, const char * file_name, FILE * out){
 	Graph_t graph;
 	clock_t start, end;
 	double time_elapsed;
 	unsigned int num_iterations;
 
-	graph = build_graph(expression);
+	graph = build_graph(expression);
+	assert(graph != NULL);
+	//print_nodes(graph);
+	//print_edges(graph);
+
+	set_up_src_nodes_to_edges(graph);
+	set_up_dest_nodes_to_edges(graph);
+	//calculate_diameter(graph);
+
+	start = clock();
+	init_previous_edge(graph);
+
+	num_iterations = loopy_propagate_until(graph, PRECISION, NUM_ITERATIONS);
+	end = clock();
+
+	time_elapsed = (double)(end - start)/CLOCKS_PER_SEC;
+	//print_nodes(graph);
+	fprintf(out, "%s,loopy,%d,%d,%d,%d,%lf\n", file_name, graph->current_num_vertices, graph->current_num_edges, graph->diameter, num_iterations, time_elapsed);
+    fflush(out);
+
+	graph_destroy(graph);
+}
+
+
+/**
+ * Wall time per iteration of loopy_propagate_until; on alarm/insurance-sized networks this is dominated by
+ * synchronization rather than message work. clock() would add up the time of every spinning thread, so omp_get_wtime is used.
+ */
+void run_test_loopy_iteration_overhead(struct expression * expression, const char * file_name, FILE * out){
+	Graph_t graph;
+	double start, end;
+	unsigned int num_iterations;
+
+	graph = build_graph(expression);
+	assert(graph != NULL);
+
+	set_up_src_nodes_to_edges(graph);
+	set_up_dest_nodes_to_edges(graph);
+	init_previous_edge(graph);
+
+	start = omp_get_wtime();
+	num_iterations = loopy_propagate_until(graph, PRECISION, NUM_ITERATIONS);
+	end = omp_get_wtime();
+
+	fprintf(out, "%s,loopy-per-iteration-%d,%d,%d,%d,%d,%lf\n", file_name, omp_get_max_threads(), graph->current_num_vertices, graph->current_num_edges, graph->diameter, num_iterations,
+			(end - start) / (num_iterations + 1));
+	fflush(out);
+
+	graph_destroy(graph);
+}
+
+void run_test_junction_tree(struct expression * expression, const char * file_name, FILE * out){
+	Graph_t graph;
+	JunctionTree_t tree;
+	clock_t start, end;
+	double time_elapsed;
+	unsigned int i;
+	unsigned int * nodes;
+	float * beliefs;
+
+	graph = build_graph(expression);
+	assert(graph != NULL);
+
+	set_up_src_nodes_to_edges(graph);
+	set_up_dest_nodes_to_edges(graph);
+
+	start = clock();
+	tree = create_junction_tree(graph);
+	if(tree == NULL){
+		//too wide to solve exactly
+		graph_destroy(graph);
+		return;
+	}
+
+	nodes = (unsigned int *)malloc(sizeof(unsigned int) * graph->current_num_vertices);
+	assert(nodes);
+	beliefs = (float *)malloc(sizeof(float) * MAX_STATES * graph->current_num_vertices);
+	assert(beliefs);
+	for(i = 0; i < graph->current_num_vertices; ++i){
+		nodes[i] = i;
+	}
+
+	junction_tree_propagate(tree, graph);
+	junction_tree_marginalize_nodes(tree, graph, nodes, graph->current_num_vertices, beliefs);
+	end = clock();
+
+	time_elapsed = (double)(end - start)/CLOCKS_PER_SEC;
+	fprintf(out, "%s,junction-tree,%d,%d,%d,2,%lf\n", file_name, graph->current_num_vertices, graph->current_num_edges, graph->diameter, time_elapsed);
+	fflush(out);
+
+	free(nodes);
+	free(beliefs);
+	junction_tree_destroy(tree);
+	graph_destroy(graph);
+}
+
+void run_test_loopy_belief_propagation_xml_file(const char * file_name, FILE * out){
+	Graph_t graph;
+	clock_t start, end;
+	double time_elapsed;
+	unsigned int num_iterations;
+
+	graph = parse_xml_file(file_name);
+	assert(graph != NULL);
+	//print_nodes(graph);
+	//print_edges(graph);
+
+	set_up_src_nodes_to_edges(graph);
+	set_up_dest_nodes_to_edges(graph);
+	//calculate_diameter(graph);
+
+	start = clock();
+	init_previous_edge(graph);
+
+	num_iterations = loopy_propagate_until(graph, PRECISION, NUM_ITERATIONS);
+	end = clock();
+
+	time_elapsed = (double)(end - start)/CLOCKS_PER_SEC;
+	//print_nodes(graph);
+	fprintf(out, "%s,loopy,%d,%d,%d,%d,%lf\n", file_name, graph->current_num_vertices, graph->current_num_edges, graph->diameter, num_iterations, time_elapsed);
+	fflush(out);
+
+	graph_destroy(graph);
+}
+
+void run_test_loopy_belief_propagation_edge_xml_file(const char * file_name, FILE * out){
+	Graph_t graph;
+	clock_t start, end;
+	double time_elapsed;
+	unsigned int num_iterations;
+
+	graph = parse_xml_file(file_name);
+	assert(graph != NULL);
+	//print_nodes(graph);
+	//print_edges(graph);
+
+	set_up_src_nodes_to_edges(graph);
+	set_up_dest_nodes_to_edges(graph);
+	//calculate_diameter(graph);
+
+	start = clock();
+	init_previous_edge(graph);
+
+	num_iterations = loopy_propagate_until_edge(graph, PRECISION, NUM_ITERATIONS);
+	end = clock();
+
+	time_elapsed = (double)(end - start)/CLOCKS_PER_SEC;
+	//print_nodes(graph);
+	fprintf(out, "%s,loopy-edge,%d,%d,%d,%d,%lf\n", file_name, graph->current_num_vertices, graph->current_num_edges, graph->diameter, num_iterations, time_elapsed);
+	fflush(out);
+
+	graph_destroy(graph);
+}
+
+void run_test_loopy_belief_propagation_damped_xml_file(const char * file_name, FILE * out){
+	Graph_t graph;
+	clock_t start, end;
+	double time_elapsed;
+	unsigned int num_iterations, num_damped_iterations;
+
+	graph = parse_xml_file(file_name);
+	assert(graph != NULL);
+
+	set_up_src_nodes_to_edges(graph);
+	set_up_dest_nodes_to_edges(graph);
+
+	start = clock();
+	init_previous_edge(graph);
+
+	num_iterations = loopy_propagate_until_damped(graph, PRECISION, NUM_ITERATIONS, &num_damped_iterations);
+	end = clock();
+
+	time_elapsed = (double)(end - start)/CLOCKS_PER_SEC;
+	fprintf(out, "%s,loopy-damped-%d,%d,%d,%d,%d,%lf\n", file_name, num_damped_iterations, graph->current_num_vertices, graph->current_num_edges, graph->diameter, num_iterations, time_elapsed);
+	fflush(out);
+
+	graph_destroy(graph);
+}
+
+void run_test_loopy_belief_propagation_undamped_xml_file(const char * file_name, FILE * out){
+	Graph_t graph;
+	clock_t start, end;
+	double time_elapsed;
+	unsigned int num_iterations;
+
+	graph = parse_xml_file(file_name);
+	assert(graph != NULL);
+
+	set_up_src_nodes_to_edges(graph);
+	set_up_dest_nodes_to_edges(graph);
+
+	start = clock();
+	init_previous_edge(graph);
+
+	//baseline for the loopy-damped row next to it
+	num_iterations = loopy_propagate_until(graph, PRECISION, NUM_ITERATIONS);
+	end = clock();
+
+	time_elapsed = (double)(end - start)/CLOCKS_PER_SEC;
+	fprintf(out, "%s,loopy-undamped,%d,%d,%d,%d,%lf\n", file_name, graph->current_num_vertices, graph->current_num_edges, graph->diameter, num_iterations, time_elapsed);
+	fflush(out);
+
+	graph_destroy(graph);
+}
+
+void run_test_loopy_belief_propagation_active_xml_file(const char * file_name, FILE * out){
+	Graph_t graph;
+	clock_t start, end;
+	double time_elapsed;
+	unsigned int num_iterations;
+
+	graph = parse_xml_file(file_name);
+	assert(graph != NULL);
+
+	set_up_src_nodes_to_edges(graph);
+	set_up_dest_nodes_to_edges(graph);
+
+	start = clock();
+	init_previous_edge(graph);
+
+	num_iterations = loopy_propagate_until_active(graph, PRECISION, NUM_ITERATIONS);
+	end = clock();
+
+	time_elapsed = (double)(end - start)/CLOCKS_PER_SEC;
+	fprintf(out, "%s,loopy-active,%d,%d,%d,%d,%lf\n", file_name, graph->current_num_vertices, graph->current_num_edges, graph->diameter, num_iterations, time_elapsed);
+	fflush(out);
+
+	graph_destroy(graph);
+}
+
+void run_test_loopy_belief_propagation_incremental_xml_file(const char * file_name, FILE * out){
+	Graph_t graph;
+	clock_t start, end;
+	double time_elapsed;
+	unsigned int num_iterations, changed_node;
+	float state[MAX_STATES];
+
+	graph = parse_xml_file(file_name);
+	assert(graph != NULL);
+
+	set_up_src_nodes_to_edges(graph);
+	set_up_dest_nodes_to_edges(graph);
+
+	init_previous_edge(graph);
+	loopy_propagate_until(graph, PRECISION, NUM_ITERATIONS);
+
+	//hard evidence on the first node, then only the region it reaches is re-propagated
+	changed_node = 0;
+	memset(state, 0, sizeof(float) * MAX_STATES);
+	state[0] = 1.0f;
+
+	start = clock();
+	graph_set_node_state(graph, changed_node, graph->node_num_vars[changed_node], state);
+
+	num_iterations = loopy_propagate_evidence_change(graph, &changed_node, 1, PRECISION, NUM_ITERATIONS);
+	end = clock();
+
+	time_elapsed = (double)(end - start)/CLOCKS_PER_SEC;
+	fprintf(out, "%s,loopy-incremental,%d,%d,%d,%d,%lf\n", file_name, graph->current_num_vertices, graph->current_num_edges, graph->diameter, num_iterations, time_elapsed);
+	fflush(out);
+
+	graph_destroy(graph);
+}
+
+void run_test_loopy_belief_propagation_warm_xml_file(const char * file_name, FILE * out){
+	Graph_t graph;
+	clock_t start, end;
+	double time_elapsed;
+	unsigned int num_iterations;
+	float state[MAX_STATES];
+	float * messages;
+
+	graph = parse_xml_file(file_name);
+	assert(graph != NULL);
+
+	set_up_src_nodes_to_edges(graph);
+	set_up_dest_nodes_to_edges(graph);
+
+	init_previous_edge(graph);
+	loopy_propagate_until(graph, PRECISION, NUM_ITERATIONS);
+
+	messages = (float *)malloc(sizeof(float) * MAX_STATES * graph->current_num_edges);
+	assert(messages);
+	save_edge_messages(graph, messages);
+
+	//new evidence on the first node, solved from the previous answer
+	memset(state, 0, sizeof(float) * MAX_STATES);
+	state[0] = 1.0f;
+	graph_set_node_state(graph, 0, graph->node_num_vars[0], state);
+
+	start = clock();
+	init_previous_edge_from_messages(graph, messages);
+
+	num_iterations = loopy_propagate_until(graph, PRECISION, NUM_ITERATIONS);
+	end = clock();
+
+	time_elapsed = (double)(end - start)/CLOCKS_PER_SEC;
+	fprintf(out, "%s,loopy-warm,%d,%d,%d,%d,%lf\n", file_name, graph->current_num_vertices, graph->current_num_edges, graph->diameter, num_iterations, time_elapsed);
+	fflush(out);
+
+	free(messages);
+	graph_destroy(graph);
+}
+
+void run_test_loopy_belief_propagation_batched_xml_file(const char * file_name, FILE * out){
+	Graph_t graph;
+	EvidenceBatch_t batch;
+	clock_t start, end;
+	double time_elapsed;
+	unsigned int num_iterations, query, node_index;
+	float state[MAX_STATES];
+
+	graph = parse_xml_file(file_name);
+	assert(graph != NULL);
+
+	set_up_src_nodes_to_edges(graph);
+	set_up_dest_nodes_to_edges(graph);
+
+	//query q observes the first state of node q
+	batch = create_evidence_batch(graph, EVIDENCE_BATCH_SIZE);
+	memset(state, 0, sizeof(float) * MAX_STATES);
+	state[0] = 1.0f;
+	for(query = 0; query < EVIDENCE_BATCH_SIZE; ++query){
+		node_index = query % graph->current_num_vertices;
+		evidence_batch_set_node_state(graph, batch, query, node_index, state);
+	}
+
+	start = clock();
+	init_previous_edge_batched(graph, batch);
+
+	num_iterations = loopy_propagate_until_batched(graph, batch, PRECISION, NUM_ITERATIONS);
+	end = clock();
+
+	time_elapsed = (double)(end - start)/CLOCKS_PER_SEC;
+	fprintf(out, "%s,loopy-batched-%d,%d,%d,%d,%d,%lf\n", file_name, EVIDENCE_BATCH_SIZE, graph->current_num_vertices, graph->current_num_edges, graph->diameter, num_iterations, time_elapsed);
+	fflush(out);
+
+	evidence_batch_destroy(batch);
+	graph_destroy(graph);
+}
+
+void run_test_loopy_belief_propagation_overlay_xml_file(const char * file_name, FILE * out){
+	Graph_t graph;
+	EvidenceOverlay_t overlay;
+	clock_t start, end;
+	double time_elapsed;
+	unsigned int num_iterations, changed_node;
+	float state[MAX_STATES];
+
+	graph = parse_xml_file(file_name);
+	assert(graph != NULL);
+
+	set_up_src_nodes_to_edges(graph);
+	set_up_dest_nodes_to_edges(graph);
+
+	init_previous_edge(graph);
+	loopy_propagate_until(graph, PRECISION, NUM_ITERATIONS);
+
+	//what-if scenario on top of the converged base: hard evidence on the first node
+	changed_node = 0;
+	memset(state, 0, sizeof(float) * MAX_STATES);
+	state[0] = 1.0f;
+
+	start = clock();
+	overlay = create_evidence_overlay(graph);
+	evidence_overlay_set_node_state(overlay, changed_node, state);
+
+	num_iterations = evidence_overlay_propagate(overlay, &changed_node, 1, PRECISION, NUM_ITERATIONS);
+	end = clock();
+
+	time_elapsed = (double)(end - start)/CLOCKS_PER_SEC;
+	fprintf(out, "%s,loopy-overlay,%d,%d,%d,%d,%lf\n", file_name, graph->current_num_vertices, graph->current_num_edges, graph->diameter, num_iterations, time_elapsed);
+	fflush(out);
+
+	evidence_overlay_destroy(overlay);
+	graph_destroy(graph);
+}
+
+void run_test_loopy_belief_propagation_partitioned_xml_file(const char * file_name, FILE * out){
+	Graph_t graph;
+	clock_t start, end;
+	double time_elapsed;
+	unsigned int num_iterations;
+
+	graph = parse_xml_file(file_name);
 	assert(graph != NULL);
-	//print_nodes(graph);
-	//print_edges(graph);
 
 	set_up_src_nodes_to_edges(graph);
 	set_up_dest_nodes_to_edges(graph);
-	//calculate_diameter(graph);
 
 	start = clock();
+	//one part per thread
+	init_partitions_to_nodes(graph, omp_get_max_threads());
 	init_previous_edge(graph);
 
-	num_iterations = loopy_propagate_until(graph, PRECISION, NUM_ITERATIONS);
+	num_iterations = loopy_propagate_until_partitioned(graph, PRECISION, NUM_ITERATIONS);
 	end = clock();
 
 	time_elapsed = (double)(end - start)/CLOCKS_PER_SEC;
-	//print_nodes(graph);
-	fprintf(out, "%s,loopy,%d,%d,%d,%d,%lf\n", file_name, graph->current_num_vertices, graph->current_num_edges, graph->diameter, num_iterations, time_elapsed);
-    fflush(out);
+	fprintf(out, "%s,loopy-partitioned-%d,%d,%d,%d,%d,%lf\n", file_name, graph->num_partitions, graph->current_num_vertices, graph->current_num_edges, graph->diameter, num_iterations, time_elapsed);
+	fflush(out);
 
 	graph_destroy(graph);
 }
 
+void run_test_loopy_belief_propagation_blocked_xml_file(const char * file_name, FILE * out){
+	Graph_t graph;
+	clock_t start, end;
+	double time_elapsed;
+	unsigned int num_iterations;
 
-void run_test_loopy_belief_propagation_xml_file(const char * file_name, FILE * out){
+	graph = parse_xml_file(file_name);
+	assert(graph != NULL);
+
+	set_up_src_nodes_to_edges(graph);
+	set_up_dest_nodes_to_edges(graph);
+
+	start = clock();
+	init_previous_edge(graph);
+
+	num_iterations = loopy_propagate_until_blocked(graph, PRECISION, NUM_ITERATIONS);
+	end = clock();
+
+	time_elapsed = (double)(end - start)/CLOCKS_PER_SEC;
+	fprintf(out, "%s,loopy-blocked-%d,%d,%d,%d,%d,%lf\n", file_name, graph->num_partitions, graph->current_num_vertices, graph->current_num_edges, graph->diameter, num_iterations, time_elapsed);
+	fflush(out);
+
+	graph_destroy(graph);
+}
+
+void run_test_loopy_belief_propagation_colored_xml_file(const char * file_name, FILE * out){
 	Graph_t graph;
 	clock_t start, end;
 	double time_elapsed;
@@ -298,28 +749,25 @@ void run_test_loopy_belief_propagation_xml_file(const char * file_name, FILE * o
 
 	graph = parse_xml_file(file_name);
 	assert(graph != NULL);
-	//print_nodes(graph);
-	//print_edges(graph);
 
 	set_up_src_nodes_to_edges(graph);
 	set_up_dest_nodes_to_edges(graph);
-	//calculate_diameter(graph);
 
 	start = clock();
 	init_previous_edge(graph);
+	init_colors_to_nodes(graph);
 
-	num_iterations = loopy_propagate_until(graph, PRECISION, NUM_ITERATIONS);
+	num_iterations = loopy_propagate_until_colored(graph, PRECISION, NUM_ITERATIONS);
 	end = clock();
 
 	time_elapsed = (double)(end - start)/CLOCKS_PER_SEC;
-	//print_nodes(graph);
-	fprintf(out, "%s,loopy,%d,%d,%d,%d,%lf\n", file_name, graph->current_num_vertices, graph->current_num_edges, graph->diameter, num_iterations, time_elapsed);
+	fprintf(out, "%s,loopy-colored,%d,%d,%d,%d,%lf\n", file_name, graph->current_num_vertices, graph->current_num_edges, graph->diameter, num_iterations, time_elapsed);
 	fflush(out);
 
 	graph_destroy(graph);
 }
 
-void run_test_loopy_belief_propagation_edge_xml_file(const char * file_name, FILE * out){
+void run_test_loopy_belief_propagation_splash_xml_file(const char * file_name, FILE * out){
 	Graph_t graph;
 	clock_t start, end;
 	double time_elapsed;
@@ -327,24 +775,244 @@ void run_test_loopy_belief_propagation_edge_xml_file(const char * file_name, FIL
 
 	graph = parse_xml_file(file_name);
 	assert(graph != NULL);
-	//print_nodes(graph);
-	//print_edges(graph);
 
 	set_up_src_nodes_to_edges(graph);
 	set_up_dest_nodes_to_edges(graph);
-	//calculate_diameter(graph);
 
 	start = clock();
 	init_previous_edge(graph);
 
-	num_iterations = loopy_propagate_until_edge(graph, PRECISION, NUM_ITERATIONS);
+	num_iterations = splash_propagate_until(graph, PRECISION, NUM_ITERATIONS, SPLASH_SIZE);
 	end = clock();
 
 	time_elapsed = (double)(end - start)/CLOCKS_PER_SEC;
-	//print_nodes(graph);
-	fprintf(out, "%s,loopy-edge,%d,%d,%d,%d,%lf\n", file_name, graph->current_num_vertices, graph->current_num_edges, graph->diameter, num_iterations, time_elapsed);
+	fprintf(out, "%s,splash,%d,%d,%d,%d,%lf\n", file_name, graph->current_num_vertices, graph->current_num_edges, graph->diameter, num_iterations, time_elapsed);
+	fflush(out);
+
+	graph_destroy(graph);
+}
+
+void run_test_loopy_belief_propagation_components_xml_file(const char * file_name, FILE * out){
+	Graph_t graph;
+	clock_t start, end;
+	double time_elapsed;
+	unsigned int num_iterations;
+
+	graph = parse_xml_file(file_name);
+	assert(graph != NULL);
+
+	set_up_src_nodes_to_edges(graph);
+	set_up_dest_nodes_to_edges(graph);
+
+	start = clock();
+	init_previous_edge(graph);
+	init_components_to_nodes(graph);
+
+	num_iterations = loopy_propagate_until_components(graph, PRECISION, NUM_ITERATIONS);
+	end = clock();
+
+	time_elapsed = (double)(end - start)/CLOCKS_PER_SEC;
+	fprintf(out, "%s,loopy-components,%d,%d,%d,%d,%lf\n", file_name, graph->current_num_vertices, graph->current_num_edges, graph->diameter, num_iterations, time_elapsed);
+	fflush(out);
+
+	graph_destroy(graph);
+}
+
+void run_test_loopy_belief_propagation_core_xml_file(const char * file_name, FILE * out){
+	Graph_t graph;
+	clock_t start, end;
+	double time_elapsed;
+	unsigned int num_iterations;
+
+	graph = parse_xml_file(file_name);
+	assert(graph != NULL);
+
+	set_up_src_nodes_to_edges(graph);
+	set_up_dest_nodes_to_edges(graph);
+
+	start = clock();
+	init_previous_edge(graph);
+	init_core_levels_to_nodes(graph);
+
+	num_iterations = loopy_propagate_until_core(graph, PRECISION, NUM_ITERATIONS);
+	end = clock();
+
+	time_elapsed = (double)(end - start)/CLOCKS_PER_SEC;
+	fprintf(out, "%s,loopy-core,%d,%d,%d,%d,%lf\n", file_name, graph->current_num_vertices, graph->current_num_edges, graph->diameter, num_iterations, time_elapsed);
+	fflush(out);
+
+	graph_destroy(graph);
+}
+
+void run_test_loopy_belief_propagation_absorbed_xml_file(const char * file_name, FILE * out){
+	Graph_t graph;
+	clock_t start, end;
+	double time_elapsed;
+	unsigned int num_iterations;
+
+	graph = parse_xml_file(file_name);
+	assert(graph != NULL);
+
+	set_up_src_nodes_to_edges(graph);
+	set_up_dest_nodes_to_edges(graph);
+
+	start = clock();
+	absorb_evidence(graph);
+	init_previous_edge(graph);
+
+	num_iterations = loopy_propagate_until(graph, PRECISION, NUM_ITERATIONS);
+	end = clock();
+
+	time_elapsed = (double)(end - start)/CLOCKS_PER_SEC;
+	fprintf(out, "%s,loopy-absorbed,%d,%d,%d,%d,%lf\n", file_name, graph->current_num_vertices, graph->current_num_edges, graph->diameter, num_iterations, time_elapsed);
+	fflush(out);
+
+	graph_destroy(graph);
+}
+
+void run_test_loopy_belief_propagation_pruned(struct expression * expression, const char * file_name, FILE * out){
+	Graph_t graph, pruned;
+	clock_t start, end;
+	double time_elapsed;
+	unsigned int num_iterations, target;
+	float belief[MAX_STATES];
+
+	graph = build_graph(expression);
+	assert(graph != NULL);
+
+	set_up_src_nodes_to_edges(graph);
+	set_up_dest_nodes_to_edges(graph);
+
+	//single-node query on the first variable
+	target = 0;
+
+	start = clock();
+	pruned = prune_graph_for_query(graph, &target, 1, NULL);
+	init_previous_edge(pruned);
+
+	num_iterations = loopy_propagate_until(pruned, PRECISION, NUM_ITERATIONS);
+
+	//target keeps index 0 after pruning; only its belief is materialized
+	marginalize_loopy_nodes(pruned, &target, 1, belief);
+	end = clock();
+
+	time_elapsed = (double)(end - start)/CLOCKS_PER_SEC;
+	fprintf(out, "%s,loopy-pruned,%d,%d,%d,%d,%lf\n", file_name, pruned->current_num_vertices, pruned->current_num_edges, pruned->diameter, num_iterations, time_elapsed);
+	fflush(out);
+
+	graph_destroy(pruned);
+	graph_destroy(graph);
+}
+
+void run_test_loopy_belief_propagation_pruned_xml_file(const char * file_name, FILE * out){
+	Graph_t graph, pruned;
+	clock_t start, end;
+	double time_elapsed;
+	unsigned int num_iterations, target;
+	float belief[MAX_STATES];
+
+	graph = parse_xml_file(file_name);
+	assert(graph != NULL);
+
+	set_up_src_nodes_to_edges(graph);
+	set_up_dest_nodes_to_edges(graph);
+
+	//single-node query on the first variable
+	target = 0;
+
+	start = clock();
+	pruned = prune_graph_for_query(graph, &target, 1, NULL);
+	init_previous_edge(pruned);
+
+	num_iterations = loopy_propagate_until(pruned, PRECISION, NUM_ITERATIONS);
+
+	//target keeps index 0 after pruning; only its belief is materialized
+	marginalize_loopy_nodes(pruned, &target, 1, belief);
+	end = clock();
+
+	time_elapsed = (double)(end - start)/CLOCKS_PER_SEC;
+	fprintf(out, "%s,loopy-pruned,%d,%d,%d,%d,%lf\n", file_name, pruned->current_num_vertices, pruned->current_num_edges, pruned->diameter, num_iterations, time_elapsed);
+	fflush(out);
+
+	graph_destroy(pruned);
+	graph_destroy(graph);
+}
+
+void run_test_auto(struct expression * expression, const char * file_name, FILE * out){
+	Graph_t graph;
+	clock_t start, end;
+	double time_elapsed;
+	unsigned int i, num_iterations;
+	unsigned int * nodes;
+	float * beliefs;
+	const char * engine;
+
+	graph = build_graph(expression);
+	assert(graph != NULL);
+
+	set_up_src_nodes_to_edges(graph);
+	set_up_dest_nodes_to_edges(graph);
+
+	nodes = (unsigned int *)malloc(sizeof(unsigned int) * graph->current_num_vertices);
+	assert(nodes);
+	beliefs = (float *)malloc(sizeof(float) * MAX_STATES * graph->current_num_vertices);
+	assert(beliefs);
+	for(i = 0; i < graph->current_num_vertices; ++i){
+		nodes[i] = i;
+	}
+
+	start = clock();
+	num_iterations = propagate_until(graph, PRECISION, NUM_ITERATIONS, &engine);
+
+	//both engines answer through the same query
+	marginalize_loopy_nodes(graph, nodes, graph->current_num_vertices, beliefs);
+	end = clock();
+
+	time_elapsed = (double)(end - start)/CLOCKS_PER_SEC;
+	fprintf(out, "%s,auto-%s,%d,%d,%d,%d,%lf\n", file_name, engine, graph->current_num_vertices, graph->current_num_edges, graph->diameter, num_iterations, time_elapsed);
+	fflush(out);
+
+	free(nodes);
+	free(beliefs);
+	graph_destroy(graph);
+}
+
+void run_test_auto_xml_file(const char * file_name, FILE * out){
+	Graph_t graph;
+	clock_t start, end;
+	double time_elapsed;
+	unsigned int i, num_iterations;
+	unsigned int * nodes;
+	float * beliefs;
+	const char * engine;
+
+	graph = parse_xml_file(file_name);
+	assert(graph != NULL);
+
+	set_up_src_nodes_to_edges(graph);
+	set_up_dest_nodes_to_edges(graph);
+
+	nodes = (unsigned int *)malloc(sizeof(unsigned int) * graph->current_num_vertices);
+	assert(nodes);
+	beliefs = (float *)malloc(sizeof(float) * MAX_STATES * graph->current_num_vertices);
+	assert(beliefs);
+	for(i = 0; i < graph->current_num_vertices; ++i){
+		nodes[i] = i;
+	}
+
+	start = clock();
+	num_iterations = propagate_until(graph, PRECISION, NUM_ITERATIONS, &engine);
+
+	//both engines answer through the same query
+	marginalize_loopy_nodes(graph, nodes, graph->current_num_vertices, beliefs);
+	end = clock();
+
+	time_elapsed = (double)(end - start)/CLOCKS_PER_SEC;
+	fprintf(out, "%s,auto-%s,%d,%d,%d,%d,%lf\n", file_name, engine, graph->current_num_vertices, graph->current_num_edges, graph->diameter, num_iterations, time_elapsed);
 	fflush(out);
 
+	free(nodes);
+	free(beliefs);
 	graph_destroy(graph);
 }
 
@@ -357,18 +1025,41 @@ void run_tests_with_file(const char * file_name, unsigned int num_iterations, FI
         run_test_belief_propagation(expr, file_name, out);
     }
 
+    for(i = 0; i < num_iterations; ++i){
+        run_test_belief_propagation_tasks(expr, file_name, out);
+    }
+
     for(i = 0; i < num_iterations; ++i){
         run_test_loopy_belief_propagation(expr, file_name, out);
     }
 
+    for(i = 0; i < num_iterations; ++i){
+        run_test_loopy_iteration_overhead(expr, file_name, out);
+    }
+
+    for(i = 0; i < num_iterations; ++i){
+        run_test_junction_tree(expr, file_name, out);
+    }
+
+    for(i = 0; i < num_iterations; ++i){
+        run_test_loopy_belief_propagation_pruned(expr, file_name, out);
+    }
+
+    for(i = 0; i < num_iterations; ++i){
+        run_test_auto(expr, file_name, out);
+    }
+
     delete_expression(expr);
 }
 
 void run_tests_with_xml_file(const char * file_name, unsigned int num_iterations, FILE * out){
     unsigned int i;
-    /*for(i = 0; i < num_iterations; ++i){
-        run_test_belief_propagation(expr, file_name, out);
-    }*/
+    for(i = 0; i < num_iterations; ++i){
+        run_test_belief_propagation_xml_file(file_name, out);
+    }
+    for(i = 0; i < num_iterations; ++i){
+        run_test_belief_propagation_tasks_xml_file(file_name, out);
+    }
 
     for(i = 0; i < num_iterations; ++i){
         run_test_loopy_belief_propagation_xml_file(file_name, out);
@@ -376,6 +1067,59 @@ void run_tests_with_xml_file(const char * file_name, unsigned int num_iterations
 	for(i = 0; i < num_iterations; ++i){
 		run_test_loopy_belief_propagation_edge_xml_file(file_name, out);
 	}
+	for(i = 0; i < num_iterations; ++i){
+		run_test_loopy_belief_propagation_damped_xml_file(file_name, out);
+	}
+	for(i = 0; i < num_iterations; ++i){
+		run_test_loopy_belief_propagation_undamped_xml_file(file_name, out);
+	}
+	for(i = 0; i < num_iterations; ++i){
+		run_test_loopy_belief_propagation_active_xml_file(file_name, out);
+	}
+
+	for(i = 0; i < num_iterations; ++i){
+		run_test_loopy_belief_propagation_incremental_xml_file(file_name, out);
+	}
+
+	for(i = 0; i < num_iterations; ++i){
+		run_test_loopy_belief_propagation_warm_xml_file(file_name, out);
+	}
+
+	for(i = 0; i < num_iterations; ++i){
+		run_test_loopy_belief_propagation_batched_xml_file(file_name, out);
+	}
+
+	for(i = 0; i < num_iterations; ++i){
+		run_test_loopy_belief_propagation_overlay_xml_file(file_name, out);
+	}
+
+	for(i = 0; i < num_iterations; ++i){
+		run_test_loopy_belief_propagation_partitioned_xml_file(file_name, out);
+	}
+	for(i = 0; i < num_iterations; ++i){
+		run_test_loopy_belief_propagation_blocked_xml_file(file_name, out);
+	}
+	for(i = 0; i < num_iterations; ++i){
+		run_test_loopy_belief_propagation_colored_xml_file(file_name, out);
+	}
+	for(i = 0; i < num_iterations; ++i){
+		run_test_loopy_belief_propagation_splash_xml_file(file_name, out);
+	}
+	for(i = 0; i < num_iterations; ++i){
+		run_test_loopy_belief_propagation_components_xml_file(file_name, out);
+	}
+	for(i = 0; i < num_iterations; ++i){
+		run_test_loopy_belief_propagation_core_xml_file(file_name, out);
+	}
+	for(i = 0; i < num_iterations; ++i){
+		run_test_loopy_belief_propagation_absorbed_xml_file(file_name, out);
+	}
+	for(i = 0; i < num_iterations; ++i){
+		run_test_loopy_belief_propagation_pruned_xml_file(file_name, out);
+	}
+	for(i = 0; i < num_iterations; ++i){
+		run_test_auto_xml_file(file_name, out);
+	}
 }
 
 
@@ -481,6 +1225,9 @@ int main(void)
 
     run_tests_with_xml_file("../benchmark_files/xml/bf_80000_160000_2.xml", 1);*/
 
+    run_tests_with_file("../benchmark_files/medium/alarm.bif", 1, out);
+    run_tests_with_file("../benchmark_files/medium/insurance.bif", 1, out);
+
     run_tests_with_xml_file("../benchmark_files/xml2/10_20.xml", 1, out);
     run_tests_with_xml_file("../benchmark_files/xml2/100_200.xml", 1, out);
     run_tests_with_xml_file("../benchmark_files/xml2/1000_2000.xml", 1, out);